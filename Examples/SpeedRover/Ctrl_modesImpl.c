@@ -36,15 +36,13 @@
 
 #include <StatechartSignals.h>
 
+/** Duration of one time step of the control loop of an ACT in seconds */
+#define CTRL_MODES_TIME_STEP 2
+
 extern bool allow_trans;
 int32_t Ctrl_modesImpl_verbosity_level = 0;
 
 double x_state=0;
-double u=0;
-double target_min=0;
-double target_mean=2.5;
-
-double target_max=5;
 
 Ctrl_modesImpl *Ctrl_modesImpl_Constructor (Ctrl_modesImpl *mepl) {
     strncpy(mepl->machineName, "Ctrl_modes", 128);
@@ -52,6 +50,15 @@ Ctrl_modesImpl *Ctrl_modesImpl_Constructor (Ctrl_modesImpl *mepl) {
 
     AttributeMapper_init(mepl);
 
+    // System, safe mode and controller thread of the continuous dynamics (once for all control modes)
+    mepl->controller = act_impl_controller_alloc(CTRL_MODES_TIME_STEP);
+    if (mepl->controller == NULL) {
+        fprintf(stderr, "\nCtrl_modes: could not create the controller\n");
+        exit(EXIT_FAILURE);
+    }
+    mepl->act = NULL;
+    mepl->mode_signal = CTRL_M3_SIG;
+
     return mepl;
 }
 
@@ -67,94 +74,74 @@ int32_t Ctrl_modesImpl_get_verbosity () {
 ////////////////////////////////////////////
 // Action and guard implementation methods
 ////////////////////////////////////////////
-double feedback() {
-    u = target_mean-x_state;
-    if (u>2){
-        u=2;
+
+/**
+ * Queue the ACT of the control mode on the controller and return at once: RTI_SIG is posted to the active object
+ * once it finished, see Ctrl_modesImpl_at_RTI()
+ */
+static void start_act(Ctrl_modesImpl *mepl,
+                      act_handle *(*action)(act_controller *, QActive *, QSignal),
+                      QSignal mode_signal) {
+    // An earlier ACT still queued or running is finished by the controller first
+    if (mepl->act != NULL) {
+        act_handle_release(mepl->act);
     }
-    else if (u<-2) {
-        u=-2;
+    mepl->mode_signal = mode_signal;
+    mepl->act = action(mepl->controller, mepl->active, RTI_SIG);
+    if (mepl->act == NULL) {
+        LogEvent_log("could not start the ACT \n");
     }
-    return u;
 }
+
 void Ctrl_modesImpl_act_m0 (Ctrl_modesImpl *mepl) {
     //printf("%s.act_m0() go to fast mode\n", mepl->machineName);
-    target_min=15;
-    target_mean=17.5;
-    target_max=20;
-    x_state=x_state+feedback();
+    start_act(mepl, ACT_m0, CTRL_M0_SIG);
 }
 
 void Ctrl_modesImpl_act_m1 (Ctrl_modesImpl *mepl) {
     //printf("%s.act_m1() go to moderate mode\n", mepl->machineName);
-    target_min=10;
-    target_mean=12.5;
-    target_max=15;
-    x_state=x_state+feedback();
-
+    start_act(mepl, ACT_m1, CTRL_M1_SIG);
 }
 
 void Ctrl_modesImpl_act_m2 (Ctrl_modesImpl *mepl) {
     //printf("%s.act_m2() go to slow mode\n", mepl->machineName);
-    target_min=5;
-    target_mean=7.5;
-    target_max=10;
-    x_state=x_state+feedback();
-
+    start_act(mepl, ACT_m2, CTRL_M2_SIG);
 }
 
 void Ctrl_modesImpl_act_m3 (Ctrl_modesImpl *mepl) {
     //printf("%s.act_m3() go to init\n", mepl->machineName);
-    target_min=0;
-    target_mean=2.5;
-    target_max=5;
-    x_state=x_state+feedback();
-
-
+    start_act(mepl, ACT_m3, CTRL_M3_SIG);
 }
 
 void Ctrl_modesImpl_at_RTI (Ctrl_modesImpl *mepl) {
+    // The plant belongs to the controller while the ACT of the mode is queued or running: wait for its completion
+    if (mepl->act == NULL) {
+        return;
+    }
+    int status = act_handle_status(mepl->act);
+    if (status == ACT_QUEUED || status == ACT_RUNNING) {
+        return;
+    }
+    act_handle_release(mepl->act);
+    mepl->act = NULL;
+
+    x_state = gsl_vector_get(mepl->controller->now->x, 0);
     printf("%s.at_RTI() measure x \n", mepl->machineName);
     printf("x =  %lf\n",x_state);
-    if (target_min <= x_state && x_state <= target_max) {
+    if (status == ACT_DONE) {
         allow_trans = true ;
         LogEvent_log("in target \n");
         LogEvent_log("PUSH a BUTTON\n");
-
     }
-    else {
+    else if (status == ACT_FAILED) {
+        // Q_NEW() allocates next available event from size-matched ev POOL
         QEvent *newEv;
         LogEvent_log("not in target \n");
-        if (target_mean == 2.5) {
-            LogEvent_log("Retrigger ctrl_m3");
-            // Q_NEW() allocates next available event from size-matched ev POOL
-            newEv = Q_NEW(QEvent, CTRL_M3_SIG );
-            QF_publish(newEv);
-
-        }
-        else if (target_mean == 7.5) {
-            LogEvent_log("Retrigger ctrl_m2");
-
-            // Q_NEW() allocates next available event from size-matched ev POOL
-                newEv = Q_NEW(QEvent, CTRL_M2_SIG );
-                QF_publish(newEv);
-
-        }
-        else if (target_mean == 12.5) {
-            LogEvent_log("Retrigger ctrl_m1");
-            // Q_NEW() allocates next available event from size-matched ev POOL
-            newEv = Q_NEW(QEvent, CTRL_M1_SIG );
-            QF_publish(newEv);
-        }
-        else if (target_mean == 17.5) {
-            LogEvent_log("Retrigger ctrl_m1");
-            // Q_NEW() allocates next available event from size-matched ev POOL
-            newEv = Q_NEW(QEvent, CTRL_M0_SIG );
-            QF_publish(newEv);
-        }
-
+        LogEvent_log("Retrigger the control mode");
+        newEv = Q_NEW(QEvent, mepl->mode_signal);
+        QF_publish(newEv);
     }
-
+    // ACT_CANCELLED: the controller was freed, nothing to retrigger
 }
 
 void Ctrl_modesImpl_entry (Ctrl_modesImpl *mepl) {
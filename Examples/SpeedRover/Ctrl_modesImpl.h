@@ -29,11 +29,18 @@
 
 #include <qf_port.h>
 #include <qassert.h>
+#include "act_impl.h"
 
 typedef struct Ctrl_modesImpl {
     char machineName[128];
     /** Cache of pointer to the container QActive object, for ease of access */
     QActive *active;
+    /** Controller thread running the ACTs of the control modes (see act_impl.h) */
+    act_controller *controller;
+    /** ACT of the current control mode (NULL: none), its completion posts RTI_SIG */
+    act_handle *act;
+    /** Signal of the current control mode, published again if its ACT did not reach the target */
+    QSignal mode_signal;
 } Ctrl_modesImpl;
 
 Ctrl_modesImpl *Ctrl_modesImpl_Constructor (Ctrl_modesImpl *mepl);  // Default constructor
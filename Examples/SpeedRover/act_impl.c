@@ -3,73 +3,128 @@
 //
 
 #include <stdio.h>
-#include "cimple_controller.h"
+#include <stdlib.h>
+#include <cdd.h>
+#include "act_impl.h"
+#include "cimple_c_from_py.h"
+#include "cimple_mpc_computation.h"
+#include "cimple_safe_mode.h"
+#include "cimple_safe_mode_storage.h"
+#include "cimple_thread_pool.h"
 
-void ACT_m1(current_state * now, discrete_dynamics * d_dyn, system_dynamics * s_dyn, cost_function * f_cost){
-    int target_cell =1;
-    printf("Computing control sequence to go from cell %d to cell m1...", (*now).current_cell);
-    fflush(stdout);
-
-    gsl_matrix * u = gsl_matrix_alloc(now->x->size, d_dyn->time_horizon);
-    get_input(u, now, d_dyn, s_dyn, target_cell, f_cost);
-    printf("Applying it...");
-    fflush(stdout);
-    apply_control(now->x, u, s_dyn->A, s_dyn->B);
-    printf("New state:");
-    gsl_vector_print(now->x, "now->");
-    fflush(stdout);
+/**
+ * "Constructor" Initializes the system and its safe mode and starts the controller thread
+ */
+act_controller *act_impl_controller_alloc(double sec){
+    dd_set_global_constants();
+    system_dynamics *s_dyn;
+    cost_function *f_cost;
+    discrete_dynamics *d_dyn;
+    current_state *now;
+
+    system_alloc(&now, &s_dyn, &f_cost, &d_dyn);
+    system_init(now, s_dyn, f_cost, d_dyn);
+
+    // Precompute the set-up of the control problem for every horizon
+    s_dyn->horizon_family = horizon_family_compute(d_dyn, s_dyn, f_cost);
+
+    // Safe mode: reuse the artefacts of an earlier run whose inputs did not change, recompute the others
+    safe_mode_store *store = safe_mode_store_alloc(s_dyn, (int)d_dyn->time_horizon);
+    safe_mode_store_load(store, SAFE_MODE_FILE);
+    thread_pool *pool = thread_pool_alloc(0);
+    compute_safe_mode(d_dyn, s_dyn, store, pool, NULL, NULL);
+    thread_pool_free(pool);
+    if (store->recomputed > 0 && safe_mode_store_save(store, SAFE_MODE_FILE) != 0){
+        fprintf(stderr, "\nCould not write safe mode artefacts to %s\n", SAFE_MODE_FILE);
+    }
+    safe_mode_store_free(store);
+
+    act_controller *controller = act_controller_alloc(now, d_dyn, s_dyn, f_cost, NULL, sec);
+    if (controller == NULL){
+        system_dynamics_free(s_dyn);
+        discrete_dynamics_free(d_dyn);
+        cost_function_free(f_cost);
+        state_free(now);
+        dd_free_global_constants();
+    }
+    return controller;
+}
+
+/**
+ * "Destructor" Stops the controller and deallocates the system
+ */
+void act_impl_controller_free(act_controller *controller){
+    system_dynamics *s_dyn = controller->s_dyn;
+    cost_function *f_cost = controller->f_cost;
+    discrete_dynamics *d_dyn = controller->d_dyn;
+    current_state *now = controller->now;
+
+    act_controller_free(controller);
     // Clean up!
-    gsl_matrix_free(u);
+    system_dynamics_free(s_dyn);
+    discrete_dynamics_free(d_dyn);
+    cost_function_free(f_cost);
+    state_free(now);
+    dd_free_global_constants();
 }
 
-void ACT_m0(current_state * now, discrete_dynamics * d_dyn, system_dynamics * s_dyn, cost_function * f_cost){
-    int target_cell =0;
-    printf("Computing control sequence to go from cell %d to cell m0...", (*now).current_cell);
-    fflush(stdout);
-
-    gsl_matrix * u = gsl_matrix_alloc(now->x->size, d_dyn->time_horizon);
-    get_input(u, now, d_dyn, s_dyn, target_cell, f_cost);
-    printf("Applying it...");
-    fflush(stdout);
-    apply_control(now->x, u, s_dyn->A, s_dyn->B);
-    printf("New state:");
-    gsl_vector_print(now->x, "now->");
-    fflush(stdout);
+/**
+ * Active object and signal the completion of an ACT is posted to
+ */
+typedef struct act_impl_post{
+
+    QActive *active;
+    QSignal signal;
+
+}act_impl_post;
+
+/**
+ * Completion of an ACT (controller thread): post the signal with the status into the queue of the active object
+ */
+static void act_impl_completion(act_handle *handle, int status, void *context){
+    act_impl_post *post = (act_impl_post *)context;
+    act_impl_event *done = Q_NEW(act_impl_event, post->signal);
+    done->status = status;
+    QActive_postFIFO(post->active, (QEvent *)done);
     // Clean up!
-    gsl_matrix_free(u);
+    free(post);
 }
 
-void ACT_m2(current_state * now, discrete_dynamics * d_dyn, system_dynamics * s_dyn, cost_function * f_cost){
+/**
+ * Queue the ACT to target_cell on the controller thread without waiting for it
+ */
+static act_handle *act_impl_start(act_controller * controller, int target_cell, QActive * active, QSignal done_signal){
+    act_impl_post *post = malloc(sizeof(act_impl_post));
+    if (post == NULL){
+        return NULL;
+    }
+    post->active = active;
+    post->signal = done_signal;
+
+    act_handle *handle = ACT_async(controller, target_cell, act_impl_completion, post);
+    if (handle == NULL){
+        free(post);
+    }
+    return handle;
+}
+
+act_handle *ACT_m1(act_controller * controller, QActive * active, QSignal done_signal){
+    int target_cell =1;
+    return act_impl_start(controller, target_cell, active, done_signal);
+}
+
+act_handle *ACT_m0(act_controller * controller, QActive * active, QSignal done_signal){
+    int target_cell =0;
+    return act_impl_start(controller, target_cell, active, done_signal);
+}
+
+act_handle *ACT_m2(act_controller * controller, QActive * active, QSignal done_signal){
     int target_cell =2;
-    printf("Computing control sequence to go from cell %d to cell m2...", (*now).current_cell);
-    fflush(stdout);
-
-    gsl_matrix * u = gsl_matrix_alloc(now->x->size, d_dyn->time_horizon);
-    get_input(u, now, d_dyn, s_dyn, target_cell, f_cost);
-    printf("Applying it...");
-    fflush(stdout);
-    apply_control(now->x, u, s_dyn->A, s_dyn->B);
-    printf("New state:");
-    gsl_vector_print(now->x, "now->");
-    fflush(stdout);
-    // Clean up!
-    gsl_matrix_free(u);
+    return act_impl_start(controller, target_cell, active, done_signal);
 }
 
-void ACT_m3(current_state * now, discrete_dynamics * d_dyn, system_dynamics * s_dyn, cost_function * f_cost){
+act_handle *ACT_m3(act_controller * controller, QActive * active, QSignal done_signal){
     int target_cell =3;
-    printf("Computing control sequence to go from cell %d to cell m3...", (*now).current_cell);
-    fflush(stdout);
-
-    gsl_matrix * u = gsl_matrix_alloc(now->x->size, d_dyn->time_horizon);
-    get_input(u, now, d_dyn, s_dyn, target_cell, f_cost);
-    printf("Applying it...");
-    fflush(stdout);
-    apply_control(now->x, u, s_dyn->A, s_dyn->B);
-    printf("New state:");
-    gsl_vector_print(now->x, "now->");
-    fflush(stdout);
-    // Clean up!
-    gsl_matrix_free(u);
+    return act_impl_start(controller, target_cell, active, done_signal);
 }
 
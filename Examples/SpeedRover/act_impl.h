@@ -6,14 +6,50 @@
 #define CIMPLE_ACT_IMPL_H
 
 #include <stdio.h>
-#include "cimple_controller.h"
+#include <qf_port.h>
+#include "cimple_act_async.h"
 
-    void ACT_m1(current_state * now, discrete_dynamics * d_dyn, system_dynamics * s_dyn, cost_function * f_cost);
+/**
+ * Event posted once an ACT finished or was cancelled: status tells them apart (see act_status, e.g. ACT_DONE if the
+ * target was reached, ACT_FAILED if not, ACT_CANCELLED if the ACT never started)
+ *
+ * Allocated with Q_NEW() from the event pools of the executive: it fits into the medium-size pool (QEvent and data)
+ * of the autocoded main, no pool of its own is needed.
+ */
+typedef struct act_impl_event{
 
-    void ACT_m0(current_state * now, discrete_dynamics * d_dyn, system_dynamics * s_dyn, cost_function * f_cost);
+    QEvent super;
+    int status;
 
-    void ACT_m2(current_state * now, discrete_dynamics * d_dyn, system_dynamics * s_dyn, cost_function * f_cost);
+}act_impl_event;
 
-    void ACT_m3(current_state * now, discrete_dynamics * d_dyn, system_dynamics * s_dyn, cost_function * f_cost);
+/**
+ * @brief "Constructor" Initializes the system (see cimple_c_from_py.c) and its safe mode and starts the controller
+ *        thread the actions queue their ACT on
+ * @param sec duration of one time step of the control loop in seconds
+ * @return NULL if the controller could not be created
+ */
+act_controller *act_impl_controller_alloc(double sec);
+
+/**
+ * @brief "Destructor" Stops the controller (queued ACTs are cancelled) and deallocates the system
+ * @param controller
+ */
+void act_impl_controller_free(act_controller *controller);
+
+/**
+ * Actions: start the ACT to the target cell on the controller thread and return at once (NULL if it could not be
+ * started). An act_impl_event with done_signal is posted into the queue of active once the ACT finished (or was
+ * cancelled). The state of the plant belongs to the controller until then, the caller checks the returned handle
+ * (act_handle_status()) when the signal arrives and gives it up with act_handle_release().
+ */
+
+    act_handle *ACT_m1(act_controller * controller, QActive * active, QSignal done_signal);
+
+    act_handle *ACT_m0(act_controller * controller, QActive * active, QSignal done_signal);
+
+    act_handle *ACT_m2(act_controller * controller, QActive * active, QSignal done_signal);
+
+    act_handle *ACT_m3(act_controller * controller, QActive * active, QSignal done_signal);
 
 #endif //CIMPLE_ACT_IMPL_H
\ No newline at end of file
@@ -0,0 +1,216 @@
+//
+// Created by L.Jonathan Feldstein
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "cimple_act_async.h"
+#include "cimple_controller.h"
+
+/**
+ * ACT finished or cancelled: completion first (the handle is still valid), then the status (under the lock, a
+ * released handle is deallocated)
+ */
+static void act_finish(act_controller *controller,
+                       act_handle *handle,
+                       int status)
+{
+    if(handle->completion != NULL){
+        handle->completion(handle, status, handle->completion_context);
+    }
+
+    pthread_mutex_lock(&controller->lock);
+    handle->status = status;
+    if(handle->released){
+        free(handle);
+    } else{
+        pthread_cond_broadcast(&controller->finished);
+    }
+    pthread_mutex_unlock(&controller->lock);
+}
+
+/**
+ * Controller thread: runs the queued ACTs in the order of the requests
+ */
+static void *act_controller_work(void *arg)
+{
+    act_controller *controller = (act_controller *)arg;
+
+    pthread_mutex_lock(&controller->lock);
+    while(1){
+        while(!controller->shutdown && controller->head == NULL){
+            pthread_cond_wait(&controller->wake, &controller->lock);
+        }
+        if(controller->shutdown){
+            break;
+        }
+        act_handle *handle = controller->head;
+        controller->head = handle->next;
+        if(controller->head == NULL){
+            controller->tail = NULL;
+        }
+        handle->status = ACT_RUNNING;
+        pthread_mutex_unlock(&controller->lock);
+
+        int reached = ACT(handle->target, controller->now, controller->d_dyn, controller->s_dyn, controller->f_cost,
+                          controller->executor, controller->sec);
+        act_finish(controller, handle, (reached == 0) ? ACT_DONE : ACT_FAILED);
+
+        pthread_mutex_lock(&controller->lock);
+    }
+    pthread_mutex_unlock(&controller->lock);
+
+    return NULL;
+}
+
+/**
+ * "Constructor" Dynamically allocates the controller and starts its thread
+ */
+struct act_controller *act_controller_alloc(current_state *now,
+                                            discrete_dynamics *d_dyn,
+                                            system_dynamics *s_dyn,
+                                            cost_function *f_cost,
+                                            rt_executor *executor,
+                                            double sec)
+{
+    struct act_controller *return_controller = malloc (sizeof (struct act_controller));
+    if (return_controller == NULL){
+        return NULL;
+    }
+
+    return_controller->now = now;
+    return_controller->d_dyn = d_dyn;
+    return_controller->s_dyn = s_dyn;
+    return_controller->f_cost = f_cost;
+    return_controller->executor = executor;
+    return_controller->sec = sec;
+    return_controller->head = NULL;
+    return_controller->tail = NULL;
+    return_controller->shutdown = 0;
+    pthread_mutex_init(&return_controller->lock, NULL);
+    pthread_cond_init(&return_controller->wake, NULL);
+    pthread_cond_init(&return_controller->finished, NULL);
+
+    //The control loop itself runs on the executor, the controller thread only waits for it
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    rt_executor_worker_attributes(&attributes);
+    int err = pthread_create(&return_controller->thread, &attributes, act_controller_work, return_controller);
+    pthread_attr_destroy(&attributes);
+    if(err != 0){
+        pthread_cond_destroy(&return_controller->finished);
+        pthread_cond_destroy(&return_controller->wake);
+        pthread_mutex_destroy(&return_controller->lock);
+        free(return_controller);
+        return NULL;
+    }
+
+    return return_controller;
+}
+
+/**
+ * "Destructor" Cancels the queued ACTs, waits for the running one and deallocates the controller
+ */
+void act_controller_free(act_controller *controller)
+{
+    pthread_mutex_lock(&controller->lock);
+    act_handle *queued = controller->head;
+    controller->head = NULL;
+    controller->tail = NULL;
+    controller->shutdown = 1;
+    pthread_cond_signal(&controller->wake);
+    pthread_mutex_unlock(&controller->lock);
+
+    pthread_join(controller->thread, NULL);
+
+    while(queued != NULL){
+        act_handle *next = queued->next;
+        act_finish(controller, queued, ACT_CANCELLED);
+        queued = next;
+    }
+
+    //Clean up!
+    pthread_cond_destroy(&controller->finished);
+    pthread_cond_destroy(&controller->wake);
+    pthread_mutex_destroy(&controller->lock);
+    free(controller);
+}
+
+/**
+ * Request an ACT to target without blocking
+ */
+struct act_handle *ACT_async(act_controller *controller,
+                             int target,
+                             act_completion completion,
+                             void *completion_context)
+{
+    struct act_handle *return_handle = malloc (sizeof (struct act_handle));
+    if (return_handle == NULL){
+        return NULL;
+    }
+
+    return_handle->controller = controller;
+    return_handle->target = target;
+    return_handle->completion = completion;
+    return_handle->completion_context = completion_context;
+    return_handle->status = ACT_QUEUED;
+    return_handle->released = 0;
+    return_handle->next = NULL;
+
+    pthread_mutex_lock(&controller->lock);
+    if(controller->tail == NULL){
+        controller->head = return_handle;
+    } else{
+        controller->tail->next = return_handle;
+    }
+    controller->tail = return_handle;
+    pthread_cond_signal(&controller->wake);
+    pthread_mutex_unlock(&controller->lock);
+
+    return return_handle;
+}
+
+/**
+ * Current status of the ACT
+ */
+int act_handle_status(act_handle *handle)
+{
+    pthread_mutex_lock(&handle->controller->lock);
+    int status = handle->status;
+    pthread_mutex_unlock(&handle->controller->lock);
+
+    return status;
+}
+
+/**
+ * Block until the ACT finished or was cancelled
+ */
+int act_handle_wait(act_handle *handle)
+{
+    act_controller *controller = handle->controller;
+
+    pthread_mutex_lock(&controller->lock);
+    while(handle->status == ACT_QUEUED || handle->status == ACT_RUNNING){
+        pthread_cond_wait(&controller->finished, &controller->lock);
+    }
+    int status = handle->status;
+    pthread_mutex_unlock(&controller->lock);
+
+    return status;
+}
+
+/**
+ * Give the handle up
+ */
+void act_handle_release(act_handle *handle)
+{
+    act_controller *controller = handle->controller;
+
+    pthread_mutex_lock(&controller->lock);
+    if(handle->status == ACT_DONE || handle->status == ACT_FAILED || handle->status == ACT_CANCELLED){
+        free(handle);
+    } else{
+        handle->released = 1;
+    }
+    pthread_mutex_unlock(&controller->lock);
+}
@@ -0,0 +1,139 @@
+//
+// Created by L.Jonathan Feldstein
+//
+
+#ifndef CIMPLE_CIMPLE_ACT_ASYNC_H
+#define CIMPLE_CIMPLE_ACT_ASYNC_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include "cimple_system.h"
+#include "cimple_rt_executor.h"
+
+/**
+ * Status of an asynchronous ACT
+ */
+enum act_status{
+
+    ACT_QUEUED,     // waiting for the controller thread
+    ACT_RUNNING,    // control loop running
+    ACT_DONE,       // control loop finished, target reached
+    ACT_FAILED,     // control loop finished, target not reached (e.g. no trajectory found)
+    ACT_CANCELLED   // never started (controller freed before)
+
+};
+
+struct act_handle;
+
+/**
+ * Completion of an ACT, called on the controller thread once the control loop finished (or the ACT was cancelled)
+ *
+ * E.g. posts an event into the queue of the state machine that started the ACT. Must not block, the handle is valid
+ * until the callback returns (see act_handle_release()).
+ */
+typedef void (*act_completion)(struct act_handle *handle,
+                               int status,
+                               void *completion_context);
+
+/**
+ * One ACT requested from the controller
+ *
+ * status: see act_status (under the lock of the controller)
+ * released: the caller gave the handle up, the controller frees it after the completion
+ * next: queue of the controller
+ */
+typedef struct act_handle{
+
+    struct act_controller *controller;
+    int target;
+    act_completion completion;
+    void *completion_context;
+
+    int status;
+    int released;
+    struct act_handle *next;
+
+}act_handle;
+
+/**
+ * Controller thread of one plant: runs the requested ACTs one after the other (in the order of the requests)
+ *
+ * ACT_async() only queues the request and returns, the caller (e.g. the action of a state machine) is thus never
+ * blocked by a solve. The state now belongs to the controller while an ACT is queued or running.
+ */
+typedef struct act_controller{
+
+    current_state *now;
+    discrete_dynamics *d_dyn;
+    system_dynamics *s_dyn;
+    cost_function *f_cost;
+    rt_executor *executor;
+    double sec;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t finished;
+    act_handle *head;
+    act_handle *tail;
+    int shutdown;
+
+}act_controller;
+
+/**
+ * @brief "Constructor" Dynamically allocates the controller and starts its thread
+ * @param now state of the plant
+ * @param d_dyn
+ * @param s_dyn
+ * @param f_cost
+ * @param executor executor of the control loops (NULL: a temporary one per ACT, see ACT())
+ * @param sec duration of one time step in seconds
+ * @return NULL if the controller could not be created
+ */
+struct act_controller *act_controller_alloc(current_state *now,
+                                            discrete_dynamics *d_dyn,
+                                            system_dynamics *s_dyn,
+                                            cost_function *f_cost,
+                                            rt_executor *executor,
+                                            double sec);
+
+/**
+ * @brief "Destructor" Cancels the queued ACTs, waits for the running one and deallocates the controller
+ * @param controller
+ */
+void act_controller_free(act_controller *controller);
+
+/**
+ * @brief Request an ACT to target without blocking
+ * @param controller
+ * @param target target region the plant is supposed to reach
+ * @param completion called on the controller thread once the ACT finished (may be NULL)
+ * @param completion_context passed to completion
+ * @return handle (see act_handle_release()), NULL if it could not be allocated
+ */
+struct act_handle *ACT_async(act_controller *controller,
+                             int target,
+                             act_completion completion,
+                             void *completion_context);
+
+/**
+ * @brief Current status of the ACT (never blocks)
+ * @param handle
+ * @return see act_status
+ */
+int act_handle_status(act_handle *handle);
+
+/**
+ * @brief Block until the ACT finished (done or failed) or was cancelled
+ * @param handle
+ * @return see act_status
+ */
+int act_handle_wait(act_handle *handle);
+
+/**
+ * @brief Give the handle up: deallocated now if the ACT finished, by the controller after its completion otherwise
+ * @param handle not used afterwards
+ */
+void act_handle_release(act_handle *handle);
+
+#endif //CIMPLE_CIMPLE_ACT_ASYNC_H
@@ -21,7 +21,7 @@
 
 
 /**
- * @brief Generates random numbers with normal distribution
+ * @brief Generates random numbers with normal distribution (stream of the calling thread, see cimple_random.h)
  * @param mu
  * @param sigma
  * @return
@@ -29,17 +29,4 @@
 double randn (double mu,
               double sigma);
 
-/**
- * @brief Timer simulating one time step in discrete control
- * @param arg
- * @return
- */
-void * timer(void * arg);
-
-/**
- * @brief Breaks infinte loop in a pthread
- * @param mtx
- * @return
- */
-int needQuit(pthread_mutex_t *mtx);
 #endif //CIMPLE_CIMPLE_AUXILIARY_FUNCTIONS_H
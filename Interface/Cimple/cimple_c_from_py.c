@@ -104,50 +104,9 @@ void system_init(current_state *now, system_dynamics *s_dyn,cost_function *f_cos
     memcpy(sys_WSetG, ((double []){0.1,0.1}),2* sizeof(double));
     gsl_vector_from_array(s_dyn->W_set->G, sys_WSetG, "s_dyn->W_set->G");
     free(sys_WSetG);
-    double *sys_help_A_K = malloc(n* time_horizon * n * time_horizon* sizeof (double));
-    memcpy(sys_help_A_K, ((double []){1.0,0.0,0.0,0.0,0.0,1.0,1.0,0.0,0.0,0.0,1.0,1.0,1.0,0.0,0.0,1.0,1.0,1.0,1.0,0.0,1.0,1.0,1.0,1.0,1.0}),25* sizeof(double));
-    gsl_matrix_from_array(s_dyn->aux_matrices->A_K, sys_help_A_K, "s_dyn->aux_matrices->A_K");
-    free(sys_help_A_K);
-    double *sys_help_A_N = malloc(n* time_horizon * n * sizeof (double));
-    memcpy(sys_help_A_N, ((double []){1.0,1.0,1.0,1.0,1.0}),5* sizeof(double));
-    gsl_matrix_from_array(s_dyn->aux_matrices->A_N, sys_help_A_N, "s_dyn->aux_matrices->A_N");
-    free(sys_help_A_N);
-    double *sys_help_E_diag = malloc(n*time_horizon* p*time_horizon* sizeof (double));
-    memcpy(sys_help_E_diag, ((double []){1.0,0.0,0.0,0.0,0.0,0.0,1.0,0.0,0.0,0.0,0.0,0.0,1.0,0.0,0.0,0.0,0.0,0.0,1.0,0.0,0.0,0.0,0.0,0.0,1.0}),25* sizeof(double));
-    gsl_matrix_from_array(s_dyn->aux_matrices->E_diag, sys_help_E_diag, "s_dyn->aux_matrices->E_diag");
-    free(sys_help_E_diag);
-    double *sys_help_B_diag = malloc(n*time_horizon* m*time_horizon* sizeof (double));
-    memcpy(sys_help_B_diag, ((double []){1.0,0.0,0.0,0.0,0.0,0.0,1.0,0.0,0.0,0.0,0.0,0.0,1.0,0.0,0.0,0.0,0.0,0.0,1.0,0.0,0.0,0.0,0.0,0.0,1.0}),25* sizeof(double));
-    gsl_matrix_from_array(s_dyn->aux_matrices->B_diag, sys_help_B_diag, "s_dyn->aux_matrices->B_diag");
-    free(sys_help_B_diag);
-    double *sys_help_K_hat = malloc(n* time_horizon* sizeof (double));
-    memcpy(sys_help_K_hat, ((double []){0.0,0.0,0.0,0.0,0.0}),5* sizeof(double));
-    gsl_vector_from_array(s_dyn->aux_matrices->K_hat, sys_help_K_hat, "s_dyn->aux_matrices->K_hat");
-    free(sys_help_K_hat);
-    double *sys_help_L_default = malloc(n*(time_horizon+1) * (n+m*(time_horizon))* sizeof (double));
-    memcpy(sys_help_L_default, ((double []){1.0,0.0,0.0,0.0,0.0,0.0,1.0,1.0,0.0,0.0,0.0,0.0,1.0,1.0,1.0,0.0,0.0,0.0,1.0,1.0,1.0,1.0,0.0,0.0,1.0,1.0,1.0,1.0,1.0,0.0,1.0,1.0,1.0,1.0,1.0,1.0}),36* sizeof(double));
-    gsl_matrix_from_array(s_dyn->aux_matrices->L_default, sys_help_L_default, "s_dyn->aux_matrices->L_default");
-    free(sys_help_L_default);
-    double *sys_help_E_default = malloc(n* time_horizon* p* time_horizon* sizeof (double));
-    memcpy(sys_help_E_default, ((double []){0.0,0.0,0.0,0.0,0.0,1.0,0.0,0.0,0.0,0.0,1.0,1.0,0.0,0.0,0.0,1.0,1.0,1.0,0.0,0.0,1.0,1.0,1.0,1.0,0.0}),25* sizeof(double));
-    gsl_matrix_from_array(s_dyn->aux_matrices->E_default, sys_help_E_default, "s_dyn->aux_matrices->E_default");
-    free(sys_help_E_default);
-    double *sys_help_Ct = malloc(n*time_horizon*m*time_horizon*sizeof(double));
-    memcpy(sys_help_Ct, ((double []){1.0,0.0,0.0,0.0,0.0,1.0,1.0,0.0,0.0,0.0,1.0,1.0,1.0,0.0,0.0,1.0,1.0,1.0,1.0,0.0,1.0,1.0,1.0,1.0,1.0}),25* sizeof(double));
-    gsl_matrix_from_array(s_dyn->aux_matrices->Ct, sys_help_Ct, "s_dyn->aux_matrices->Ct");
-    free(sys_help_Ct);
-    double *sys_help_MU = malloc(u_set_size*time_horizon * sizeof(double));
-    memcpy(sys_help_MU, ((double []){1.0,1.0,1.0,1.0,1.0,1.0,1.0,1.0,1.0,1.0}),10* sizeof(double));
-    gsl_vector_from_array(s_dyn->aux_matrices->MU, sys_help_MU, "s_dyn->aux_matrices->MU");
-    free(sys_help_MU);
-    double *sys_help_GU = malloc(u_set_size*time_horizon* p*time_horizon* sizeof(double));
-    memcpy(sys_help_GU, ((double []){0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0}),50* sizeof(double));
-    gsl_matrix_from_array(s_dyn->aux_matrices->GU, sys_help_GU,"s_dyn->aux_matrices->GU");
-    free(sys_help_GU);
-    double *sys_help_LU = malloc(u_set_size*time_horizon * (n+m*(time_horizon))* sizeof (double));
-    memcpy(sys_help_LU, ((double []){0.0,1.0,0.0,0.0,0.0,0.0,0.0,-1.0,0.0,0.0,0.0,0.0,0.0,0.0,1.0,0.0,0.0,0.0,0.0,0.0,-1.0,0.0,0.0,0.0,0.0,0.0,0.0,1.0,0.0,0.0,0.0,0.0,0.0,-1.0,0.0,0.0,0.0,0.0,0.0,0.0,1.0,0.0,0.0,0.0,0.0,0.0,-1.0,0.0,0.0,0.0,0.0,0.0,0.0,1.0,0.0,0.0,0.0,0.0,0.0,-1.0}),60* sizeof(double));
-    gsl_matrix_from_array(s_dyn->aux_matrices->LU, sys_help_LU, "s_dyn->aux_matrices->LU");
-    free(sys_help_LU);
+
+    // Compute auxiliary matrices from the system dynamics
+    aux_matrices_init(s_dyn, time_horizon);
 
     // Set cost function
     double *cf_R = malloc(n* time_horizon* n* time_horizon* sizeof (double));
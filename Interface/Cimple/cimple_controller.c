@@ -4,172 +4,507 @@
 
 
 #include "cimple_controller.h"
+#include "cimple_safe_mode.h"
+#include "cimple_workspace.h"
+#include "cimple_trace.h"
 
-int main_computation_completed = 0;
 /**
- * Action to get plant from current abstract state to target abstract state.
+ * Main computation: get_input() with the arguments, the result is published in their mailbox
  */
-void ACT(int target,
-         current_state * now,
-         discrete_dynamics * d_dyn,
-         system_dynamics * s_dyn,
-         cost_function * f_cost,
-         double sec){
-    printf("\nComputing control sequence to go from abstract state %d to abstract state %d...\n", (*now).current_abs_state, target);
-    fflush(stdout);
-    //Setup threads and start timer
-
-    gsl_matrix * u_backup = gsl_matrix_alloc(s_dyn->B->size2, d_dyn->time_horizon);
-    gsl_matrix_set_zero(u_backup);
-    polytope **polytope_list_backup = malloc(sizeof(polytope)*(d_dyn->time_horizon+1));
-//    polytope **polytope_list_safemode = malloc(sizeof(polytope)*(d_dyn->time_horizon+1));
-    for(size_t i=0; i<d_dyn->time_horizon;i++){
-
-        //Create timer thread
-        pthread_t timer_id;
-        pthread_create(&timer_id, NULL, timer, &sec);
-
-        //Check whether backup is good
-
-
-        size_t current_time_horizon = d_dyn->time_horizon-i;
-        gsl_matrix_view u = gsl_matrix_submatrix(u_backup, 0, i, u_backup->size1, (u_backup->size2-i));
-        int backup_applicable = 0;
-        gsl_matrix *u_safemode = gsl_matrix_alloc(s_dyn->B->size2,1);
-//        if(i != 0){
-//            backup_applicable = check_backup(now->x, &u_last.vector ,s_dyn->A,s_dyn->B, polytope_list_backup[i]);
-//        }
-        if(backup_applicable){
-            pthread_t main_computation_id;
-            control_computation_arguments *cc_arguments = cc_arguments_alloc(now, &u.matrix, s_dyn, d_dyn,f_cost, current_time_horizon, target, polytope_list_backup);
-            pthread_create(&main_computation_id, NULL, main_computation, (void*)cc_arguments);
-            pthread_join(main_computation_id, NULL);
-            free(cc_arguments);
-
-        }else{
-            if(i==0){
-//                pthread_t main_computation_id;
-//                pthread_t safe_mode_computation_id;
-                polytope *current = polytope_alloc(d_dyn->abstract_states_set[now->current_abs_state]->cells[0]->polytope_description->H->size1,d_dyn->abstract_states_set[now->current_abs_state]->cells[0]->polytope_description->H->size2);
-                gsl_matrix_memcpy(current->H, d_dyn->abstract_states_set[now->current_abs_state]->cells[0]->polytope_description->H);
-                gsl_vector_memcpy(current->G,d_dyn->abstract_states_set[now->current_abs_state]->cells[0]->polytope_description->G);
-
-                polytope *safe = polytope_alloc(d_dyn->abstract_states_set[now->current_abs_state]->cells[0]->polytope_description->H->size1,d_dyn->abstract_states_set[now->current_abs_state]->cells[0]->polytope_description->H->size2);
-                gsl_matrix_memcpy(safe->H, d_dyn->abstract_states_set[now->current_abs_state]->cells[0]->polytope_description->H);
-                gsl_vector_memcpy(safe->G,d_dyn->abstract_states_set[now->current_abs_state]->cells[0]->polytope_description->G);
-//                for (int j = 0; j < d_dyn->abstract_states_set[now->current_abs_state]->cells_count; j++) {
-//                    if (polytope_check_state(d_dyn->abstract_states_set[now->current_abs_state]->cells[j]->polytope_description, now->x)){
-//
-//                        polytope *current = polytope_alloc(d_dyn->abstract_states_set[now->current_abs_state]->cells[0]->polytope_description->H->size1,d_dyn->abstract_states_set[now->current_abs_state]->cells[0]->polytope_description->H->size2);
-//                        gsl_matrix_memcpy(current->H, d_dyn->abstract_states_set[now->current_abs_state]->cells[0]->polytope_description->H);
-//                        gsl_vector_memcpy(current->G,d_dyn->abstract_states_set[now->current_abs_state]->cells[0]->polytope_description->G);
-//
-//                        polytope *safe = polytope_alloc(d_dyn->abstract_states_set[now->current_abs_state]->cells[0]->polytope_description->H->size1,d_dyn->abstract_states_set[now->current_abs_state]->cells[0]->polytope_description->H->size2);
-//                        gsl_matrix_memcpy(safe->H, d_dyn->abstract_states_set[now->current_abs_state]->cells[0]->polytope_description->H);
-//                        gsl_vector_memcpy(safe->G,d_dyn->abstract_states_set[now->current_abs_state]->cells[0]->polytope_description->G);
-//                        break;
-//                    }
-//                }
-//                total_safemode_computation_arguments *total_sm_arguments = sm_arguments_alloc(now, u_safemode, current, safe, s_dyn, d_dyn->time_horizon, f_cost, polytope_list_safemode);
-//                pthread_create(&safe_mode_computation_id, NULL, total_safe_mode_computation, (void*)total_sm_arguments);
-//                pthread_join(safe_mode_computation_id, NULL);
-
-//                control_computation_arguments *cc_arguments = cc_arguments_alloc(now, &u.matrix, s_dyn, d_dyn,f_cost, current_time_horizon, target, polytope_list_backup);
-//                pthread_create(&main_computation_id, NULL, main_computation, (void*)cc_arguments);
-//                pthread_join(main_computation_id, NULL);
-
-                get_input(&u.matrix, now, d_dyn, s_dyn, target, f_cost, current_time_horizon, polytope_list_backup);
-
-                //Clean up
-                polytope_free(safe);
-                polytope_free(current);
-//                free(cc_arguments);
-//                free(total_sm_arguments);
-            }else{
-//                pthread_t next_safemode_id;
-//                pthread_t main_computation_id;
-//                next_safemode_computation_arguments *next_sm_arguments = next_sm_arguments_alloc(now, u_safemode, s_dyn, d_dyn->time_horizon, f_cost, polytope_list_safemode);
-//                pthread_create(&next_safemode_id, NULL, next_safemode_computation, (void*)next_sm_arguments);
-//                pthread_join(next_safemode_id, NULL);
-//                control_computation_arguments *cc_arguments = cc_arguments_alloc(now, &u.matrix, s_dyn, d_dyn,f_cost, current_time_horizon, target, polytope_list_backup);
-//                pthread_create(&main_computation_id, NULL, main_computation, (void*)cc_arguments);
-//                pthread_join(main_computation_id, NULL);
-//                free(cc_arguments);
-                get_input(&u.matrix, now, d_dyn, s_dyn, target, f_cost, current_time_horizon, polytope_list_backup);
-
-//                free(next_sm_arguments);
-            }
-
+static void main_computation_run(control_computation_arguments *cc_arguments)
+{
+    trace_set_step((uint32_t)(cc_arguments->d_dyn->time_horizon-cc_arguments->current_time_horizon));
+
+    double cost = get_input(cc_arguments->u, cc_arguments->now, cc_arguments->d_dyn, cc_arguments->s_dyn, cc_arguments->target_abs_state, cc_arguments->f_cost, cc_arguments->current_time_horizon, cc_arguments->polytope_list_backup, cc_arguments->r_target, cc_arguments->qp_workspace, cc_arguments->cancel);
+
+    if(cc_arguments->mailbox != NULL){
+        int status = MAILBOX_COMPLETED;
+        if(cancel_token_is_cancelled(cc_arguments->cancel)){
+            status = MAILBOX_CANCELLED;
+        } else if(cost == INFINITY){
+            status = MAILBOX_FAILED;
         }
+        TRACE_INFO(TRACE_PLAN, cc_arguments->now->current_abs_state, status, cost);
+        result_mailbox_publish(cc_arguments->mailbox, cc_arguments->ticket, cc_arguments->result, cost, status);
+    }
+}
 
-        printf("\nApplying it...\n");
-        fflush(stdout);
-        gsl_vector *w = gsl_vector_alloc(s_dyn->E->size2);
-        simulate_disturbance(w, 0, 0.01);
-        //get timer back
-        pthread_join(timer_id, NULL);
-        gsl_vector_view u_apply = gsl_matrix_column(&u.matrix,0);
-        apply_control(now->x, &u_apply.vector, s_dyn->A, s_dyn->B, s_dyn->E, w, i);
-//        if(main_computation_completed){
-//            gsl_vector_view u_apply = gsl_matrix_column(&u.matrix,0);
-//            apply_control(now->x, &u_apply.vector, s_dyn->A, s_dyn->B, s_dyn->E, w, i);
-//            main_computation_completed = 0;
-//
-//        }else if(backup_applicable){
-//
-//            gsl_vector_view u_apply = gsl_matrix_column(u_backup,i);
-//            apply_control(now->x, &u_apply.vector, s_dyn->A, s_dyn->B, s_dyn->E, w, i);
-//
-//        }else{
-//            //goto safemode
-//            gsl_vector_view u_safe = gsl_matrix_column(u_safemode,0);
-//            apply_control(now->x, &u_safe.vector, s_dyn->A, s_dyn->B, s_dyn->E, w, i);
-//
-//        }
+/**
+ * Plan of the main computation: inputs and polytopes of the time steps step,...,N-1
+ * (absolute indices: column i of u is the input of time step i, polytope_list[i] the polytope x(i) has to be in)
+ */
+typedef struct input_buffer{
+
+    gsl_matrix *u;
+    polytope **polytope_list;
+    size_t step;
 
-        int new_cell_found = 0;
-        for (int j = 0; j < d_dyn->abstract_states_set[now->current_abs_state]->cells_count; j++) {
-            if (polytope_check_state(d_dyn->abstract_states_set[now->current_abs_state]->cells[j]->polytope_description, now->x)){
+}input_buffer;
+
+/**
+ * State of ACT shared by the periods of the control loop
+ *
+ * resolve_every, deviation_threshold: execution policy from closed_loop (closed loop: new plan every time step, open
+ * loop: played out, see ACT_FORCE_RESOLVE_EVERY and ACT_DEVIATION_THRESHOLD)
+ *
+ * buffers[front] is applied, buffers[1-front] is written by the main computation of the next time step
+ * (in the background, started from start: a copy of the predicted state, which the actuation keeps updating). The main
+ * computation publishes the buffer under its ticket in the mailbox, at the period boundary the actuation swaps in what
+ * was published for the current ticket and time step and cancels the computation otherwise.
+ *
+ * The main computation runs on one persistent worker thread (requested/done count the computations handed to it) with
+ * its own qp_workspace (weights, GUROBI environment). The actuation works in the preallocated workspace: after the
+ * first time step applying a valid plan allocates nothing on the control loop thread (checked with
+ * CIMPLE_DEBUG_ALLOC, the main computation still allocates inside cdd and GUROBI).
+ */
+typedef struct act_context{
+
+    int target;
+    current_state *now;
+    discrete_dynamics *d_dyn;
+    system_dynamics *s_dyn;
+    cost_function *f_cost;
+
+    input_buffer buffers[2];
+    int front;
+    control_workspace *workspace;
+    current_state *predicted;
+    current_state *start;
+
+    control_computation_arguments *cc_arguments;
+    gsl_matrix_view u_main;
+    pthread_t worker_id;
+    pthread_mutex_t worker_lock;
+    pthread_cond_t worker_wake;
+    pthread_cond_t worker_idle;
+    unsigned long requested;
+    unsigned long done;
+    int worker_shutdown;
+    int main_computation_running;
+    result_mailbox *mailbox;
+    unsigned long ticket;
+    cancel_token cancel;
+
+    int plan_reused;
+    size_t plan_age;
+    size_t steps_reused;
+    size_t resolve_every;
+    double deviation_threshold;
+
+    random_stream disturbance;
+
+}act_context;
+
+/**
+ * Swap in the buffer published for the current ticket if it was planned for time step i (never blocks)
+ *
+ * A late computation of an earlier time step may publish under the current ticket (no new one is started while it
+ * runs), its plan starts from the prediction of another time step and is rejected.
+ */
+static int swap_input_buffers(act_context *act,
+                              size_t i)
+{
+    void *result;
+    int status;
+    if(!result_mailbox_take(act->mailbox, act->ticket, &result, NULL, &status) || status != MAILBOX_COMPLETED
+       || ((input_buffer *)result)->step != i){
+        return 0;
+    }
+    act->front = (int)((input_buffer *)result - act->buffers);
+    return 1;
+}
+
+/**
+ * Abstract state of the state: the current one if one of its cells contains it, then target, then all others
+ */
+void update_abstract_state(current_state *now,
+                           discrete_dynamics *d_dyn,
+                           int target)
+{
+    int new_cell_found = 0;
+    for (int j = 0; j < d_dyn->abstract_states_set[now->current_abs_state]->cells_count; j++) {
+        if (polytope_check_state(d_dyn->abstract_states_set[now->current_abs_state]->cells[j]->polytope_description, now->x)){
+            new_cell_found = 1;
+            break;
+        }
+    }
+    if(!new_cell_found){
+        for (int j = 0; j < d_dyn->abstract_states_set[target]->cells_count; j++) {
+            if (polytope_check_state(d_dyn->abstract_states_set[target]->cells[j]->polytope_description, now->x)){
                 new_cell_found = 1;
+                now->current_abs_state=target;
                 break;
             }
         }
-        if(!new_cell_found){
-            for (int j = 0; j < d_dyn->abstract_states_set[target]->cells_count; j++) {
-                if (polytope_check_state(d_dyn->abstract_states_set[target]->cells[j]->polytope_description, now->x)){
-                    new_cell_found = 1;
-                    now->current_abs_state=target;
+    }
+    if(!new_cell_found){
+        for(int k=0; k<d_dyn->abstract_states_count;k++){
+            for (int j = 0; j < d_dyn->abstract_states_set[k]->cells_count; j++) {
+                if (polytope_check_state(d_dyn->abstract_states_set[k]->cells[j]->polytope_description, now->x)){
+                    now->current_abs_state=k;
                     break;
                 }
             }
         }
-        if(!new_cell_found){
-            for(int k=0; k<d_dyn->abstract_states_count;k++){
-                for (int j = 0; j < d_dyn->abstract_states_set[k]->cells_count; j++) {
-                    if (polytope_check_state(d_dyn->abstract_states_set[k]->cells[j]->polytope_description, now->x)){
-                        now->current_abs_state=k;
-                        break;
-                    }
-                }
-            }
+    }
+}
+
+/**
+ * Worker thread of the main computation: runs every computation handed to it by act_start_main_computation()
+ */
+static void *act_worker(void *arg)
+{
+    act_context *act = (act_context *)arg;
+
+    pthread_mutex_lock(&act->worker_lock);
+    while(1){
+        while(!act->worker_shutdown && act->requested == act->done){
+            pthread_cond_wait(&act->worker_wake, &act->worker_lock);
+        }
+        if(act->worker_shutdown){
+            break;
+        }
+        pthread_mutex_unlock(&act->worker_lock);
+
+        main_computation_run(act->cc_arguments);
+
+        pthread_mutex_lock(&act->worker_lock);
+        act->done++;
+        pthread_cond_signal(&act->worker_idle);
+    }
+    pthread_mutex_unlock(&act->worker_lock);
+
+    return NULL;
+}
+
+/**
+ * Start the main computation of time step i in the background: plan from a copy of the predicted state into the back
+ * buffer (only called once the previous computation published, i.e. no longer reads start)
+ */
+static void act_start_main_computation(act_context *act,
+                                       size_t i)
+{
+    gsl_vector_memcpy(act->start->x, act->predicted->x);
+    act->start->current_abs_state = act->predicted->current_abs_state;
+
+    input_buffer *back = &act->buffers[1-act->front];
+    size_t current_time_horizon = act->d_dyn->time_horizon-i;
+    back->step = i;
+    act->u_main = gsl_matrix_submatrix(back->u, 0, i, back->u->size1, current_time_horizon);
+
+    act->ticket = result_mailbox_request(act->mailbox);
+    cancel_token_reset(&act->cancel);
+    act->cc_arguments->u = &act->u_main.matrix;
+    act->cc_arguments->current_time_horizon = current_time_horizon;
+    act->cc_arguments->polytope_list_backup = back->polytope_list;
+    act->cc_arguments->ticket = act->ticket;
+    act->cc_arguments->result = back;
+
+    pthread_mutex_lock(&act->worker_lock);
+    act->requested++;
+    pthread_cond_signal(&act->worker_wake);
+    pthread_mutex_unlock(&act->worker_lock);
+    act->main_computation_running = 1;
+}
+
+/**
+ * Largest deviation of the state from the nominal trajectory of the plan (infinity norm)
+ */
+static double act_plan_deviation(const gsl_vector *x,
+                                 const gsl_vector *x_planned)
+{
+    double deviation = 0;
+    for(size_t j = 0; j < x->size; j++){
+        double difference = fabs(gsl_vector_get(x, j)-gsl_vector_get(x_planned, j));
+        if(difference > deviation){
+            deviation = difference;
+        }
+    }
+    return deviation;
+}
+
+/**
+ * Whether the applied plan still holds for time step i from the predicted state: the policy allows to keep it, the
+ * state is in the polytope of the plan and the planned input brings it nominally into the next one (two membership
+ * tests, no solve)
+ */
+static int act_plan_still_valid(act_context *act,
+                                size_t i)
+{
+    input_buffer *front = &act->buffers[act->front];
+    if(act->resolve_every > 0 && act->plan_age >= act->resolve_every){
+        return 0;
+    }
+    if(act_plan_deviation(act->predicted->x, act->workspace->x_planned) > act->deviation_threshold){
+        return 0;
+    }
+    if(!polytope_check_state(front->polytope_list[i], act->predicted->x)){
+        return 0;
+    }
+    gsl_vector_view u_planned = gsl_matrix_column(front->u, i);
+    return check_backup(act->predicted->x, &u_planned.vector, act->s_dyn->A, act->s_dyn->B, front->polytope_list[i+1],
+                        act->workspace->x_next);
+}
+
+/**
+ * Whether the main computation of the current ticket published its result, i.e. no longer writes into the back
+ * buffer (never blocks)
+ */
+static int act_main_computation_published(act_context *act)
+{
+    void *result;
+    int status;
+    return result_mailbox_take(act->mailbox, act->ticket, &result, NULL, &status);
+}
+
+/**
+ * Wait for the last main computation (only at the end of ACT: a late one is cancelled at the period boundary and
+ * keeps running in the background, see act_period())
+ */
+static void act_join_main_computation(act_context *act)
+{
+    if(act->main_computation_running){
+        pthread_mutex_lock(&act->worker_lock);
+        while(act->done != act->requested){
+            pthread_cond_wait(&act->worker_idle, &act->worker_lock);
         }
-        gsl_vector_free(w);
-        printf("\nNew state:");
-        gsl_vector_print(now->x, "now->");
-        printf("\nNew abstract state: %d\n", now->current_abs_state);
-        fflush(stdout);
-        gsl_matrix_free(u_safemode);
+        pthread_mutex_unlock(&act->worker_lock);
+        act->main_computation_running = 0;
+    }
+}
+
+/**
+ * Period i of the control loop:
+ *
+ *      1. swap in the plan computed for time step i during the last period (from the predicted state) and apply it if
+ *         it still brings the measured state into the next polytope, otherwise the safe mode input
+ *      2. predict the next state and start the main computation of time step i+1 in the background, unless the plan
+ *         just applied still holds for the predicted state (its next input is then applied without a solve)
+ *
+ * A late main computation is cancelled but never waited for within a period (it may be in cdd code that does not
+ * check the cancel token): no new one is started until it published.
+ *
+ * The solve thus overlaps with the period instead of delaying the actuation.
+ */
+static void act_period(size_t i,
+                       void *context)
+{
+    act_context *act = (act_context *)context;
+    current_state *now = act->now;
+    discrete_dynamics *d_dyn = act->d_dyn;
+    system_dynamics *s_dyn = act->s_dyn;
+    control_workspace *workspace = act->workspace;
+    ALLOC_COUNTER_START(allocations);
+    TRACE_INFO(TRACE_STEP, now->current_abs_state, d_dyn->time_horizon-i);
+
+    int planned;
+    if(act->plan_reused){
+        planned = 1;
+        act->plan_age++;
+        act->steps_reused++;
+        TRACE_INFO(TRACE_PLAN_REUSED, now->current_abs_state, act->plan_age);
+    } else{
+        planned = swap_input_buffers(act, i);
+        if(planned){
+            act->plan_age = 1;
+            //The plan starts from the state predicted in the last time step (copied when it was started)
+            gsl_vector_memcpy(workspace->x_planned, act->start->x);
+        } else{
+            //Late: its plan would be discarded anyway
+            cancel_token_cancel(&act->cancel);
+        }
+    }
+    input_buffer *front = &act->buffers[act->front];
+    gsl_vector_view u_planned = gsl_matrix_column(front->u, i);
+
+    gsl_vector *u_apply = &u_planned.vector;
+    if(planned && !check_backup(now->x, &u_planned.vector, s_dyn->A, s_dyn->B, front->polytope_list[i+1],
+                                workspace->x_next)){
+        TRACE_WARNING(TRACE_FALLBACK, now->current_abs_state, TRACE_FALLBACK_PLAN_INVALID);
+        planned = 0;
+    }
+    if(!planned){
+        if(total_safe_mode_computation(workspace->u_safemode, now, d_dyn, s_dyn) >= 0){
+            TRACE_WARNING(TRACE_FALLBACK, now->current_abs_state, TRACE_FALLBACK_SAFE_MODE);
+            u_apply = workspace->u_safemode;
+        } else{
+            //Neither: keep following the inputs computed in an earlier time step
+            TRACE_WARNING(TRACE_FALLBACK, now->current_abs_state, TRACE_FALLBACK_EARLIER_INPUT);
+        }
+    }
+
+    //Nominal trajectory of the plan
+    if(planned){
+        gsl_blas_dgemv(CblasNoTrans, 1.0, s_dyn->A, workspace->x_planned, 0.0, workspace->x_next);
+        gsl_blas_dgemv(CblasNoTrans, 1.0, s_dyn->B, &u_planned.vector, 1.0, workspace->x_next);
+        gsl_vector_memcpy(workspace->x_planned, workspace->x_next);
+    }
+
+    //Predicted (nominal) state of the next time step
+    gsl_vector *x_predicted = workspace->x_predicted;
+    gsl_blas_dgemv(CblasNoTrans, 1.0, s_dyn->A, now->x, 0.0, x_predicted);
+    gsl_blas_dgemv(CblasNoTrans, 1.0, s_dyn->B, u_apply, 1.0, x_predicted);
+
+    simulate_disturbance(workspace->w, &act->disturbance, 0, 0.01);
+    apply_control(now->x, u_apply, s_dyn->A, s_dyn->B, s_dyn->E, workspace->w, i, workspace->x_next);
+
+    int previous_abs_state = now->current_abs_state;
+    update_abstract_state(now, d_dyn, act->target);
+    if(now->current_abs_state != previous_abs_state){
+        TRACE_INFO(TRACE_TRANSITION, now->current_abs_state, previous_abs_state);
+    }
+
+    if(i+1 < d_dyn->time_horizon){
+        gsl_vector_memcpy(act->predicted->x, x_predicted);
+        act->predicted->current_abs_state = now->current_abs_state;
+        update_abstract_state(act->predicted, d_dyn, act->target);
+        act->plan_reused = planned && act_plan_still_valid(act, i+1);
+        //A late (cancelled) computation still writes into the back buffer: it is not waited for, the next time step
+        //falls back to the safe mode input and a new computation is started once it published
+        if(!act->plan_reused && act_main_computation_published(act)){
+            act_start_main_computation(act, i+1);
+        }
+    }
+
+    //Steady state (after the first time step, valid plan applied): the time step must not allocate
+    if(i > 0 && planned){
+        ALLOC_COUNTER_ASSERT_NONE(allocations, "ACT time step");
+    }
+}
+
+/**
+ * Action to get plant from current abstract state to target abstract state.
+ *
+ * The plan of the first time step is computed before the loop starts. During every period the main computation of
+ * the next time step runs in the background on the predicted state and its result is swapped in at the period
+ * boundary (see act_period()), late or invalid plans are replaced by the safe mode input.
+ * The periods are released by the executor at absolute times, thus the time steps do not drift.
+ * Returns 0 if the plant reached target, -1 otherwise.
+ */
+int ACT(int target,
+        current_state * now,
+        discrete_dynamics * d_dyn,
+        system_dynamics * s_dyn,
+        cost_function * f_cost,
+        rt_executor * executor,
+        double sec){
+    printf("\nComputing control sequence to go from abstract state %d to abstract state %d...\n", (*now).current_abs_state, target);
+    fflush(stdout);
+
+    act_context act;
+    act.target = target;
+    act.now = now;
+    act.d_dyn = d_dyn;
+    act.s_dyn = s_dyn;
+    act.f_cost = f_cost;
+    for(int b = 0; b < 2; b++){
+        act.buffers[b].u = gsl_matrix_alloc(s_dyn->B->size2, d_dyn->time_horizon);
+        gsl_matrix_set_zero(act.buffers[b].u);
+        act.buffers[b].polytope_list = calloc(d_dyn->time_horizon+1, sizeof(polytope *));
+        act.buffers[b].step = 0;
     }
-    gsl_matrix_free(u_backup);
-
-//    for(int i = 0; i< d_dyn->time_horizon+1; i++){
-//        polytope_free(polytope_list_safemode[i]);
-//    }
-//    free(polytope_list_safemode);
-    for(int i = 0; i< d_dyn->time_horizon+1; i++){
-        polytope_free(polytope_list_backup[i]);
+    act.front = 0;
+    act.workspace = control_workspace_alloc(now->x->size, s_dyn->B->size2, s_dyn->E->size2);
+    act.predicted = state_alloc(now->x->size, now->current_abs_state);
+    act.start = state_alloc(now->x->size, now->current_abs_state);
+    if(act.workspace == NULL || act.predicted == NULL || act.start == NULL){
+        fprintf(stderr, "\nACT: could not allocate the workspace of the control loop\n");
+        exit(EXIT_FAILURE);
+    }
+    act.mailbox = result_mailbox_alloc();
+    if(act.mailbox == NULL){
+        fprintf(stderr, "\nACT: could not create the mailbox of the main computation\n");
+        exit(EXIT_FAILURE);
+    }
+    act.ticket = 0;
+    cancel_token_reset(&act.cancel);
+    act.plan_reused = 0;
+    act.plan_age = 0;
+    act.steps_reused = 0;
+    if(d_dyn->closed_loop){
+        act.resolve_every = 1;
+        act.deviation_threshold = INFINITY;
+    } else{
+        act.resolve_every = ACT_FORCE_RESOLVE_EVERY;
+        act.deviation_threshold = ACT_DEVIATION_THRESHOLD;
+    }
+    random_stream_init(&act.disturbance, RANDOM_DEFAULT_SEED, 0);
+
+    //Arguments and worker of the main computation (set up once, reused every time step)
+    act.cc_arguments = cc_arguments_alloc(act.start, NULL, s_dyn, d_dyn, f_cost, d_dyn->time_horizon, target, NULL);
+    act.cc_arguments->mailbox = act.mailbox;
+    act.cc_arguments->cancel = &act.cancel;
+    act.cc_arguments->r_target = gsl_vector_alloc(f_cost->r->size);
+    act.cc_arguments->qp_workspace = qp_workspace_alloc(s_dyn->B->size2, d_dyn->time_horizon);
+    if(act.cc_arguments->qp_workspace == NULL){
+        fprintf(stderr, "\nACT: could not allocate the workspace of the main computation\n");
+        exit(EXIT_FAILURE);
+    }
+    act.main_computation_running = 0;
+    act.requested = 0;
+    act.done = 0;
+    act.worker_shutdown = 0;
+    pthread_mutex_init(&act.worker_lock, NULL);
+    pthread_cond_init(&act.worker_wake, NULL);
+    pthread_cond_init(&act.worker_idle, NULL);
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    rt_executor_worker_attributes(&attributes);
+    pthread_create(&act.worker_id, &attributes, act_worker, &act);
+    pthread_attr_destroy(&attributes);
+
+    //Plan of the first time step (nothing to overlap with yet): blocks until it is published
+    gsl_vector_memcpy(act.predicted->x, now->x);
+    act_start_main_computation(&act, 0);
+    result_mailbox_wait(act.mailbox, act.ticket, -1);
+
+    //Without an executor of the caller a temporary one with default scheduling is used
+    rt_executor *own_executor = NULL;
+    if(executor == NULL){
+        own_executor = rt_executor_alloc(NULL);
+        executor = own_executor;
+    }
+    printf("\nTime runs: %.6fs per time step\n", sec);
+    rt_executor_run(executor, sec, d_dyn->time_horizon, act_period, &act);
+
+    printf("\nMain computation: previous plan reused in %d of %d time steps (%.0f%% of the solves skipped)\n",
+           (int)act.steps_reused, (int)d_dyn->time_horizon, 100.0*(double)act.steps_reused/(double)d_dyn->time_horizon);
+    int reached = (now->current_abs_state == target);
+    if(!reached){
+        fprintf(stderr, "\nACT: abstract state %d not reached (plant in abstract state %d)\n", target, now->current_abs_state);
+    }
+
+    //Clean up!
+    act_join_main_computation(&act);
+    pthread_mutex_lock(&act.worker_lock);
+    act.worker_shutdown = 1;
+    pthread_cond_signal(&act.worker_wake);
+    pthread_mutex_unlock(&act.worker_lock);
+    pthread_join(act.worker_id, NULL);
+    pthread_cond_destroy(&act.worker_idle);
+    pthread_cond_destroy(&act.worker_wake);
+    pthread_mutex_destroy(&act.worker_lock);
+    gsl_vector_free(act.cc_arguments->r_target);
+    qp_workspace_free(act.cc_arguments->qp_workspace);
+    free(act.cc_arguments);
+    if(own_executor != NULL){
+        rt_executor_free(own_executor);
     }
-    free(polytope_list_backup);
+    for(int b = 0; b < 2; b++){
+        gsl_matrix_free(act.buffers[b].u);
+        for(size_t i = 0; i < d_dyn->time_horizon+1; i++){
+            if(act.buffers[b].polytope_list[i] != NULL){
+                polytope_free(act.buffers[b].polytope_list[i]);
+            }
+        }
+        free(act.buffers[b].polytope_list);
+    }
+    control_workspace_free(act.workspace);
+    state_free(act.predicted);
+    state_free(act.start);
+    result_mailbox_free(act.mailbox);
+
+    return reached ? 0 : -1;
 };
 /**
  * Simulation of system:
@@ -182,50 +517,39 @@ void apply_control(gsl_vector *x,
                    gsl_matrix *B,
                    gsl_matrix *E,
                    gsl_vector* w,
-                   size_t current_time) {
-    printf("\nApply_control time(%d)\n", (int) current_time);
-    gsl_vector_print(x, "x");
-    fflush(stdout);
-    gsl_vector *x_temp = gsl_vector_alloc(x->size);
+                   size_t current_time,
+                   gsl_vector *x_next) {
+    gsl_vector *x_temp = (x_next != NULL) ? x_next : gsl_vector_alloc(x->size);
     //Apply input to state of next N time steps
     // x[k+1] = A.x[k] + B.u[k+1]
-    gsl_vector_set_zero(x_temp);
-    printf("\nApply_control: u[%d] = ", (int)current_time);
-    gsl_vector_print(u,"u");
-    fflush(stdout);
-    gsl_vector *Btu = gsl_vector_alloc(x->size);
+    TRACE_DEBUG_VECTOR(TRACE_INPUT, u);
 
     //A.x
     gsl_blas_dgemv(CblasNoTrans, 1, A, x, 0, x_temp);
-    //B.u
-    gsl_blas_dgemv(CblasNoTrans, 1, B, u, 0 , Btu);
+    //+ B.u
+    gsl_blas_dgemv(CblasNoTrans, 1, B, u, 1, x_temp);
+    //+ E.w
+    gsl_blas_dgemv(CblasNoTrans, 1, E, w, 1, x_temp);
     //update x[k-1] => x[k]
-    gsl_vector_set_zero(x);
-    gsl_vector_add(x, x_temp);
-    gsl_vector_add(x, Btu);
-    //E.w
-    gsl_vector_set_zero(x_temp);
-    gsl_blas_dgemv(CblasNoTrans, 1, E, w, 0, x_temp);
-    gsl_vector_add(x,x_temp);
-    gsl_vector_free(x_temp);
-    printf("\nTemporary state: x[%d] = ", (int)current_time+1);
-    gsl_vector_print(x,"x");
-    fflush(stdout);
-    gsl_vector_free(Btu);
+    gsl_vector_memcpy(x, x_temp);
+    if(x_next == NULL){
+        gsl_vector_free(x_temp);
+    }
+    TRACE_DEBUG_VECTOR(TRACE_STATE, x);
 };
 
 /**
  * @brief Simulate disturbance by filling p-dimensional vector with gaussian random variables
  * @param w Vector to be filled
+ * @param stream Random stream of the simulation
  * @param mu Mean of distribution
- * @param sigma Variance of distribution
+ * @param sigma Standard deviation of distribution
  */
 void simulate_disturbance(gsl_vector *w,
-                     double mu,
-                     double sigma){
-    for(size_t i = 0; i<w->size;i++){
-        gsl_vector_set(w,i,randn(mu,sigma));
-    }
+                          random_stream *stream,
+                          double mu,
+                          double sigma){
+    random_gaussian_batch((stream != NULL) ? stream : random_thread_stream(), w->data, w->size, w->stride, mu, sigma);
 };
 
 
@@ -236,17 +560,7 @@ void simulate_disturbance(gsl_vector *w,
  */
 void * main_computation(void *arg){
 
-
-    control_computation_arguments *cc_arguments = (control_computation_arguments *)arg;
-    long j = 0;
-    for(long i=0;i<10000;i++){
-        j=j+1;
-    }
-
-    get_input(cc_arguments->u, cc_arguments->now, cc_arguments->d_dyn, cc_arguments->s_dyn, cc_arguments->target_abs_state, cc_arguments->f_cost, cc_arguments->current_time_horizon, cc_arguments->polytope_list_backup);
-
-    main_computation_completed = 1;
-
+    main_computation_run((control_computation_arguments *)arg);
 
     pthread_exit(NULL);
 };
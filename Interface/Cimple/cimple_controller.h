@@ -13,29 +13,60 @@
 #include "cimple_polytope_library.h"
 #include <pthread.h>
 #include "cimple_mpc_computation.h"
+#include "cimple_rt_executor.h"
+#include "cimple_random.h"
 
 
+/**
+ * Open loop execution (closed_loop = 0): force a new solve after a plan was applied in this many consecutive time
+ * steps (0: reuse a plan as long as it holds)
+ */
+#ifndef ACT_FORCE_RESOLVE_EVERY
+#define ACT_FORCE_RESOLVE_EVERY 0
+#endif
+
+/**
+ * Open loop execution (closed_loop = 0): force a new solve once the predicted state deviates from the nominal
+ * trajectory of the plan by more than this (infinity norm, INFINITY: never)
+ */
+#ifndef ACT_DEVIATION_THRESHOLD
+#define ACT_DEVIATION_THRESHOLD INFINITY
+#endif
+
 /**
  * @brief Action to get plant from current abstract state to target_abs_state.
  *
+ * If the main computation misses the deadline of a time step (sec), the safe mode input is applied instead.
+ * With d_dyn->closed_loop every time step applies the first input of a new plan. Otherwise the plan is played out:
+ * while the predicted state stays within the polytopes of the current plan the next planned input is applied without
+ * a new solve (multi-rate: see ACT_FORCE_RESOLVE_EVERY and ACT_DEVIATION_THRESHOLD), the share of skipped solves is
+ * printed at the end.
+ * Time steps are released by the executor at absolute times (see rt_executor_run()), its statistics show the
+ * jitter and the overruns of the time steps afterwards.
+ *
  * @param target target region the plant is supposed to reach
  * @param now current state of the plant
  * @param d_dyn discrete abstraction of the system
  * @param s_dyn system dynamics including auxiliary matrices
  * @param f_cost cost function to be minimized on the path
+ * @param executor executor of the control loop (NULL: a temporary one with default scheduling)
+ * @param sec duration of one time step in seconds
+ * @return 0 if the plant reached target, -1 otherwise (e.g. no trajectory was found)
  */
-void ACT(int target,
-         current_state * now,
-         discrete_dynamics * d_dyn,
-         system_dynamics * s_dyn,
-         cost_function * f_cost,
-         double sec);
+int ACT(int target,
+        current_state * now,
+        discrete_dynamics * d_dyn,
+        system_dynamics * s_dyn,
+        cost_function * f_cost,
+        rt_executor * executor,
+        double sec);
 /**
  * @brief Apply the calculated control to the current state using system dynamics
  * @param x current state at time [0]
  * @param u matrix with next N inputs calculated by the MPC controller
  * @param A system dynamics
  * @param B input dynamics
+ * @param x_next memory for the successor (e.g. of the control_workspace, NULL: allocated)
  */
 void apply_control(gsl_vector *x,
                    gsl_vector *u,
@@ -43,17 +74,37 @@ void apply_control(gsl_vector *x,
                    gsl_matrix *B,
                    gsl_matrix *E,
                    gsl_vector *w,
-                   size_t current_time);
+                   size_t current_time,
+                   gsl_vector *x_next);
+
+/**
+ * @brief Abstract state of the state: the current one if one of its cells contains it, then target, then all others
+ * @param now state, current_abs_state is updated
+ * @param d_dyn
+ * @param target
+ */
+void update_abstract_state(current_state *now,
+                           discrete_dynamics *d_dyn,
+                           int target);
 
 /**
  * Fill a vector with gaussian distributed noise
  * @param w
+ * @param stream random stream of the simulation (NULL: stream of the calling thread)
+ * @param mu
+ * @param sigma
  */
 void simulate_disturbance(gsl_vector *w,
+                          random_stream *stream,
                           double mu,
                           double sigma);
 
 
+/**
+ * @brief Main computation thread: get_input() with the arguments, the result is published in their mailbox
+ * @param arg control_computation_arguments
+ * @return
+ */
 void * main_computation(void *arg);
 
 
@@ -0,0 +1,488 @@
+//
+// Created by L.Jonathan Feldstein
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include "cimple_controller_service.h"
+#include "cimple_controller.h"
+#include "cimple_mpc_computation.h"
+#include "cimple_safe_mode.h"
+#include "cimple_rt_executor.h"
+#include "cimple_trace.h"
+
+static uint64_t plants_count = 0;
+
+/**
+ * "Constructor" Dynamically allocates the mutable state of one plant
+ */
+struct plant_context *plant_context_alloc(control_model *model,
+                                          current_state *now,
+                                          int target)
+{
+    struct plant_context *return_plant = calloc(1, sizeof (struct plant_context));
+    if (return_plant == NULL){
+        return NULL;
+    }
+
+    size_t n = model->s_dyn->A->size1;
+    size_t m = model->s_dyn->B->size2;
+    size_t N = model->d_dyn->time_horizon;
+
+    return_plant->now = now;
+    return_plant->target = target;
+    return_plant->step = 0;
+    return_plant->u = gsl_matrix_calloc(m, N);
+    return_plant->polytope_list = calloc(N+1, sizeof(polytope *));
+    return_plant->planned = 0;
+    return_plant->start = state_alloc(n, now->current_abs_state);
+    return_plant->planning_step = 0;
+    return_plant->workspace = control_workspace_alloc(n, m, model->s_dyn->E->size2);
+    return_plant->r_target = gsl_vector_alloc(model->f_cost->r->size);
+    cancel_token_reset(&return_plant->cancel);
+    random_stream_init(&return_plant->disturbance, RANDOM_DEFAULT_SEED,
+                       __atomic_fetch_add(&plants_count, 1, __ATOMIC_RELAXED));
+    return_plant->pending = 0;
+    return_plant->running = 0;
+    return_plant->abandoned = 0;
+    return_plant->status = MAILBOX_FAILED;
+    return_plant->cost = INFINITY;
+    if (return_plant->u == NULL || return_plant->polytope_list == NULL || return_plant->start == NULL
+        || return_plant->workspace == NULL || return_plant->r_target == NULL){
+        plant_context_free(return_plant, model);
+        return NULL;
+    }
+
+    return return_plant;
+}
+
+/**
+ * "Destructor" Deallocates the plant context
+ */
+void plant_context_free(plant_context *plant,
+                        control_model *model)
+{
+    if(plant->u != NULL){
+        gsl_matrix_free(plant->u);
+    }
+    if(plant->polytope_list != NULL){
+        for(size_t i = 0; i < model->d_dyn->time_horizon+1; i++){
+            if(plant->polytope_list[i] != NULL){
+                polytope_free(plant->polytope_list[i]);
+            }
+        }
+        free(plant->polytope_list);
+    }
+    if(plant->start != NULL){
+        state_free(plant->start);
+    }
+    if(plant->workspace != NULL){
+        control_workspace_free(plant->workspace);
+    }
+    if(plant->r_target != NULL){
+        gsl_vector_free(plant->r_target);
+    }
+    free(plant);
+}
+
+/**
+ * Time step of the plant: planned input if it still holds, safe mode input otherwise
+ */
+int plant_context_advance(control_model *model,
+                          plant_context *plant,
+                          gsl_vector *w)
+{
+    system_dynamics *s_dyn = model->s_dyn;
+    discrete_dynamics *d_dyn = model->d_dyn;
+    control_workspace *workspace = plant->workspace;
+    current_state *now = plant->now;
+    size_t i = plant->step;
+
+    if(i >= d_dyn->time_horizon){
+        return 0;
+    }
+
+    gsl_vector_view u_planned = gsl_matrix_column(plant->u, i);
+    gsl_vector *u_apply = &u_planned.vector;
+    //An abandoned computation may still write into the plan, planned is 0 then and the plan is not read
+    int planned = plant->planned && plant->polytope_list[i+1] != NULL
+                  && check_backup(now->x, u_apply, s_dyn->A, s_dyn->B, plant->polytope_list[i+1], workspace->x_next);
+    if(!planned){
+        if(total_safe_mode_computation(workspace->u_safemode, now, d_dyn, s_dyn) >= 0){
+            TRACE_WARNING(TRACE_FALLBACK, now->current_abs_state, TRACE_FALLBACK_SAFE_MODE);
+            u_apply = workspace->u_safemode;
+        } else{
+            TRACE_WARNING(TRACE_FALLBACK, now->current_abs_state, TRACE_FALLBACK_EARLIER_INPUT);
+        }
+    }
+
+    if(w == NULL){
+        simulate_disturbance(workspace->w, &plant->disturbance, 0, 0.01);
+        w = workspace->w;
+    }
+    apply_control(now->x, u_apply, s_dyn->A, s_dyn->B, s_dyn->E, w, i, workspace->x_next);
+
+    int previous_abs_state = now->current_abs_state;
+    update_abstract_state(now, d_dyn, plant->target);
+    if(now->current_abs_state != previous_abs_state){
+        TRACE_INFO(TRACE_TRANSITION, now->current_abs_state, previous_abs_state);
+    }
+    plant->step++;
+
+    return planned;
+}
+
+/**
+ * Earlier deadline (order of the queue)
+ */
+static int deadline_before(plant_context *first,
+                           plant_context *second)
+{
+    if(first->deadline.tv_sec != second->deadline.tv_sec){
+        return first->deadline.tv_sec < second->deadline.tv_sec;
+    }
+    return first->deadline.tv_nsec < second->deadline.tv_nsec;
+}
+
+/**
+ * Swap two entries of the queue (keeps their queue_index up to date)
+ */
+static void queue_swap(controller_service *service,
+                       size_t i,
+                       size_t j)
+{
+    plant_context *plant = service->queue[i];
+    service->queue[i] = service->queue[j];
+    service->queue[j] = plant;
+    service->queue[i]->queue_index = i;
+    service->queue[j]->queue_index = j;
+}
+
+/**
+ * Restore the heap order from entry i on (up and down)
+ */
+static void queue_restore(controller_service *service,
+                          size_t i)
+{
+    while(i > 0 && deadline_before(service->queue[i], service->queue[(i-1)/2])){
+        queue_swap(service, i, (i-1)/2);
+        i = (i-1)/2;
+    }
+    while(1){
+        size_t earliest = i;
+        size_t left = 2*i+1;
+        size_t right = 2*i+2;
+        if(left < service->queued && deadline_before(service->queue[left], service->queue[earliest])){
+            earliest = left;
+        }
+        if(right < service->queued && deadline_before(service->queue[right], service->queue[earliest])){
+            earliest = right;
+        }
+        if(earliest == i){
+            break;
+        }
+        queue_swap(service, i, earliest);
+        i = earliest;
+    }
+}
+
+/**
+ * Remove entry i of the queue
+ */
+static plant_context *queue_remove(controller_service *service,
+                                   size_t i)
+{
+    plant_context *plant = service->queue[i];
+    service->queued--;
+    if(i != service->queued){
+        service->queue[i] = service->queue[service->queued];
+        service->queue[i]->queue_index = i;
+        queue_restore(service, i);
+    }
+    return plant;
+}
+
+/**
+ * Whether the deadline passed
+ */
+static int deadline_passed(struct timespec *deadline)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec > deadline->tv_sec || (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
+
+/**
+ * Computation of the plant finished (under the lock of the service)
+ */
+static void plant_finished(controller_service *service,
+                           plant_context *plant,
+                           int status,
+                           double cost)
+{
+    plant->pending = 0;
+    plant->running = 0;
+    //Already reported as missed by controller_service_collect()
+    if(plant->abandoned){
+        plant->abandoned = 0;
+        pthread_cond_broadcast(&service->finished);
+        return;
+    }
+    plant->status = status;
+    plant->cost = cost;
+    if(status == MAILBOX_CANCELLED){
+        service->missed++;
+    } else if(status == MAILBOX_COMPLETED){
+        service->completed++;
+    }
+    pthread_cond_broadcast(&service->finished);
+}
+
+/**
+ * Plan of the plant from its start state: get_input() with the shared model, the memory of the plant and the qp
+ * workspace of the worker
+ */
+static int plant_compute(control_model *model,
+                         plant_context *plant,
+                         qp_workspace *workspace,
+                         double *cost)
+{
+    size_t N = model->d_dyn->time_horizon;
+    size_t i = plant->planning_step;
+    trace_set_step((uint32_t)i);
+
+    gsl_matrix_view u = gsl_matrix_submatrix(plant->u, 0, i, plant->u->size1, N-i);
+    *cost = get_input(&u.matrix, plant->start, model->d_dyn, model->s_dyn, plant->target, model->f_cost, N-i,
+                      plant->polytope_list, plant->r_target, workspace, &plant->cancel);
+
+    int status = MAILBOX_COMPLETED;
+    if(cancel_token_is_cancelled(&plant->cancel)){
+        status = MAILBOX_CANCELLED;
+    } else if(*cost == INFINITY){
+        status = MAILBOX_FAILED;
+    }
+    TRACE_INFO(TRACE_PLAN, plant->start->current_abs_state, status, *cost);
+    return status;
+}
+
+/**
+ * Worker of the service: computes the plans of the queued plants, earliest deadline first
+ */
+static void *controller_service_work(void *arg)
+{
+    controller_service *service = (controller_service *)arg;
+
+    //Memory and GUROBI environment of this worker, shared by all plants it computes (NULL: one per computation)
+    qp_workspace *workspace = qp_workspace_alloc(service->model->s_dyn->B->size2, service->model->d_dyn->time_horizon);
+
+    pthread_mutex_lock(&service->lock);
+    while(1){
+        while(!service->shutdown && service->queued == 0){
+            pthread_cond_wait(&service->work, &service->lock);
+        }
+        if(service->shutdown){
+            break;
+        }
+        plant_context *plant = queue_remove(service, 0);
+
+        //Too late to be of any use
+        if(deadline_passed(&plant->deadline)){
+            plant_finished(service, plant, MAILBOX_CANCELLED, INFINITY);
+            continue;
+        }
+        plant->running = 1;
+        service->running[service->running_count++] = plant;
+        pthread_mutex_unlock(&service->lock);
+
+        double cost;
+        int status = plant_compute(service->model, plant, workspace, &cost);
+
+        pthread_mutex_lock(&service->lock);
+        for(size_t i = 0; i < service->running_count; i++){
+            if(service->running[i] == plant){
+                service->running[i] = service->running[--service->running_count];
+                break;
+            }
+        }
+        plant_finished(service, plant, status, cost);
+    }
+    pthread_mutex_unlock(&service->lock);
+
+    //Clean up!
+    if(workspace != NULL){
+        qp_workspace_free(workspace);
+    }
+
+    return NULL;
+}
+
+/**
+ * "Constructor" Dynamically allocates the service and starts its workers
+ */
+struct controller_service *controller_service_alloc(control_model *model,
+                                                    size_t threads_count,
+                                                    size_t capacity)
+{
+    struct controller_service *return_service = malloc (sizeof (struct controller_service));
+    if (return_service == NULL){
+        return NULL;
+    }
+
+    if(threads_count == 0){
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads_count = (online > 0) ? (size_t)online : 1;
+    }
+    return_service->model = model;
+    return_service->threads_count = 0;
+    return_service->threads = malloc(sizeof(pthread_t)*threads_count);
+    return_service->queue = malloc(sizeof(plant_context *)*capacity);
+    return_service->queued = 0;
+    return_service->capacity = capacity;
+    return_service->running = malloc(sizeof(plant_context *)*threads_count);
+    return_service->running_count = 0;
+    return_service->shutdown = 0;
+    return_service->completed = 0;
+    return_service->missed = 0;
+    if (return_service->threads == NULL || return_service->queue == NULL || return_service->running == NULL){
+        free(return_service->threads);
+        free(return_service->queue);
+        free(return_service->running);
+        free(return_service);
+        return NULL;
+    }
+
+    //Deadlines are absolute times on CLOCK_MONOTONIC (see controller_service_collect())
+    pthread_condattr_t monotonic;
+    pthread_condattr_init(&monotonic);
+    pthread_condattr_setclock(&monotonic, CLOCK_MONOTONIC);
+    pthread_mutex_init(&return_service->lock, NULL);
+    pthread_cond_init(&return_service->work, NULL);
+    pthread_cond_init(&return_service->finished, &monotonic);
+    pthread_condattr_destroy(&monotonic);
+
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    rt_executor_worker_attributes(&attributes);
+    for(size_t i = 0; i < threads_count; i++){
+        if(pthread_create(&return_service->threads[i], &attributes, controller_service_work, return_service) != 0){
+            break;
+        }
+        return_service->threads_count++;
+    }
+    pthread_attr_destroy(&attributes);
+
+    if(return_service->threads_count == 0){
+        controller_service_free(return_service);
+        return NULL;
+    }
+
+    return return_service;
+}
+
+/**
+ * "Destructor" Stops the workers and deallocates the service
+ */
+void controller_service_free(controller_service *service)
+{
+    pthread_mutex_lock(&service->lock);
+    while(service->queued > 0){
+        plant_finished(service, queue_remove(service, 0), MAILBOX_CANCELLED, INFINITY);
+    }
+    //Running computations stop at their next cancellation point instead of solving to the end
+    for(size_t i = 0; i < service->running_count; i++){
+        cancel_token_cancel(&service->running[i]->cancel);
+    }
+    service->shutdown = 1;
+    pthread_cond_broadcast(&service->work);
+    pthread_mutex_unlock(&service->lock);
+
+    for(size_t i = 0; i < service->threads_count; i++){
+        pthread_join(service->threads[i], NULL);
+    }
+
+    //Clean up!
+    pthread_cond_destroy(&service->finished);
+    pthread_cond_destroy(&service->work);
+    pthread_mutex_destroy(&service->lock);
+    free(service->running);
+    free(service->queue);
+    free(service->threads);
+    free(service);
+}
+
+/**
+ * Queue the computation of the plan of the plant
+ */
+int controller_service_submit(controller_service *service,
+                              plant_context *plant,
+                              double deadline)
+{
+    if(plant->step >= service->model->d_dyn->time_horizon){
+        return -1;
+    }
+    if(deadline < 0){
+        deadline = 0;
+    }
+
+    pthread_mutex_lock(&service->lock);
+    if(plant->pending || service->queued == service->capacity){
+        pthread_mutex_unlock(&service->lock);
+        return -1;
+    }
+
+    //The plant keeps running on now while the plan is computed from the copy
+    gsl_vector_memcpy(plant->start->x, plant->now->x);
+    plant->start->current_abs_state = plant->now->current_abs_state;
+    plant->planning_step = plant->step;
+    cancel_token_reset(&plant->cancel);
+
+    clock_gettime(CLOCK_MONOTONIC, &plant->deadline);
+    long nanoseconds = plant->deadline.tv_nsec + (long)((deadline - (double)(long)deadline)*1e9);
+    plant->deadline.tv_sec += (time_t)deadline + nanoseconds/1000000000L;
+    plant->deadline.tv_nsec = nanoseconds%1000000000L;
+
+    plant->pending = 1;
+    plant->running = 0;
+    plant->queue_index = service->queued;
+    service->queue[service->queued++] = plant;
+    queue_restore(service, plant->queue_index);
+    pthread_cond_signal(&service->work);
+    pthread_mutex_unlock(&service->lock);
+
+    return 0;
+}
+
+/**
+ * Block until the computation of the plant finished or its deadline passed
+ */
+int controller_service_collect(controller_service *service,
+                               plant_context *plant)
+{
+    pthread_mutex_lock(&service->lock);
+    while(plant->pending && !plant->abandoned){
+        int err = pthread_cond_timedwait(&service->finished, &service->lock, &plant->deadline);
+        if(err == ETIMEDOUT && plant->pending){
+            if(!plant->running){
+                //Not started yet: dropped
+                queue_remove(service, plant->queue_index);
+                plant_finished(service, plant, MAILBOX_CANCELLED, INFINITY);
+            } else{
+                //Running: stops at its next cancellation point, the worker finishes it without the caller
+                cancel_token_cancel(&plant->cancel);
+                plant->abandoned = 1;
+                plant->status = MAILBOX_CANCELLED;
+                plant->cost = INFINITY;
+                service->missed++;
+            }
+        }
+    }
+    int status = plant->abandoned ? MAILBOX_CANCELLED : plant->status;
+    plant->planned = (status == MAILBOX_COMPLETED);
+    pthread_mutex_unlock(&service->lock);
+
+    return status;
+}
@@ -0,0 +1,172 @@
+//
+// Created by L.Jonathan Feldstein
+//
+
+#ifndef CIMPLE_CIMPLE_CONTROLLER_SERVICE_H
+#define CIMPLE_CIMPLE_CONTROLLER_SERVICE_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <time.h>
+#include <gsl/gsl_matrix.h>
+#include "cimple_system.h"
+#include "cimple_mailbox.h"
+#include "cimple_workspace.h"
+#include "cimple_random.h"
+
+/**
+ * Everything that changes while one plant is controlled (the model is shared, see control_model)
+ *
+ * now: state of the plant (owned by the caller)
+ * target: abstract state the plant is supposed to reach
+ * step: time step whose input is applied next by plant_context_advance()
+ * u, polytope_list: plan, column i of u is the input of time step i, polytope_list[i] the polytope x(i) has to be in
+ * planned: the plan holds (last collected computation completed)
+ * start, planning_step: state and time step the pending computation plans from (copied on submission, so the caller
+ *      may keep using now)
+ * workspace, r_target: memory of the time step and of get_input()
+ * disturbance: random stream of the simulated disturbance (stream id: index of the plant in the order of allocation,
+ *      random_stream_init() for another one)
+ *
+ * Bookkeeping of the service (under its lock): pending (queued or running), running, abandoned (running past its
+ * deadline, finished by the worker in the background), queue_index, deadline, status and cost of the last computation.
+ */
+typedef struct plant_context{
+
+    current_state *now;
+    int target;
+    size_t step;
+
+    gsl_matrix *u;
+    polytope **polytope_list;
+    int planned;
+
+    current_state *start;
+    size_t planning_step;
+    control_workspace *workspace;
+    gsl_vector *r_target;
+    cancel_token cancel;
+    random_stream disturbance;
+
+    int pending;
+    int running;
+    int abandoned;
+    size_t queue_index;
+    struct timespec deadline;
+    int status;
+    double cost;
+
+}plant_context;
+
+/**
+ * @brief "Constructor" Dynamically allocates the mutable state of one plant controlled with model
+ * @param model
+ * @param now state of the plant
+ * @param target
+ * @return NULL if any memory could not be allocated
+ */
+struct plant_context *plant_context_alloc(control_model *model,
+                                          current_state *now,
+                                          int target);
+
+/**
+ * @brief "Destructor" Deallocates the plant context (not its state now)
+ * @param plant must not be pending (an abandoned computation may still run: free the service first)
+ * @param model
+ */
+void plant_context_free(plant_context *plant,
+                        control_model *model);
+
+/**
+ * @brief Time step of the plant: apply the planned input (if it still brings the state into the next polytope,
+ *        otherwise the safe mode input), update the abstract state and go to the next time step
+ * @param model
+ * @param plant collected (see controller_service_collect()), the plan of an abandoned computation is not read
+ * @param w disturbance of the time step (NULL: simulated)
+ * @return 1 if the planned input was applied, 0 if a fallback was
+ */
+int plant_context_advance(control_model *model,
+                          plant_context *plant,
+                          gsl_vector *w);
+
+/**
+ * Service computing the plans of many plants with one shared model on a fixed pool of workers
+ *
+ * Plants submit a computation with a deadline, the workers take them earliest deadline first (queue: binary heap on
+ * the deadline). A computation whose deadline passed before a worker took it is dropped, a running one is cancelled
+ * and abandoned once its plant collects it after the deadline: the collection returns at once and the worker finishes
+ * it in the background (it stops at its next cancellation point, cdd does not check the token). The model and the precomputations in it are paid once, however many
+ * plants there are.
+ *
+ *      controller_service_submit(service, plant, period);
+ *      ...
+ *      controller_service_collect(service, plant);
+ *      plant_context_advance(model, plant, NULL);
+ *
+ * queue: pending plants not taken by a worker yet (at most capacity)
+ * running: plants whose computation a worker runs (at most threads_count, cancelled when the service is freed)
+ * completed: computations that published a plan, missed: computations dropped or cancelled at their deadline
+ */
+typedef struct controller_service{
+
+    control_model *model;
+
+    size_t threads_count;
+    pthread_t *threads;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t finished;
+    plant_context **queue;
+    size_t queued;
+    size_t capacity;
+    plant_context **running;
+    size_t running_count;
+    int shutdown;
+
+    size_t completed;
+    size_t missed;
+
+}controller_service;
+
+/**
+ * @brief "Constructor" Dynamically allocates the service and starts its workers
+ * @param model shared (read only) by all plants of the service
+ * @param threads_count number of workers (0: one per online processor)
+ * @param capacity maximal number of plants with a pending computation
+ * @return NULL if the service could not be created
+ */
+struct controller_service *controller_service_alloc(control_model *model,
+                                                    size_t threads_count,
+                                                    size_t capacity);
+
+/**
+ * @brief "Destructor" Stops the workers and deallocates the service (queued computations are dropped, running ones
+ *        cancelled, it waits until they reached their next cancellation point)
+ * @param service
+ */
+void controller_service_free(controller_service *service);
+
+/**
+ * @brief Queue the computation of the plan of the plant from its current state and time step
+ * @param service
+ * @param plant
+ * @param deadline seconds from now
+ * @return 0 on success, -1 if the plant is already pending (e.g. an abandoned computation still runs), its time
+ *         horizon is over or the queue is full
+ */
+int controller_service_submit(controller_service *service,
+                              plant_context *plant,
+                              double deadline);
+
+/**
+ * @brief Block until the computation of the plant finished or its deadline passed (it is dropped or cancelled and
+ *        abandoned then, never waits beyond the deadline)
+ * @param service
+ * @param plant
+ * @return see result_mailbox_status (MAILBOX_CANCELLED: deadline missed, or an abandoned computation still runs)
+ */
+int controller_service_collect(controller_service *service,
+                               plant_context *plant);
+
+#endif //CIMPLE_CIMPLE_CONTROLLER_SERVICE_H
@@ -81,7 +81,7 @@ int gsl_vector_to_linterm_gurobi(gsl_vector *q,
 
     int error = 0;
     for(size_t i =0; i < N; i++){
-        error = GRBsetdblattrelement(model, GRB_DBL_ATTR_OBJ, 0, gsl_vector_get(q,i));
+        error = GRBsetdblattrelement(model, GRB_DBL_ATTR_OBJ, (int)i, gsl_vector_get(q,i));
         if(error){
             return error;
         }
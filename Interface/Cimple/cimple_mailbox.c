@@ -0,0 +1,170 @@
+//
+// Created by L.Jonathan Feldstein
+//
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include "cimple_mailbox.h"
+
+/**
+ * Clear the token before a new computation is started
+ */
+void cancel_token_reset(cancel_token *token)
+{
+    __atomic_store_n(&token->cancelled, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Ask the computation to stop as soon as possible
+ */
+void cancel_token_cancel(cancel_token *token)
+{
+    __atomic_store_n(&token->cancelled, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Check whether the computation was asked to stop
+ */
+int cancel_token_is_cancelled(cancel_token *token)
+{
+    return token != NULL && __atomic_load_n(&token->cancelled, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * "Constructor" Dynamically allocates an empty mailbox
+ */
+struct result_mailbox *result_mailbox_alloc(void)
+{
+    struct result_mailbox *return_mailbox = malloc (sizeof (struct result_mailbox));
+    if (return_mailbox == NULL){
+        return NULL;
+    }
+
+    return_mailbox->wakeup = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (return_mailbox->wakeup < 0){
+        free(return_mailbox);
+        return NULL;
+    }
+    return_mailbox->requested = 0;
+    return_mailbox->sequence = 0;
+    return_mailbox->result = NULL;
+    return_mailbox->cost = 0;
+    return_mailbox->status = MAILBOX_FAILED;
+
+    return return_mailbox;
+}
+
+/**
+ * "Destructor" Deallocates the mailbox
+ */
+void result_mailbox_free(result_mailbox *mailbox)
+{
+    close(mailbox->wakeup);
+    free(mailbox);
+}
+
+/**
+ * Ticket for the next computation
+ */
+unsigned long result_mailbox_request(result_mailbox *mailbox)
+{
+    mailbox->requested++;
+    return mailbox->requested;
+}
+
+/**
+ * Publish the result of a computation and wake up a blocking waiter
+ */
+void result_mailbox_publish(result_mailbox *mailbox,
+                            unsigned long ticket,
+                            void *result,
+                            double cost,
+                            int status)
+{
+    //Odd: slot is written, readers back off
+    __atomic_store_n(&mailbox->sequence, 2*ticket-1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store_n(&mailbox->result, result, __ATOMIC_RELAXED);
+    __atomic_store(&mailbox->cost, &cost, __ATOMIC_RELAXED);
+    __atomic_store_n(&mailbox->status, status, __ATOMIC_RELAXED);
+
+    //Even: published, everything written above is visible to a reader that sees it
+    __atomic_store_n(&mailbox->sequence, 2*ticket, __ATOMIC_RELEASE);
+
+    uint64_t one = 1;
+    ssize_t written = write(mailbox->wakeup, &one, sizeof(one));
+    (void)written;
+}
+
+/**
+ * Take the result of a ticket if it was published
+ */
+int result_mailbox_take(result_mailbox *mailbox,
+                        unsigned long ticket,
+                        void **result,
+                        double *cost,
+                        int *status)
+{
+    unsigned long before = __atomic_load_n(&mailbox->sequence, __ATOMIC_ACQUIRE);
+    if(before != 2*ticket){
+        return 0;
+    }
+
+    void *read_result = __atomic_load_n(&mailbox->result, __ATOMIC_RELAXED);
+    double read_cost;
+    __atomic_load(&mailbox->cost, &read_cost, __ATOMIC_RELAXED);
+    int read_status = __atomic_load_n(&mailbox->status, __ATOMIC_RELAXED);
+
+    //Slot overwritten meanwhile (by a later ticket): the values read may be torn
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if(__atomic_load_n(&mailbox->sequence, __ATOMIC_RELAXED) != before){
+        return 0;
+    }
+
+    *result = read_result;
+    if(cost != NULL){
+        *cost = read_cost;
+    }
+    *status = read_status;
+    return 1;
+}
+
+/**
+ * Block until the result of a ticket is published
+ */
+int result_mailbox_wait(result_mailbox *mailbox,
+                        unsigned long ticket,
+                        double timeout)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while(__atomic_load_n(&mailbox->sequence, __ATOMIC_ACQUIRE) != 2*ticket){
+        int wait_ms = -1;
+        if(timeout >= 0){
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            double left = timeout - ((double)(now.tv_sec - start.tv_sec) + (double)(now.tv_nsec - start.tv_nsec)*1e-9);
+            if(left <= 0){
+                return 0;
+            }
+            wait_ms = (int)(left*1e3)+1;
+        }
+
+        struct pollfd wakeup = {mailbox->wakeup, POLLIN, 0};
+        if(poll(&wakeup, 1, wait_ms) > 0){
+            //Reset the counter (publications of earlier tickets wake up as well, the loop checks again)
+            uint64_t count;
+            ssize_t read_bytes = read(mailbox->wakeup, &count, sizeof(count));
+            (void)read_bytes;
+        }
+    }
+    return 1;
+}
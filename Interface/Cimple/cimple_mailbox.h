@@ -0,0 +1,133 @@
+//
+// Created by L.Jonathan Feldstein
+//
+
+#ifndef CIMPLE_CIMPLE_MAILBOX_H
+#define CIMPLE_CIMPLE_MAILBOX_H
+
+#include <stddef.h>
+
+/**
+ * Cooperative cancellation: set by the thread waiting for a result, checked by the solver between iterations
+ * (between the cells of the target region in get_input(), periodically inside GUROBI through a callback)
+ */
+typedef struct cancel_token{
+
+    int cancelled;
+
+}cancel_token;
+
+/**
+ * @brief Clear the token before a new computation is started
+ * @param token
+ */
+void cancel_token_reset(cancel_token *token);
+
+/**
+ * @brief Ask the computation to stop as soon as possible
+ * @param token
+ */
+void cancel_token_cancel(cancel_token *token);
+
+/**
+ * @brief Check whether the computation was asked to stop
+ * @param token (NULL: never cancelled)
+ * @return 1 if cancelled, 0 otherwise
+ */
+int cancel_token_is_cancelled(cancel_token *token);
+
+/**
+ * Status of a published result
+ */
+enum result_mailbox_status{
+
+    MAILBOX_COMPLETED,  // result is valid
+    MAILBOX_FAILED,     // no result found (e.g. infeasible)
+    MAILBOX_CANCELLED   // computation stopped through its cancel token
+
+};
+
+/**
+ * Single slot mailbox between one producer (computation) and one consumer (actuation), without locks
+ *
+ * Every computation gets a ticket from result_mailbox_request() and publishes exactly once under it.
+ * The slot is a sequence lock: sequence = 2*ticket-1 while the result of ticket is written, 2*ticket once it is
+ * published. A consumer thus only takes a result of the ticket it asked for, results of older (late) computations
+ * are never mistaken for the current one.
+ *
+ * requested: last ticket handed out (consumer side only)
+ * wakeup: eventfd written after every publication, blocking waiters poll it (see result_mailbox_wait())
+ */
+typedef struct result_mailbox{
+
+    unsigned long requested;
+    unsigned long sequence;
+
+    void *result;
+    double cost;
+    int status;
+
+    int wakeup;
+
+}result_mailbox;
+
+/**
+ * @brief "Constructor" Dynamically allocates an empty mailbox
+ * @return NULL if the mailbox or its eventfd could not be created
+ */
+struct result_mailbox *result_mailbox_alloc(void);
+
+/**
+ * @brief "Destructor" Deallocates the mailbox
+ * @param mailbox
+ */
+void result_mailbox_free(result_mailbox *mailbox);
+
+/**
+ * @brief Ticket for the next computation (results of earlier tickets are ignored from now on)
+ * @param mailbox
+ * @return
+ */
+unsigned long result_mailbox_request(result_mailbox *mailbox);
+
+/**
+ * @brief Publish the result of a computation and wake up a blocking waiter
+ * @param mailbox
+ * @param ticket ticket of the computation
+ * @param result
+ * @param cost
+ * @param status see result_mailbox_status
+ */
+void result_mailbox_publish(result_mailbox *mailbox,
+                            unsigned long ticket,
+                            void *result,
+                            double cost,
+                            int status);
+
+/**
+ * @brief Take the result of a ticket if it was published (never blocks)
+ * @param mailbox
+ * @param ticket
+ * @param result
+ * @param cost (may be NULL)
+ * @param status
+ * @return 1 if the result of ticket is published, 0 otherwise
+ */
+int result_mailbox_take(result_mailbox *mailbox,
+                        unsigned long ticket,
+                        void **result,
+                        double *cost,
+                        int *status);
+
+/**
+ * @brief Block until the result of a ticket is published
+ * @param mailbox
+ * @param ticket
+ * @param timeout in seconds (< 0: no timeout)
+ * @return 1 if the result of ticket is published, 0 if the timeout ran out first
+ */
+int result_mailbox_wait(result_mailbox *mailbox,
+                        unsigned long ticket,
+                        double timeout);
+
+#endif //CIMPLE_CIMPLE_MAILBOX_H
@@ -1,7 +1,732 @@
 #include <gsl/gsl_matrix.h>
 #include <gsl/gsl_vector_double.h>
 #include <gsl/gsl_vector.h>
+#include <gsl/gsl_linalg.h>
+#include <gsl/gsl_errno.h>
 #include "cimple_mpc_computation.h"
+#include "cimple_trace.h"
+
+/**
+ * Log file of the GUROBI environments: none, computations of several plants run concurrently
+ * (with CIMPLE_DEBUG_QP all of them write qp.log, single plant only)
+ */
+#ifdef CIMPLE_DEBUG_QP
+#define QP_LOG_FILE "qp.log"
+#else
+#define QP_LOG_FILE NULL
+#endif
+
+/**
+ * "Constructor" Dynamically allocates the space for the polytope references of N+1 stages
+ */
+struct horizon_polytopes *horizon_polytopes_alloc(size_t N,
+                                                  size_t distinct_count){
+
+    struct horizon_polytopes *return_horizon = malloc (sizeof (struct horizon_polytopes));
+    if (return_horizon == NULL){
+        return NULL;
+    }
+
+    return_horizon->polytopes = malloc(sizeof(polytope *)*distinct_count);
+    if (return_horizon->polytopes == NULL) {
+        free (return_horizon);
+        return NULL;
+    }
+
+    return_horizon->stage_index = malloc(sizeof(size_t)*(N+1));
+    if (return_horizon->stage_index == NULL) {
+        free (return_horizon->polytopes);
+        free (return_horizon);
+        return NULL;
+    }
+
+    return_horizon->N = N;
+    return_horizon->distinct_count = distinct_count;
+
+    return return_horizon;
+}
+
+/**
+ * "Destructor" Deallocates the list, the referenced polytopes are not freed
+ */
+void horizon_polytopes_free(horizon_polytopes *horizon){
+    free(horizon->stage_index);
+    free(horizon->polytopes);
+    free(horizon);
+}
+
+/**
+ * Polytope stage i of the horizon has to be in
+ */
+polytope *horizon_polytopes_stage(horizon_polytopes *horizon,
+                                  size_t i){
+    return horizon->polytopes[horizon->stage_index[i]];
+}
+
+/**
+ * Make every distinct polytope of the horizon robust against the disturbance by subtracting EW (only once)
+ */
+static polytope **robust_horizon_polytopes(system_dynamics *s_dyn,
+                                           horizon_polytopes *horizon){
+
+    polytope *scaled_W_set = polytope_linear_transform(s_dyn->W_set, s_dyn->E); // multiplication: EW
+
+    polytope **robust_distinct = malloc(sizeof(polytope *)*horizon->distinct_count);
+    for(size_t d = 0; d < horizon->distinct_count; d++){
+        robust_distinct[d] = polytope_pontryagin(horizon->polytopes[d], scaled_W_set);
+    }
+
+    //Clean up!
+    polytope_free(scaled_W_set);
+
+    return robust_distinct;
+}
+
+/**
+ * Assemble the path constraints of horizon N from the robust distinct polytopes of the horizon
+ */
+static path_constraints *assemble_path_constraints(system_dynamics *s_dyn,
+                                                   horizon_polytopes *horizon,
+                                                   polytope **robust_distinct,
+                                                   size_t N){
+    // Help variables
+    size_t n = s_dyn->A->size2;  // State space dimension
+    size_t m = s_dyn->B->size2;
+    size_t sum_polytope_dim = 0; // Sum of dimension n of all polytopes in the list (without x(0))
+
+    for(size_t i = 1; i < N+1; i++){
+        sum_polytope_dim += robust_distinct[horizon->stage_index[i]]->H->size1;
+    }
+
+    /*
+     * Every stage i only depends on x(0) and the inputs before it:
+     *
+     *      x(i) = A^i.x(0) + [A^(i-1)B ... AB B 0 ... 0].[u(0)' ... u(N-1)']'
+     *
+     * which is block row i of L_default. Thus L = diag(H_0,...,H_N).L_default is assembled block row by block row:
+     *
+     *      L_x block row i = H_i.A^i
+     *      L_u block row i = |H_i.[A^(i-1)B ... B]  0 ... 0|
+     *      G   block row i = G_i
+     *
+     * Constraints on x(0) (block row 0) are obviously already satisfied and are not assembled at all.
+     */
+    path_constraints *constraints = path_constraints_alloc(sum_polytope_dim, n, m, N);
+    gsl_matrix_set_zero(constraints->L_u);
+
+    size_t polytope_count = 0;
+    for(size_t i = 1; i<N+1; i++){
+        polytope *stage = robust_distinct[horizon->stage_index[i]];
+        size_t k = stage->H->size1;
+
+        gsl_matrix_view A_i = gsl_matrix_submatrix(s_dyn->aux_matrices->L_default, i*n, 0, n, n);
+        gsl_matrix_view AB_i = gsl_matrix_submatrix(s_dyn->aux_matrices->L_default, i*n, n, n, m*i);
+
+        //L_u block row i (u(i)...u(N-1) stay zero)
+        gsl_matrix_view L_u_i = gsl_matrix_submatrix(constraints->L_u, polytope_count, 0, k, m*i);
+        gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, stage->H, &AB_i.matrix, 0.0, &L_u_i.matrix);
+
+        //L_x block row i
+        gsl_matrix_view L_x_i = gsl_matrix_submatrix(constraints->L_x, polytope_count, 0, k, n);
+        gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, stage->H, &A_i.matrix, 0.0, &L_x_i.matrix);
+
+        //G block row i
+        gsl_vector_view G_i = gsl_vector_subvector(constraints->G, polytope_count, k);
+        gsl_vector_memcpy(&G_i.vector, stage->G);
+
+        polytope_count += k;
+    }
+
+    return constraints;
+}
+
+/**
+ * "Constructor" Dynamically allocates the space for k path constraints
+ */
+struct path_constraints *path_constraints_alloc(size_t k,
+                                                size_t n,
+                                                size_t m,
+                                                size_t N){
+
+    struct path_constraints *return_constraints = malloc (sizeof (struct path_constraints));
+    if (return_constraints == NULL){
+        return NULL;
+    }
+
+    return_constraints->L_u = gsl_matrix_alloc(k, m*N);
+    if (return_constraints->L_u == NULL) {
+        free (return_constraints);
+        return NULL;
+    }
+
+    return_constraints->L_x = gsl_matrix_alloc(k, n);
+    if (return_constraints->L_x == NULL) {
+        gsl_matrix_free(return_constraints->L_u);
+        free (return_constraints);
+        return NULL;
+    }
+
+    return_constraints->G = gsl_vector_alloc(k);
+    if (return_constraints->G == NULL) {
+        gsl_matrix_free(return_constraints->L_x);
+        gsl_matrix_free(return_constraints->L_u);
+        free (return_constraints);
+        return NULL;
+    }
+
+    return return_constraints;
+}
+
+/**
+ * "Destructor" Deallocates the dynamically allocated memory of the path constraints
+ */
+void path_constraints_free(path_constraints *constraints){
+    gsl_matrix_free(constraints->L_u);
+    gsl_matrix_free(constraints->L_x);
+    gsl_vector_free(constraints->G);
+    free(constraints);
+}
+
+/**
+ * Polytope in u of the path constraints for the current state: L_u.u <= G - L_x.x
+ */
+polytope *path_constraints_evaluate(path_constraints *constraints,
+                                    gsl_vector *x){
+
+    polytope *return_constraints = polytope_alloc(constraints->L_u->size1, constraints->L_u->size2);
+    gsl_matrix_memcpy(return_constraints->H, constraints->L_u);
+    gsl_vector_memcpy(return_constraints->G, constraints->G);
+    gsl_blas_dgemv(CblasNoTrans, -1.0, constraints->L_x, x, 1.0, return_constraints->G);
+
+    return return_constraints;
+}
+
+/**
+ * Compute the weights of the quadratic problem of horizon h
+ */
+struct horizon_cost *horizon_cost_compute(system_dynamics *s_dyn,
+                                          cost_function *f_cost,
+                                          size_t h){
+
+    size_t n = s_dyn->A->size1;
+    size_t m = s_dyn->B->size2;
+
+    struct horizon_cost *return_cost = malloc (sizeof (struct horizon_cost));
+    if (return_cost == NULL){
+        return NULL;
+    }
+    return_cost->P = gsl_matrix_alloc(m*h, m*h);
+    return_cost->F_x = gsl_matrix_alloc(m*h, n);
+    return_cost->f = gsl_vector_alloc(m*h);
+
+    //P and q(x = 0) = f + 0.5*Ct'.r from the condensed cost function
+    gsl_vector *x_zero = gsl_vector_calloc(n);
+    condense_cost_function(return_cost->P, return_cost->f, x_zero, s_dyn, f_cost, h);
+
+    //r is only added at evaluation (it is changed for every target polytope): f = q(x = 0) - 0.5*Ct'.r
+    gsl_matrix_view Ct_h = gsl_matrix_submatrix(s_dyn->aux_matrices->Ct, 0, 0, n*h, m*h);
+    gsl_vector_view r_view = gsl_vector_subvector(f_cost->r,(f_cost->r->size-n*h),n*h);
+    gsl_blas_dgemv(CblasTrans, -0.5, &Ct_h.matrix, &r_view.vector, 1.0, return_cost->f);
+
+    //F_x = Ct'.R'.R.A_N = (R.Ct)'.(R.A_N)
+    gsl_matrix_view R_view = gsl_matrix_submatrix(f_cost->R,(f_cost->R->size1-n*h),(f_cost->R->size2-n*h),n*h,n*h);
+    gsl_matrix_view A_N_h = gsl_matrix_submatrix(s_dyn->aux_matrices->A_N, 0, 0, n*h, n);
+    gsl_matrix *R_dot_Ct = gsl_matrix_alloc(n*h, m*h);
+    gsl_matrix *R_dot_A_N = gsl_matrix_alloc(n*h, n);
+    gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, &R_view.matrix, &Ct_h.matrix, 0.0, R_dot_Ct);
+    gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, &R_view.matrix, &A_N_h.matrix, 0.0, R_dot_A_N);
+    gsl_blas_dgemm(CblasTrans, CblasNoTrans, 1.0, R_dot_Ct, R_dot_A_N, 0.0, return_cost->F_x);
+
+    //Cholesky factorisation of P (only exists if P is positive definite, e.g. Q of full rank)
+    return_cost->P_cholesky = gsl_matrix_alloc(m*h, m*h);
+    gsl_matrix_memcpy(return_cost->P_cholesky, return_cost->P);
+    gsl_error_handler_t *default_handler = gsl_set_error_handler_off();
+    int status = gsl_linalg_cholesky_decomp(return_cost->P_cholesky);
+    gsl_set_error_handler(default_handler);
+    if(status){
+        gsl_matrix_free(return_cost->P_cholesky);
+        return_cost->P_cholesky = NULL;
+    }
+
+    //Clean up!
+    gsl_vector_free(x_zero);
+    gsl_matrix_free(R_dot_Ct);
+    gsl_matrix_free(R_dot_A_N);
+
+    return return_cost;
+}
+
+/**
+ * "Destructor" Deallocates the dynamically allocated memory of the weights of one horizon
+ */
+void horizon_cost_free(horizon_cost *cost){
+    gsl_matrix_free(cost->P);
+    if(cost->P_cholesky != NULL){
+        gsl_matrix_free(cost->P_cholesky);
+    }
+    gsl_matrix_free(cost->F_x);
+    gsl_vector_free(cost->f);
+    free(cost);
+}
+
+/**
+ * Linear weight q = F_x.x + f + 0.5*Ct'.r of the quadratic problem for the current state and cost vector r
+ */
+void horizon_cost_linear_term(gsl_vector *q,
+                              horizon_cost *cost,
+                              gsl_vector *x,
+                              system_dynamics *s_dyn,
+                              cost_function *f_cost,
+                              size_t h){
+
+    size_t n = s_dyn->A->size1;
+    size_t m = s_dyn->B->size2;
+
+    gsl_matrix_view Ct_h = gsl_matrix_submatrix(s_dyn->aux_matrices->Ct, 0, 0, n*h, m*h);
+    gsl_vector_view r_view = gsl_vector_subvector(f_cost->r,(f_cost->r->size-n*h),n*h);
+
+    gsl_vector_memcpy(q, cost->f);
+    gsl_blas_dgemv(CblasNoTrans, 1.0, cost->F_x, x, 1.0, q);
+    gsl_blas_dgemv(CblasTrans, 0.5, &Ct_h.matrix, &r_view.vector, 1.0, q);
+}
+
+/**
+ * Polytope the state starts in (depends on conservative path or not), NULL if it has to be convex but is not
+ */
+static polytope *start_polytope(discrete_dynamics *d_dyn,
+                                int start){
+
+    if (d_dyn->conservative == 1){
+        // Take convex hull or polytope as starting polytope P1
+
+        // if convex_hull != NULL => hull was computed => several polytopes in that region
+        if (d_dyn->abstract_states_set[start]->convex_hull->H != NULL){
+            return d_dyn->abstract_states_set[start]->convex_hull;
+        } else{
+            return d_dyn->abstract_states_set[start]->cells[0]->polytope_description;
+        }
+    } else{
+        // Take original proposition preserving abstract state as constraint
+        // must be single polytope (ensuring convex)
+
+        if (d_dyn->original_regions[start]->cells_count == 1){
+            return d_dyn->original_regions[start]->cells[0]->polytope_description;
+        } else {
+            return NULL;
+        }
+    }
+}
+
+/**
+ * Index of the abstract state in the discrete abstraction (-1 if not part of it)
+ */
+static int abstract_state_index(discrete_dynamics *d_dyn,
+                                abstract_state *state){
+
+    for(int i = 0; i < d_dyn->abstract_states_count; i++){
+        if(d_dyn->abstract_states_set[i] == state){
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Path constraints of every horizon 1,...,N from P1 into every cell of the target abstract state
+ */
+static path_constraints **pair_path_constraints(system_dynamics *s_dyn,
+                                                polytope *P1,
+                                                abstract_state *target,
+                                                size_t N){
+
+    path_constraints **pair_constraints = malloc(sizeof(path_constraints *)*target->cells_count*N);
+
+    for(int c = 0; c < target->cells_count; c++){
+        polytope *P3 = target->cells[c]->polytope_description;
+
+        horizon_polytopes *horizon = horizon_polytopes_alloc(N, (P1 == P3) ? 1 : 2);
+        horizon->polytopes[0] = P1;
+        horizon->polytopes[horizon->distinct_count-1] = P3;
+
+        //Robust polytopes are shared by all horizons
+        polytope **robust_distinct = robust_horizon_polytopes(s_dyn, horizon);
+
+        for(size_t h = 1; h < N+1; h++){
+            horizon->N = h;
+            for (size_t i = 0; i < h; i++) {
+                horizon->stage_index[i] = 0;
+            }
+            horizon->stage_index[h] = horizon->distinct_count-1;
+            pair_constraints[c*N+h-1] = assemble_path_constraints(s_dyn, horizon, robust_distinct, h);
+        }
+
+        //Clean up!
+        for(size_t d = 0; d < horizon->distinct_count; d++){
+            polytope_free(robust_distinct[d]);
+        }
+        free(robust_distinct);
+        horizon_polytopes_free(horizon);
+    }
+
+    return pair_constraints;
+}
+
+/**
+ * Precompute the set-up of the control problem for every horizon 1,...,N and every reachable (start, target) pair
+ */
+struct horizon_family *horizon_family_compute(discrete_dynamics *d_dyn,
+                                              system_dynamics *s_dyn,
+                                              cost_function *f_cost){
+
+    size_t N = d_dyn->time_horizon;
+    int count = d_dyn->abstract_states_count;
+
+    struct horizon_family *return_family = malloc (sizeof (struct horizon_family));
+    if (return_family == NULL){
+        return NULL;
+    }
+    return_family->N = N;
+    return_family->abstract_states_count = count;
+    return_family->cells_count = malloc(sizeof(int)*count);
+    return_family->cost = malloc(sizeof(horizon_cost *)*N);
+    return_family->constraints = malloc(sizeof(path_constraints **)*count*count);
+
+    for(int i = 0; i < count; i++){
+        return_family->cells_count[i] = d_dyn->abstract_states_set[i]->cells_count;
+    }
+    for(int i = 0; i < count*count; i++){
+        return_family->constraints[i] = NULL;
+    }
+
+    //Weights of the quadratic problem only depend on the horizon
+    for(size_t h = 1; h < N+1; h++){
+        return_family->cost[h-1] = horizon_cost_compute(s_dyn, f_cost, h);
+    }
+
+    //Path constraints for every transition (and for staying in the same abstract state)
+    for(int start = 0; start < count; start++){
+        polytope *P1 = start_polytope(d_dyn, start);
+        if(P1 == NULL){
+            //Computed (and reported) on the fly by get_input()
+            continue;
+        }
+        abstract_state *start_state = d_dyn->abstract_states_set[start];
+        for(int t = -1; t < start_state->transitions_out_count; t++){
+            int target = (t < 0) ? start : abstract_state_index(d_dyn, start_state->transitions_out[t]);
+            if(target < 0 || return_family->constraints[start*count+target] != NULL){
+                continue;
+            }
+            return_family->constraints[start*count+target] = pair_path_constraints(s_dyn, P1, d_dyn->abstract_states_set[target], N);
+        }
+    }
+
+    return return_family;
+}
+
+/**
+ * "Destructor" Deallocates the dynamically allocated memory of the horizon family
+ */
+void horizon_family_free(horizon_family *family){
+    int count = family->abstract_states_count;
+    for(int start = 0; start < count; start++){
+        for(int target = 0; target < count; target++){
+            path_constraints **pair_constraints = family->constraints[start*count+target];
+            if(pair_constraints == NULL){
+                continue;
+            }
+            for(size_t i = 0; i < family->cells_count[target]*family->N; i++){
+                path_constraints_free(pair_constraints[i]);
+            }
+            free(pair_constraints);
+        }
+    }
+    for(size_t h = 0; h < family->N; h++){
+        horizon_cost_free(family->cost[h]);
+    }
+    free(family->constraints);
+    free(family->cost);
+    free(family->cells_count);
+    free(family);
+}
+
+/**
+ * Precomputed path constraints from abstract state start into cell of abstract state target for horizon h
+ */
+path_constraints *horizon_family_constraints(horizon_family *family,
+                                             int start,
+                                             int target,
+                                             int cell,
+                                             size_t h){
+
+    if(family == NULL || h < 1 || h > family->N){
+        return NULL;
+    }
+    int count = family->abstract_states_count;
+    if(start < 0 || start >= count || target < 0 || target >= count || cell < 0 || cell >= family->cells_count[target]){
+        return NULL;
+    }
+    path_constraints **pair_constraints = family->constraints[start*count+target];
+    if(pair_constraints == NULL){
+        return NULL;
+    }
+    return pair_constraints[cell*family->N+h-1];
+}
+
+/**
+ * Precomputed weights of the quadratic problem for horizon h
+ */
+horizon_cost *horizon_family_cost(horizon_family *family,
+                                  size_t h){
+
+    if(family == NULL || h < 1 || h > family->N){
+        return NULL;
+    }
+    return family->cost[h-1];
+}
+
+/**
+ * "Constructor" Dynamically allocates the memory of the main computation and loads its GUROBI environment
+ */
+struct qp_workspace *qp_workspace_alloc(size_t m,
+                                        size_t N){
+
+    struct qp_workspace *return_workspace = malloc (sizeof (struct qp_workspace));
+    if (return_workspace == NULL){
+        return NULL;
+    }
+
+    return_workspace->m = m;
+    return_workspace->N = N;
+    return_workspace->P = gsl_matrix_alloc(N*m, N*m);
+    return_workspace->q = gsl_vector_alloc(N*m);
+    return_workspace->u = gsl_vector_alloc(N*m);
+    return_workspace->slack = gsl_vector_alloc(N*m);
+    return_workspace->env = NULL;
+    if (return_workspace->P == NULL || return_workspace->q == NULL || return_workspace->u == NULL
+        || return_workspace->slack == NULL){
+        qp_workspace_free(return_workspace);
+        return NULL;
+    }
+
+    int error = GRBloadenv(&return_workspace->env, QP_LOG_FILE);
+    if (!error){
+        error = GRBsetintparam(return_workspace->env, GRB_INT_PAR_OUTPUTFLAG, 0);
+    }
+    if (error){
+        qp_workspace_free(return_workspace);
+        return NULL;
+    }
+
+    return return_workspace;
+}
+
+/**
+ * "Destructor" Deallocates the memory of the main computation and frees its GUROBI environment
+ */
+void qp_workspace_free(qp_workspace *workspace){
+
+    if(workspace->P != NULL){
+        gsl_matrix_free(workspace->P);
+    }
+    if(workspace->q != NULL){
+        gsl_vector_free(workspace->q);
+    }
+    if(workspace->u != NULL){
+        gsl_vector_free(workspace->u);
+    }
+    if(workspace->slack != NULL){
+        gsl_vector_free(workspace->slack);
+    }
+    if(workspace->env != NULL){
+        GRBfreeenv(workspace->env);
+    }
+    free(workspace);
+}
+
+/**
+ * Check whether all blocks outside the block diagonal (block size k) of the matrix are zero
+ */
+static bool is_block_diagonal(gsl_matrix *X,
+                              size_t k){
+
+    for(size_t i = 0; i<X->size1; i++){
+        for(size_t j = 0; j<X->size2; j++){
+            if(i/k != j/k && gsl_matrix_get(X, i, j) != 0){
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Condense the cost function over the next N time steps into the weights of the quadratic problem
+ */
+void condense_cost_function(gsl_matrix *P,
+                            gsl_vector *q,
+                            gsl_vector *x,
+                            system_dynamics *s_dyn,
+                            cost_function *f_cost,
+                            size_t N){
+
+    size_t n = s_dyn->A->size1;
+    size_t m = s_dyn->B->size2;
+
+    //Weights of the current horizon are the trailing blocks of the weights defined for the full horizon
+    gsl_matrix_view R_view = gsl_matrix_submatrix(f_cost->R,(f_cost->R->size1-n*N),(f_cost->R->size2-n*N),n*N,n*N);
+    gsl_matrix_view Q_view = gsl_matrix_submatrix(f_cost->Q,(f_cost->Q->size1-m*N),(f_cost->Q->size2-m*N),m*N,m*N);
+    gsl_vector_view r_view = gsl_vector_subvector(f_cost->r,(f_cost->r->size-n*N),n*N);
+
+    //Markov parameters: Gamma = |B AB A^2B ... A^(N-1)B|
+    gsl_matrix *Gamma = gsl_matrix_alloc(n, m*N);
+    gsl_matrix_view Gamma_0 = gsl_matrix_submatrix(Gamma, 0, 0, n, m);
+    gsl_matrix_memcpy(&Gamma_0.matrix, s_dyn->B);
+    for(size_t d = 1; d<N; d++){
+        gsl_matrix_view Gamma_prev = gsl_matrix_submatrix(Gamma, 0, (d-1)*m, n, m);
+        gsl_matrix_view Gamma_d = gsl_matrix_submatrix(Gamma, 0, d*m, n, m);
+        gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, s_dyn->A, &Gamma_prev.matrix, 0.0, &Gamma_d.matrix);
+    }
+
+    //Free response (u = 0) of the system: x_bar(k) = A.x_bar(k-1) + K, x_bar(0) = x
+    //i.e. x_bar = A_N.x + A_K.K_hat, computed in one forward pass
+    gsl_vector *x_bar = gsl_vector_alloc(n*N);
+    gsl_vector_const_view x_start = gsl_vector_const_subvector(x, 0, n);
+    for(size_t k = 0; k<N; k++){
+        gsl_vector_view x_bar_k = gsl_vector_subvector(x_bar, k*n, n);
+        if(k == 0){
+            gsl_blas_dgemv(CblasNoTrans, 1.0, s_dyn->A, &x_start.vector, 0.0, &x_bar_k.vector);
+        } else{
+            gsl_vector_view x_bar_prev = gsl_vector_subvector(x_bar, (k-1)*n, n);
+            gsl_blas_dgemv(CblasNoTrans, 1.0, s_dyn->A, &x_bar_prev.vector, 0.0, &x_bar_k.vector);
+        }
+        gsl_vector_add(&x_bar_k.vector, s_dyn->K);
+    }
+
+    gsl_matrix_set_zero(P);
+
+    if(is_block_diagonal(&R_view.matrix, n) && is_block_diagonal(&Q_view.matrix, m)){
+        /*
+         * Stage-wise weights: S_k = R_kk'.R_kk on x(k), k = 1,...,N
+         *
+         * Backward recursion over the stages:
+         *
+         *      W_N = S_N
+         *      W_k = S_k + A'.W_(k+1).A
+         *
+         * gives for i >= j the blocks of P:
+         *
+         *      P_ij = B'.W_(i+1).A^(i-j)B (+ Q_ii'.Q_ii if i == j)
+         *
+         * and with the stage gradients g_k = S_k.x_bar(k) + 0.5*r_k (adjoint recursion):
+         *
+         *      lambda_N = g_N
+         *      lambda_k = g_k + A'.lambda_(k+1)
+         *      q_j = B'.lambda_(j+1)
+         */
+        gsl_matrix *W = gsl_matrix_alloc(n, n);
+        gsl_matrix *S = gsl_matrix_alloc(n, n);
+        gsl_matrix *W_A = gsl_matrix_alloc(n, n);
+        gsl_matrix *BW = gsl_matrix_alloc(m, n);
+        gsl_vector *lambda = gsl_vector_alloc(n);
+        gsl_vector *g = gsl_vector_alloc(n);
+
+        gsl_matrix_set_zero(W);
+        gsl_vector_set_zero(lambda);
+        for(size_t k = N; k>0; k--){
+            //S_k = R_kk'.R_kk (symmetric rank-k update, only lower triangle is filled)
+            gsl_matrix_view R_kk = gsl_matrix_submatrix(&R_view.matrix, (k-1)*n, (k-1)*n, n, n);
+            gsl_blas_dsyrk(CblasLower, CblasTrans, 1.0, &R_kk.matrix, 0.0, S);
+            for(size_t a = 0; a<n; a++){
+                for(size_t b = a+1; b<n; b++){
+                    gsl_matrix_set(S, a, b, gsl_matrix_get(S, b, a));
+                }
+            }
+
+            //W_k = S_k + A'.W_(k+1).A
+            gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, W, s_dyn->A, 0.0, W_A);
+            gsl_blas_dgemm(CblasTrans, CblasNoTrans, 1.0, s_dyn->A, W_A, 0.0, W);
+            gsl_matrix_add(W, S);
+
+            //lambda_k = S_k.x_bar(k) + 0.5*r_k + A'.lambda_(k+1)
+            gsl_vector_view x_bar_k = gsl_vector_subvector(x_bar, (k-1)*n, n);
+            gsl_vector_view r_k = gsl_vector_subvector(&r_view.vector, (k-1)*n, n);
+            gsl_vector_memcpy(g, &r_k.vector);
+            gsl_blas_dgemv(CblasNoTrans, 1.0, S, &x_bar_k.vector, 0.5, g);
+            gsl_blas_dgemv(CblasTrans, 1.0, s_dyn->A, lambda, 1.0, g);
+            gsl_vector_memcpy(lambda, g);
+
+            //Input u(k-1) is the first one to influence x(k)
+            size_t i = k-1;
+            gsl_vector_view q_i = gsl_vector_subvector(q, i*m, m);
+            gsl_blas_dgemv(CblasTrans, 1.0, s_dyn->B, lambda, 0.0, &q_i.vector);
+
+            //Block row i of P up to the diagonal: P_ij = (B'.W_(i+1)).A^(i-j)B
+            gsl_blas_dgemm(CblasTrans, CblasNoTrans, 1.0, s_dyn->B, W, 0.0, BW);
+            for(size_t j = 0; j<=i; j++){
+                gsl_matrix_view Gamma_ij = gsl_matrix_submatrix(Gamma, 0, (i-j)*m, n, m);
+                gsl_matrix_view P_ij = gsl_matrix_submatrix(P, i*m, j*m, m, m);
+                gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, BW, &Gamma_ij.matrix, 0.0, &P_ij.matrix);
+            }
+
+            //Input weight Q_ii'.Q_ii (symmetric rank-k update on the diagonal block)
+            gsl_matrix_view Q_ii = gsl_matrix_submatrix(&Q_view.matrix, i*m, i*m, m, m);
+            gsl_matrix_view P_ii = gsl_matrix_submatrix(P, i*m, i*m, m, m);
+            gsl_blas_dsyrk(CblasLower, CblasTrans, 1.0, &Q_ii.matrix, 1.0, &P_ii.matrix);
+        }
+
+        //Mirror lower triangle into upper triangle
+        for(size_t a = 0; a<P->size1; a++){
+            for(size_t b = a+1; b<P->size2; b++){
+                gsl_matrix_set(P, a, b, gsl_matrix_get(P, b, a));
+            }
+        }
+
+        //Clean up!
+        gsl_matrix_free(W);
+        gsl_matrix_free(S);
+        gsl_matrix_free(W_A);
+        gsl_matrix_free(BW);
+        gsl_vector_free(lambda);
+        gsl_vector_free(g);
+    } else{
+        /*
+         * Weights couple different time steps: dense products with the block-Toeplitz matrix Ct of the Markov parameters
+         *
+         *      P = Q'.Q + Ct'.R'.R.Ct
+         *      q = Ct'.(R'.R.x_bar + 0.5*r)
+         */
+        gsl_matrix *Ct = gsl_matrix_alloc(n*N, m*N);
+        gsl_matrix_set_zero(Ct);
+        for(size_t i = 0; i<N; i++){
+            for(size_t j = 0; j<=i; j++){
+                gsl_matrix_view Gamma_ij = gsl_matrix_submatrix(Gamma, 0, (i-j)*m, n, m);
+                gsl_matrix_view Ct_ij = gsl_matrix_submatrix(Ct, i*n, j*m, n, m);
+                gsl_matrix_memcpy(&Ct_ij.matrix, &Gamma_ij.matrix);
+            }
+        }
+        gsl_matrix *R2 = gsl_matrix_alloc(n*N, n*N);
+        gsl_blas_dgemm(CblasTrans, CblasNoTrans, 1.0, &R_view.matrix, &R_view.matrix, 0.0, R2);
+        gsl_matrix *R2_dot_Ct = gsl_matrix_alloc(n*N, m*N);
+        gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, R2, Ct, 0.0, R2_dot_Ct);
+        gsl_blas_dgemm(CblasTrans, CblasNoTrans, 1.0, Ct, R2_dot_Ct, 0.0, P);
+        gsl_blas_dgemm(CblasTrans, CblasNoTrans, 1.0, &Q_view.matrix, &Q_view.matrix, 1.0, P);
+
+        gsl_vector *gradient = gsl_vector_alloc(n*N);
+        gsl_vector_memcpy(gradient, &r_view.vector);
+        gsl_blas_dgemv(CblasNoTrans, 1.0, R2, x_bar, 0.5, gradient);
+        gsl_blas_dgemv(CblasTrans, 1.0, Ct, gradient, 0.0, q);
+
+        //Clean up!
+        gsl_matrix_free(Ct);
+        gsl_matrix_free(R2);
+        gsl_matrix_free(R2_dot_Ct);
+        gsl_vector_free(gradient);
+    }
+
+    //Clean up!
+    gsl_matrix_free(Gamma);
+    gsl_vector_free(x_bar);
+}
 
 /**
  * Set up weight matrices for the quadratic problem
@@ -15,84 +740,8 @@ polytope * set_cost_function(gsl_matrix *P,
                              cost_function *f_cost,
                              size_t time_horizon){
 
-    size_t N = time_horizon;
-    size_t n = s_dyn->A->size1;
-    size_t m = s_dyn->B->size2;
-
-
     /*Calculate P and q */
-    //           |B     0     0     0   0|
-    //           |AB    B     0     0   0|
-    //      Ct = |A^2B  AB    B     0   0|
-    //           |A^3B  A^2B  AB    B   0|
-    //           |A^4B  A^3B  A^2B  AB  B|
-
-    //            |I    0    0    0  0|
-    //            |A    I    0    0  0|
-    //      A_K = |A^2  A    I    0  0|
-    //            |A^3  A^2  A    I  0|
-    //            |A^4  A^3  A^2  A  I|
-
-    //            |A  |
-    //            |A^2|
-    //      A_N = |A^3|
-    //            |A^4|
-    //            |A^5|
-
-    //P = Q2 + Ct^T.R2.Ct
-    //q = {([x^T.A_N^T + (A_K.K_hat)^T].[R2.Ct])+(0.5*r^T.Ct)}^T
-
-    // symmetrize
-    gsl_matrix * Q2 = gsl_matrix_alloc(N*m, N*m);
-    gsl_matrix_view Q_view = gsl_matrix_submatrix(f_cost->Q,(f_cost->Q->size1-N),(f_cost->Q->size2-N),(N),(N));
-    gsl_blas_dgemm(CblasTrans, CblasNoTrans, 1.0, &Q_view.matrix,&Q_view.matrix, 0.0, Q2);
-    gsl_matrix * R2 = gsl_matrix_alloc(N*n, N*n);
-    gsl_matrix_view R_view = gsl_matrix_submatrix(f_cost->R,(f_cost->R->size1-N),(f_cost->R->size2-N),(N),(N));
-    gsl_blas_dgemm(CblasTrans, CblasNoTrans, 1.0, &R_view.matrix,&R_view.matrix, 0.0, R2);
-
-
-    //Calculate P
-    gsl_matrix * R2_dot_Ct = gsl_matrix_alloc(N*n, N*m);
-    gsl_matrix_set_zero(R2_dot_Ct);
-    gsl_matrix_view Ct_view = gsl_matrix_submatrix(s_dyn->aux_matrices->Ct,0,0,N,N);
-    gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, R2, &Ct_view.matrix, 0.0, R2_dot_Ct);
-    gsl_blas_dgemm(CblasTrans, CblasNoTrans, 1.0, &Ct_view.matrix, R2_dot_Ct, 0.0, P);
-    gsl_matrix_add(P, Q2);
-
-    //Clean up!
-    gsl_matrix_free(R2);
-    gsl_matrix_free(Q2);
-
-    //Calculate q
-    gsl_vector_set_zero(q);
-    gsl_vector * A_N_dot_x = gsl_vector_alloc(N*n);
-    gsl_vector_set_zero(A_N_dot_x);
-    gsl_matrix_view A_N_view = gsl_matrix_submatrix(s_dyn->aux_matrices->A_N,0,0,N,1);
-    gsl_blas_dgemv(CblasNoTrans, 1.0, &A_N_view.matrix, now->x, 0.0, A_N_dot_x);
-    gsl_vector * A_K_dot_K_hat = gsl_vector_alloc(N*n);
-    gsl_vector_set_zero(A_K_dot_K_hat);
-    gsl_matrix_view A_K_view = gsl_matrix_submatrix(s_dyn->aux_matrices->A_K,0,0,N,N);
-    gsl_vector_view K_hat_view = gsl_vector_subvector(s_dyn->aux_matrices->K_hat,0,N);
-    gsl_blas_dgemv(CblasNoTrans, 1.0, &A_K_view.matrix, &K_hat_view.vector, 0.0, A_K_dot_K_hat);
-
-    //[x^T.A_N^T + (A_K.K_hat)^T]^T
-    gsl_vector_add(A_N_dot_x, A_K_dot_K_hat);
-
-    //{([x^T.A_N^T + (A_K.K_hat)^T].[R2.Ct])}^T
-    //R2_dot_Ct was calculated earlier
-    gsl_blas_dgemv(CblasTrans, 1.0, R2_dot_Ct, A_N_dot_x, 0.0, q);
-
-    //(0.5*r^T.Ct)
-    gsl_vector *Right_side = gsl_vector_alloc(N*m);
-    gsl_vector_view r_view = gsl_vector_subvector(f_cost->r,(f_cost->r->size-N),N);
-    gsl_blas_dgemv(CblasTrans, 0.5, &Ct_view.matrix, &r_view.vector, 0.0, Right_side);
-    gsl_vector_add(q, Right_side);
-
-    //Clean up!
-    gsl_matrix_free(R2_dot_Ct);
-    gsl_vector_free(A_N_dot_x);
-    gsl_vector_free(A_K_dot_K_hat);
-    gsl_vector_free(Right_side);
+    condense_cost_function(P, q, now->x, s_dyn, f_cost, time_horizon);
 
 
     /*GUROBI Convex Optimization: solve quadratic problem*/
@@ -192,6 +841,20 @@ polytope * set_cost_function(gsl_matrix *P,
     return opt_constraints;
 }
 
+/**
+ * GUROBI callback: stop the optimization once its cancel token is set
+ */
+static int __stdcall qp_cancel_callback(GRBmodel *model,
+                                        void *cbdata,
+                                        int where,
+                                        void *usrdata)
+{
+    if(cancel_token_is_cancelled((cancel_token *)usrdata)){
+        GRBterminate(model);
+    }
+    return 0;
+}
+
 /**
  * Set up GUROBI environment and solve qp
  */
@@ -201,11 +864,13 @@ void compute_optimal_control_qp(gsl_matrix *low_u,
                                 gsl_vector* q,
                                 polytope *opt_constraints,
                                 size_t time_horizon,
-                                size_t n){
+                                size_t n,
+                                GRBenv *env,
+                                cancel_token *cancel){
 
 
     //Initialization for qp in gurobi
-    GRBenv   *env   = NULL;
+    GRBenv   *own_env = NULL;
     GRBmodel *model = NULL;
     int       error = 0;
     double    sol[time_horizon];
@@ -213,12 +878,15 @@ void compute_optimal_control_qp(gsl_matrix *low_u,
     double    cost;
 
 
-    /* Create environment */
+    /* Create environment (only without one of the worker) */
 
-    error = GRBloadenv(&env, "qp.log");
-    if (error) goto QUIT;
-    error = GRBsetintparam(env, GRB_INT_PAR_OUTPUTFLAG, 0);
-    if (error) goto QUIT;
+    if (env == NULL){
+        error = GRBloadenv(&own_env, QP_LOG_FILE);
+        env = own_env;
+        if (error) goto QUIT;
+        error = GRBsetintparam(env, GRB_INT_PAR_OUTPUTFLAG, 0);
+        if (error) goto QUIT;
+    }
 
 
     /* Create an empty model */
@@ -246,20 +914,34 @@ void compute_optimal_control_qp(gsl_matrix *low_u,
 
     error = polytope_to_constraints_gurobi(opt_constraints,model,time_horizon);
     if (error) goto QUIT;
+
+    /* Stop early if the result is no longer needed */
+
+    if (cancel != NULL){
+        error = GRBsetcallbackfunc(model, qp_cancel_callback, cancel);
+        if (error) goto QUIT;
+    }
+
     /* Optimize model */
 
     error = GRBoptimize(model);
     if (error) goto QUIT;
 
-    /* Write model to 'qp.lp' */
+#ifdef CIMPLE_DEBUG_QP
+    /* Write model to 'qp.lp' (all computations write the same file: single plant only) */
 
     error = GRBwrite(model, "qp.lp");
     if (error) goto QUIT;
+#endif
 
     /* Capture solution information */
 
     error = GRBgetintattr(model, GRB_INT_ATTR_STATUS, &optimstatus);
     if (error) goto QUIT;
+    if (optimstatus == GRB_INTERRUPTED) {
+        TRACE_INFO(TRACE_QP, -1, optimstatus, INFINITY);
+        goto QUIT;
+    }
 
     error = GRBgetdblattr(model, GRB_DBL_ATTR_OBJVAL, &cost);
     if (error) goto QUIT;
@@ -267,20 +949,10 @@ void compute_optimal_control_qp(gsl_matrix *low_u,
     error = GRBgetdblattrarray(model, GRB_DBL_ATTR_X, 0, (int)time_horizon, sol);
     if (error) goto QUIT;
 
-    printf("\nOptimization complete\n");
+    //Optimal, infeasible/unbounded or stopped early: see the status
+    TRACE_INFO(TRACE_QP, -1, optimstatus, cost);
     if (optimstatus == GRB_OPTIMAL) {
-        printf("\nOptimal objective: %.4e\n", cost);
-
-        for(size_t i=0;i<time_horizon;i++){
-            printf("  u%d=%.4f", (int)i,sol[i]);
-
-        }
-        printf("\n");
-
-    } else if (optimstatus == GRB_INF_OR_UNBD) {
-        printf("\nModel is infeasible or unbounded\n");
-    } else {
-        printf("\nOptimization was stopped early\n");
+        TRACE_DEBUG_ARRAY(TRACE_QP_INPUTS, sol, time_horizon);
     }
 
     if(cost < *low_cost){
@@ -308,22 +980,79 @@ void compute_optimal_control_qp(gsl_matrix *low_u,
         exit(1);
     }
 
-    /* Free environment */
+    /* Free environment (the one of the worker is kept) */
 
-    GRBfreeenv(env);
+    if (own_env != NULL){
+        GRBfreeenv(own_env);
+    }
+}
+
+/**
+ * Unconstrained minimizer u = -0.5*P^(-1).q of u'.P.u + q'.u, only taken if it satisfies the constraints
+ * (it is then also the optimum of the constrained problem). Returns 1 if it was taken.
+ */
+static int unconstrained_optimal_control(gsl_matrix *low_u,
+                                         double *low_cost,
+                                         gsl_matrix *P_cholesky,
+                                         gsl_vector *q,
+                                         polytope *constraints,
+                                         size_t m,
+                                         qp_workspace *workspace){
+
+    gsl_vector_view u_view = gsl_vector_subvector(workspace->u, 0, q->size);
+    gsl_vector *u = &u_view.vector;
+    gsl_linalg_cholesky_solve(P_cholesky, q, u);
+    gsl_vector_scale(u, -0.5);
+
+    //Check L.u <= M (the slack only grows until it fits the largest number of path constraints)
+    if(workspace->slack->size < constraints->G->size){
+        gsl_vector_free(workspace->slack);
+        workspace->slack = gsl_vector_alloc(constraints->G->size);
+    }
+    gsl_vector_view slack_view = gsl_vector_subvector(workspace->slack, 0, constraints->G->size);
+    gsl_vector *slack = &slack_view.vector;
+    gsl_vector_memcpy(slack, constraints->G);
+    gsl_blas_dgemv(CblasNoTrans, -1.0, constraints->H, u, 1.0, slack);
+    int feasible = 1;
+    for(size_t i = 0; i < slack->size; i++){
+        if(gsl_vector_get(slack, i) < -1e-9){
+            feasible = 0;
+            break;
+        }
+    }
+
+    if(feasible){
+        //u'.P.u + q'.u = 0.5*q'.u at the minimizer
+        double cost;
+        gsl_blas_ddot(q, u, &cost);
+        cost *= 0.5;
+        if(cost < *low_cost){
+            for(size_t j = 0; j < low_u->size2; j++){
+                for(size_t i = 0; i < m; i++){
+                    gsl_matrix_set(low_u, i, j, gsl_vector_get(u, j*m+i));
+                }
+            }
+            *low_cost = cost;
+        }
+    }
+
+    return feasible;
 }
 
 /**
  * Calculate (optimal) input that will be applied to take plant from current state (now) to target_abs_state.
  */
-void get_input (gsl_matrix * low_u,
-                current_state * now,
-                discrete_dynamics * d_dyn,
-                system_dynamics * s_dyn,
-                int target_abs_state,
-                cost_function * f_cost,
-                size_t current_time_horizon,
-                polytope **polytope_list_backup) {
+double get_input (gsl_matrix * low_u,
+                  current_state * now,
+                  discrete_dynamics * d_dyn,
+                  system_dynamics * s_dyn,
+                  int target_abs_state,
+                  cost_function * f_cost,
+                  size_t current_time_horizon,
+                  polytope **polytope_list_backup,
+                  gsl_vector *r_target,
+                  qp_workspace *workspace,
+                  cancel_token *cancel) {
 
     //Set input back to zero (safety precaution)
     gsl_matrix_set_zero(low_u);
@@ -336,30 +1065,35 @@ void get_input (gsl_matrix * low_u,
     double low_cost = INFINITY;
     double err_weight = f_cost->distance_error_weight;
 
-    //Set start region (depends on conservative path or not)
-    polytope *P1;
-
-    int start = now->current_abs_state;
-
-    if (d_dyn->conservative == 1){
-        // Take convex hull or polytope as starting polytope P1
-
-        // if convex_hull != NULL => hull was computed => several polytopes in that region
-        if (d_dyn->abstract_states_set[start]->convex_hull->H != NULL){
-            P1 = d_dyn->abstract_states_set[start]->convex_hull;
-        } else{
-            P1 = d_dyn->abstract_states_set[start]->cells[0]->polytope_description;
+    //Cost function of a target cell: the shared one with its own r (f_cost itself is never written)
+    cost_function target_cost = *f_cost;
+    gsl_vector *r_own = NULL;
+    if (err_weight > 0){
+        if (r_target == NULL){
+            r_own = gsl_vector_alloc(f_cost->r->size);
+            r_target = r_own;
         }
-    } else{
-        // Take original proposition preserving abstract state as constraint
-        // must be single polytope (ensuring convex)
+        target_cost.r = r_target;
+    }
 
-        if (d_dyn->original_regions[start]->cells_count == 1){
-            P1 = d_dyn->original_regions[start]->cells[0]->polytope_description;
-        } else {
-            fprintf(stderr, "\nIn Region of polytopes(%d): `conservative = False` arg requires that original abstract_states_set be convex\n", now->current_abs_state);
+    //Memory of the solves (a worker passes its own)
+    qp_workspace *own_workspace = NULL;
+    if (workspace == NULL){
+        own_workspace = qp_workspace_alloc(s_dyn->B->size2, N);
+        if (own_workspace == NULL){
+            fprintf(stderr, "\nget_input: could not allocate the memory of the qp\n");
             exit(EXIT_FAILURE);
         }
+        workspace = own_workspace;
+    }
+
+    //Set start region (depends on conservative path or not)
+    int start = now->current_abs_state;
+    polytope *P1 = start_polytope(d_dyn, start);
+
+    if (P1 == NULL){
+        fprintf(stderr, "\nIn Region of polytopes(%d): `conservative = False` arg requires that original abstract_states_set be convex\n", now->current_abs_state);
+        exit(EXIT_FAILURE);
     }
 
 
@@ -368,39 +1102,47 @@ void get_input (gsl_matrix * low_u,
 
     // for each polytope in target region
     for (int i = 0; i < d_dyn->abstract_states_set[target_abs_state]->cells_count; i++){
+        if (cancel_token_is_cancelled(cancel)){
+            break;
+        }
         polytope *P3 = d_dyn->abstract_states_set[target_abs_state]->cells[i]->polytope_description;
 
+        //Path constraints of this horizon if precomputed at start-up
+        path_constraints *precomputed = horizon_family_constraints(s_dyn->horizon_family, start, target_abs_state, i, N);
+
         //Finding a path to target region
         if (err_weight > 0){
             //Set r (=xc.R)(from default to polytope specific):
             double *xc = P3->chebyshev_center;
 
-            //r[n*(N-1), n*N] += err_weight * xc;
-            for (size_t j = n * (N - 1); j < n*N; j++){
-                double * element_value = gsl_vector_ptr(f_cost->r, j);
-                * element_value += err_weight * xc[i];
-                gsl_vector_set(f_cost->r, j, *element_value);
+            //r of x(N) += err_weight * xc (x(N) is the last block of r for every horizon, see condense_cost_function())
+            gsl_vector_memcpy(r_target, f_cost->r);
+            for (size_t j = 0; j < n; j++){
+                double * element_value = gsl_vector_ptr(r_target, r_target->size - n + j);
+                * element_value += err_weight * xc[j];
             }
 
-            search_better_path(low_u, now,s_dyn, P1, P3,d_dyn->ord, N, f_cost, &low_cost, polytope_list_backup, d_dyn->time_horizon);
-            //Reset r vector to default values
-            for (size_t j = n * (N - 1); j < n*N; j++){
-                double * element_value = gsl_vector_ptr(f_cost->r, j);
-                * element_value -= err_weight * xc[i];
-                gsl_vector_set(f_cost->r, j, * element_value);
-            }
+            search_better_path(low_u, now,s_dyn, P1, P3,d_dyn->ord, N, &target_cost, &low_cost, polytope_list_backup, d_dyn->time_horizon, precomputed, workspace, cancel);
 
         } else{
-            search_better_path(low_u, now,s_dyn, P1, P3,d_dyn->ord, N, f_cost, &low_cost, polytope_list_backup, d_dyn->time_horizon);
+            search_better_path(low_u, now,s_dyn, P1, P3,d_dyn->ord, N, f_cost, &low_cost, polytope_list_backup, d_dyn->time_horizon, precomputed, workspace, cancel);
         }
     }
 
-    if (low_cost == INFINITY){
-        //raise Exception
+    //Clean up!
+    if (r_own != NULL){
+        gsl_vector_free(r_own);
+    }
+    if (own_workspace != NULL){
+        qp_workspace_free(own_workspace);
+    }
+
+    if (low_cost == INFINITY && !cancel_token_is_cancelled(cancel)){
+        //Reported to the caller (e.g. published as MAILBOX_FAILED), the control loop falls back to safe mode
         fprintf(stderr, "\nget_input: Did not find any trajectory\n");
-        exit(EXIT_FAILURE);
     }
 
+    return low_cost;
 };
 
 
@@ -417,7 +1159,10 @@ void search_better_path(gsl_matrix *low_u,
                         cost_function * f_cost,
                         double *low_cost,
                         polytope **polytope_list_backup,
-                        size_t total_time){
+                        size_t total_time,
+                        path_constraints *precomputed,
+                        qp_workspace *workspace,
+                        cancel_token *cancel){
 
     //Auxiliary variables
     size_t N = time_horizon;
@@ -426,60 +1171,71 @@ void search_better_path(gsl_matrix *low_u,
 
 
     //Build list of polytopes that the state is going to be in in the next N time steps
-    polytope **polytope_list = malloc(sizeof(polytope)*(N+1));
-    polytope_list[0] = polytope_alloc(P1->H->size1,P1->H->size2);
-    gsl_matrix_memcpy(polytope_list[0]->H, P1->H);
-    gsl_vector_memcpy(polytope_list[0]->G, P1->G);
-
-    for (int i = 1; i < N; i++) {
-        polytope_list[i] = polytope_alloc(P1->H->size1,P1->H->size2);
-        gsl_matrix_memcpy(polytope_list[i]->H, P1->H);
-        gsl_vector_memcpy(polytope_list[i]->G, P1->G);
+    //x(0)...x(N-1) share P1 and x(N) is in P3, thus at most two distinct polytopes are referenced
+    horizon_polytopes *horizon = horizon_polytopes_alloc(N, (P1 == P3) ? 1 : 2);
+    horizon->polytopes[0] = P1;
+    horizon->polytopes[horizon->distinct_count-1] = P3;
+    for (size_t i = 0; i < N; i++) {
+        horizon->stage_index[i] = 0;
     }
-    polytope_list[N] = polytope_alloc(P3->H->size1, P3->H->size2);
-    gsl_matrix_memcpy(polytope_list[N]->H, P3->H);
-    gsl_vector_memcpy(polytope_list[N]->G, P3->G);
+    horizon->stage_index[N] = horizon->distinct_count-1;
 
-    size_t sum_polytope_sizes = 0;
-    for(int i = 0; i<N+1; i++){
-        sum_polytope_sizes += polytope_list[i]->H->size1;
+    polytope *constraints;
+    if(precomputed != NULL){
+        constraints = path_constraints_evaluate(precomputed, now->x);
+    } else{
+        constraints = set_path_constraints(now, s_dyn, horizon, N);
     }
 
-    polytope *constraints = set_path_constraints(now, s_dyn, polytope_list, N);
+    double previous_cost = *low_cost;
 
-    //Updating backup list of polytopes
-    //If polytope list doesn't have to be initialized completely, old ones have first to be destroyed:
-    if(N< total_time) {
-        for (size_t i = total_time; i > total_time - N - 1; i--) {
-            polytope_free(polytope_list_backup[i]);
+    if (ord == 2){
+        //Weights of this horizon in the leading block of the workspace
+        gsl_matrix_view P_view = gsl_matrix_submatrix(workspace->P, 0, 0, N*m, N*m);
+        gsl_vector_view q_view = gsl_vector_subvector(workspace->q, 0, N*m);
+        gsl_vector *q = &q_view.vector;
+
+        horizon_cost *cost = horizon_family_cost(s_dyn->horizon_family, N);
+        if(cost != NULL){
+            //Weights precomputed at start-up (P is only read): only q depends on the current state
+            horizon_cost_linear_term(q, cost, now->x, s_dyn, f_cost, N);
+
+            //Unconstrained optimum is the solution if it satisfies the constraints (no qp has to be solved)
+            if(cost->P_cholesky == NULL
+               || !unconstrained_optimal_control(low_u, low_cost, cost->P_cholesky, q, constraints, m, workspace)){
+                polytope *opt_constraints = polytope_minimize(constraints);
+                compute_optimal_control_qp(low_u, low_cost, cost->P, q, opt_constraints, N, n, workspace->env, cancel);
+                polytope_free(opt_constraints);
+            }
+        } else{
+            gsl_matrix *P = &P_view.matrix;
+            polytope *opt_constraints = set_cost_function(P, q, constraints->H, constraints->G, now, s_dyn, f_cost, N);
+            compute_optimal_control_qp(low_u, low_cost, P, q, opt_constraints, N, n, workspace->env, cancel);
+            polytope_free(opt_constraints);
         }
-    }
-    //List is updated (or created, if total_time == N)
-    for(size_t i = total_time-N; i< total_time+1; i++){
-        size_t k =i-(total_time-N);
-        polytope_list_backup[i] = polytope_alloc(polytope_list[k]->H->size1,polytope_list[k]->H->size2);
-        gsl_matrix_memcpy(polytope_list_backup[i]->H,polytope_list[k]->H);
-        gsl_vector_memcpy(polytope_list_backup[i]->G,polytope_list[k]->G);
-    }
 
-    for(int i = 0; i< N+1; i++){
-        polytope_free(polytope_list[i]);
     }
-    free(polytope_list);
-
-
-    if (ord == 2){
-        gsl_matrix * P = gsl_matrix_alloc(N*m, N*m);
-        gsl_vector * q = gsl_vector_alloc(N*m);
-
-        polytope *opt_constraints = set_cost_function(P, q, constraints->H, constraints->G, now, s_dyn, f_cost, N);
-        compute_optimal_control_qp(low_u, low_cost, P, q, opt_constraints, N, n);
-        polytope_free(opt_constraints);
-        gsl_vector_free(q);
-        gsl_matrix_free(P);
+    polytope_free(constraints);
 
+    //Updating backup list of polytopes: only if this cell gave the plan stored in low_u (its x(N) has to be in P3)
+    if(*low_cost < previous_cost){
+        //List is updated in place (an entry is only reallocated if it was never filled or its size changed)
+        for(size_t i = total_time-N; i< total_time+1; i++){
+            polytope *stage = horizon_polytopes_stage(horizon, i-(total_time-N));
+            if(polytope_list_backup[i] != NULL && (polytope_list_backup[i]->H->size1 != stage->H->size1
+                                                   || polytope_list_backup[i]->H->size2 != stage->H->size2)){
+                polytope_free(polytope_list_backup[i]);
+                polytope_list_backup[i] = NULL;
+            }
+            if(polytope_list_backup[i] == NULL){
+                polytope_list_backup[i] = polytope_alloc(stage->H->size1,stage->H->size2);
+            }
+            gsl_matrix_memcpy(polytope_list_backup[i]->H,stage->H);
+            gsl_vector_memcpy(polytope_list_backup[i]->G,stage->G);
+        }
     }
-    polytope_free(constraints);
+
+    horizon_polytopes_free(horizon);
 };
 
 
@@ -488,109 +1244,22 @@ void search_better_path(gsl_matrix *low_u,
  */
 polytope * set_path_constraints(current_state * now,
                                 system_dynamics * s_dyn,
-                                polytope **list_polytopes,
+                                horizon_polytopes *horizon,
                                 size_t N){
     //Disturbance assumed at every step and full dimension of s_dyn.Wset
 
-    // Help variables
-    size_t n = s_dyn->A->size2;  // State space dimension
-    size_t m = s_dyn->B->size2;
-    size_t sum_polytope_dim = 0; // Sum of dimension n of all polytopes in the list
-    polytope *scaled_W_set = polytope_linear_transform(s_dyn->W_set, s_dyn->E); // multiplication: EW
-
-
-    polytope **robust_polytope_list = malloc(sizeof(polytope)*(N+1));
-    for(size_t i = 0; i < N+1; i++){
-        //Subtract EW of polytope to make them robust against disturbances
-        robust_polytope_list[i] = polytope_pontryagin(list_polytopes[i], scaled_W_set);
-        sum_polytope_dim += robust_polytope_list[i]->H->size1;
-
-    }
-
-    /* INITIALIZE MATRICES: Lk, Mk, constraints*/
-    polytope *constraints = polytope_alloc(sum_polytope_dim, n*(N+1));
-    gsl_matrix_set_zero(constraints->H);
-    gsl_vector_set_zero(constraints->G);
-    /*
-     *     |G_0|
-     *     |G_1|
-     *Mk = |G_2| dim[sum_polytope_dim x 1]
-     *     |G_3|
-     *     |G_4|
-     *
-     *   with M = |Mk|
-     *            |Mu|
-     * */
-
-    /*
-     *                 |H_0 0  0  0  0 |
-     *                 |0 H_1  0  0  0 |
-     * constaints->H=  |0  0  H_2 0  0 | dim[sum_polytope_dim x n*N]
-     *                 |0  0   0 H_3 0 |
-     *                 |0  0   0  0 H_4|
-     * */
-
-    //Loop over N and polytopes in parallel
-    size_t polytope_count = 0;
-    for(int i = 0; i<N+1; i++){
-
-        //Set diagonal block N of constaints->H
-        for(size_t j = 0; j<n; j++){
+    polytope **robust_distinct = robust_horizon_polytopes(s_dyn, horizon);
+    path_constraints *constraints = assemble_path_constraints(s_dyn, horizon, robust_distinct, N);
 
-            for(size_t k = 0; k<robust_polytope_list[i]->H->size1; k++){
-                gsl_matrix_set(constraints->H,polytope_count+k, j+(i*n), gsl_matrix_get(robust_polytope_list[i]->H,k,j));
-            }
-        }
-
-        // Build constraints->g
-        for(size_t j = 0; j<robust_polytope_list[i]->G->size; j++){
-            // Set entries Mk[j+polytope_count] = G_i[j]
-            gsl_vector_set(constraints->G,j+polytope_count,gsl_vector_get(robust_polytope_list[i]->G,j));
-        }
-
-        polytope_count += robust_polytope_list[i]->H->size1;
+    polytope *return_constraints = path_constraints_evaluate(constraints, now->x);
 
-    }
-    /*Update L and M*/
-
-    // Lk = H_constaints->Hdiag.L_default
-    gsl_matrix_view L_default_view = gsl_matrix_submatrix(s_dyn->aux_matrices->L_default,0,0,n*(N+1),(m*N)+n);
-    gsl_matrix *L_full = gsl_matrix_alloc(sum_polytope_dim, (m*N)+n);
-    gsl_vector *M_full = gsl_vector_alloc(sum_polytope_dim);
-    gsl_blas_dgemm(CblasNoTrans,CblasNoTrans,1.0, constraints->H, &L_default_view.matrix ,0.0,L_full);
-
-    //Update M such that it includes the uncertainty of noise
-    gsl_vector_memcpy(M_full, constraints->G);
-
-
-
-    // Remove first constraints on x(0) they are obviously already satisfied
-    // L_x = L[{(polytope[0]+1),(dim_n(L))},{1,n}]
-    gsl_matrix_view L_x = gsl_matrix_submatrix(L_full, robust_polytope_list[0]->H->size1, 0, (L_full->size1)-(robust_polytope_list[0]->H->size1), n);
-    // L_u = L[{(polytope[0]+1),(dim_n(L))},{(n+1),(dim_m(L))}]
-    gsl_matrix_view L_u = gsl_matrix_submatrix(L_full, robust_polytope_list[0]->H->size1, n, (L_full->size1)-(robust_polytope_list[0]->H->size1), L_full->size2 - n);
-    // M_view = M[{(polytope[0]+1),(dim_n(M))}]
-    gsl_vector_view M_view = gsl_vector_subvector(M_full, robust_polytope_list[0]->H->size1, M_full->size-robust_polytope_list[0]->H->size1);
-
-    //M = M-(L_x.x)
-    gsl_vector * L_x_dot_X0 = gsl_vector_alloc((L_full->size1)-(robust_polytope_list[0]->H->size1));
-    gsl_blas_dgemv(CblasNoTrans, 1.0, &L_x.matrix, now->x, 0.0, L_x_dot_X0);
-    gsl_vector_sub(&M_view.vector, L_x_dot_X0);
-
-    polytope * return_constraints = polytope_alloc(constraints->H->size1-robust_polytope_list[0]->H->size1, ((constraints->H->size2)-(robust_polytope_list[0]->H->size2)));
-
-    gsl_matrix_memcpy(return_constraints->H, &L_u.matrix);
-    gsl_vector_memcpy(return_constraints->G, &M_view.vector);
     //Clean up!
-    polytope_free(scaled_W_set);
-    polytope_free(constraints);
-    for(size_t i = 0; i < N+1; i++){
-        polytope_free(robust_polytope_list[i]);
+    path_constraints_free(constraints);
+    for(size_t d = 0; d < horizon->distinct_count; d++){
+        polytope_free(robust_distinct[d]);
     }
-    free(robust_polytope_list);
-    gsl_vector_free(L_x_dot_X0);
+    free(robust_distinct);
 
     return return_constraints;
 
 };
-
@@ -11,6 +11,282 @@
 #include <gsl/gsl_matrix.h>
 #include <gsl/gsl_blas.h>
 #include "cimple_polytope_library.h"
+#include "cimple_mailbox.h"
+
+/**
+ * Polytopes the state has to be in during the next N time steps:
+ *
+ *      x(i) in polytopes[stage_index[i]] for i = 0,...,N
+ *
+ * Most stages share the same polytope (e.g. x(0)...x(N-1) in P1), thus every distinct polytope is
+ * referenced only once and each stage only stores the index of its polytope.
+ * The referenced polytopes are neither copied nor freed by the list.
+ */
+typedef struct horizon_polytopes{
+
+    size_t N;
+    size_t distinct_count;
+    polytope **polytopes;
+    size_t *stage_index;
+
+}horizon_polytopes;
+
+/**
+ * @brief "Constructor" Dynamically allocates the space for the polytope references of N+1 stages
+ * @param N time horizon
+ * @param distinct_count number of distinct polytopes referenced by the stages
+ * @return
+ */
+struct horizon_polytopes *horizon_polytopes_alloc(size_t N,
+                                                  size_t distinct_count);
+
+/**
+ * @brief "Destructor" Deallocates the list, the referenced polytopes are not freed
+ * @param horizon
+ */
+void horizon_polytopes_free(horizon_polytopes *horizon);
+
+/**
+ * @brief Polytope stage i of the horizon has to be in
+ * @param horizon
+ * @param i stage in {0,...,N}
+ * @return
+ */
+polytope *horizon_polytopes_stage(horizon_polytopes *horizon,
+                                  size_t i);
+
+/**
+ * Path constraints of a horizon split into the part on the inputs and the part on the current state:
+ *
+ *      L_u.[u(0)' ... u(N-1)']' <= G - L_x.x(0)
+ *
+ * Neither L_u, L_x nor G depend on x(0), thus they can be computed once per (start, target) pair and horizon.
+ */
+typedef struct path_constraints{
+
+    gsl_matrix *L_u;
+    gsl_matrix *L_x;
+    gsl_vector *G;
+
+}path_constraints;
+
+/**
+ * @brief "Constructor" Dynamically allocates the space for k path constraints
+ * @param k number of constraints
+ * @param n state space dimension
+ * @param m input space dimension
+ * @param N time horizon
+ * @return
+ */
+struct path_constraints *path_constraints_alloc(size_t k,
+                                                size_t n,
+                                                size_t m,
+                                                size_t N);
+
+/**
+ * @brief "Destructor" Deallocates the dynamically allocated memory of the path constraints
+ * @param constraints
+ */
+void path_constraints_free(path_constraints *constraints);
+
+/**
+ * @brief Polytope in u of the path constraints for the current state: L_u.u <= G - L_x.x
+ * @param constraints
+ * @param x current state x(0)
+ * @return
+ */
+polytope *path_constraints_evaluate(path_constraints *constraints,
+                                    gsl_vector *x);
+
+/**
+ * Weights of the quadratic problem of one horizon h, split like the path constraints into a constant and a state
+ * (and cost vector r) dependent part:
+ *
+ *      P = Q'.Q + Ct'.R'.R.Ct
+ *      q = F_x.x + f + 0.5*Ct'.r
+ *
+ * with F_x = Ct'.R'.R.A_N and f = Ct'.R'.R.A_K.K_hat.
+ * P_cholesky is the Cholesky factorisation of P (NULL if P is not positive definite).
+ */
+typedef struct horizon_cost{
+
+    gsl_matrix *P;
+    gsl_matrix *P_cholesky;
+    gsl_matrix *F_x;
+    gsl_vector *f;
+
+}horizon_cost;
+
+/**
+ * @brief Compute the weights of the quadratic problem of horizon h
+ * @param s_dyn system dynamics (including auxiliary matrices)
+ * @param f_cost cost function (trailing blocks of R, Q and r are used)
+ * @param h horizon in {1,...,N}
+ * @return
+ */
+struct horizon_cost *horizon_cost_compute(system_dynamics *s_dyn,
+                                          cost_function *f_cost,
+                                          size_t h);
+
+/**
+ * @brief "Destructor" Deallocates the dynamically allocated memory of the weights of one horizon
+ * @param cost
+ */
+void horizon_cost_free(horizon_cost *cost);
+
+/**
+ * @brief Linear weight q = F_x.x + f + 0.5*Ct'.r of the quadratic problem for the current state and cost vector r
+ * @param q empty vector dim[h*m] when passed in
+ * @param cost weights of horizon h
+ * @param x current state x(0)
+ * @param s_dyn system dynamics (including auxiliary matrices)
+ * @param f_cost cost function (r may differ from the one the weights were computed with)
+ * @param h horizon
+ */
+void horizon_cost_linear_term(gsl_vector *q,
+                              horizon_cost *cost,
+                              gsl_vector *x,
+                              system_dynamics *s_dyn,
+                              cost_function *f_cost,
+                              size_t h);
+
+/**
+ * Set-up of the control problem for every horizon h = 1,...,N:
+ *
+ *      cost[h-1]: weights (and factorisation) of the quadratic problem of horizon h
+ *      constraints[start*abstract_states_count+target][cell*N+h-1]: path constraints of horizon h from abstract state
+ *      start into cell of abstract state target (NULL if the pair (start, target) was not precomputed)
+ *
+ * Precomputed pairs are all transitions of the discrete abstraction (and staying in the same abstract state).
+ * ACT() solves with horizon N, N-1, ..., 1, thus every step only indexes into the family.
+ */
+typedef struct horizon_family{
+
+    size_t N;
+    int abstract_states_count;
+    int *cells_count;
+    horizon_cost **cost;
+    path_constraints ***constraints;
+
+}horizon_family;
+
+/**
+ * @brief Precompute the set-up of the control problem for every horizon 1,...,N and every reachable (start, target) pair
+ *
+ * Only valid as long as the system dynamics, R and Q of the cost function and the abstraction are not changed.
+ *
+ * @param d_dyn discrete abstraction of the system
+ * @param s_dyn system dynamics (including auxiliary matrices)
+ * @param f_cost cost function
+ * @return
+ */
+struct horizon_family *horizon_family_compute(discrete_dynamics *d_dyn,
+                                              system_dynamics *s_dyn,
+                                              cost_function *f_cost);
+
+/**
+ * @brief "Destructor" Deallocates the dynamically allocated memory of the horizon family
+ * @param family
+ */
+void horizon_family_free(horizon_family *family);
+
+/**
+ * @brief Precomputed path constraints from abstract state start into cell of abstract state target for horizon h
+ * @param family (may be NULL)
+ * @param start
+ * @param target
+ * @param cell
+ * @param h
+ * @return NULL if not precomputed
+ */
+path_constraints *horizon_family_constraints(horizon_family *family,
+                                             int start,
+                                             int target,
+                                             int cell,
+                                             size_t h);
+
+/**
+ * @brief Precomputed weights of the quadratic problem for horizon h
+ * @param family (may be NULL)
+ * @param h
+ * @return NULL if not precomputed
+ */
+horizon_cost *horizon_family_cost(horizon_family *family,
+                                  size_t h);
+
+/**
+ * Memory of the main computation, allocated once per worker from the sizes of the system (m, N):
+ *
+ * P, q: weights of the qp of the full horizon (the leading h*m block is used for horizon h, precomputed weights are
+ *       used in place)
+ * u: unconstrained minimizer
+ * slack: M - L.u of the unconstrained minimizer (grown to the largest number of path constraints seen)
+ * env: GUROBI environment of the worker (loaded once, every qp only creates its model)
+ *
+ * Not covered: cdd (path constraints, redundancy removal) and the GUROBI models still allocate internally, thus only
+ * the actuation of a time step is allocation free (see ALLOC_COUNTER_ASSERT_NONE()).
+ */
+typedef struct qp_workspace{
+
+    size_t m;
+    size_t N;
+
+    gsl_matrix *P;
+    gsl_vector *q;
+    gsl_vector *u;
+    gsl_vector *slack;
+    GRBenv *env;
+
+}qp_workspace;
+
+/**
+ * @brief "Constructor" Dynamically allocates the memory of the main computation and loads its GUROBI environment
+ * @param m input space dimension
+ * @param N time horizon
+ * @return NULL if the memory could not be allocated or the environment not be loaded
+ */
+struct qp_workspace *qp_workspace_alloc(size_t m,
+                                        size_t N);
+
+/**
+ * @brief "Destructor" Deallocates the memory of the main computation and frees its GUROBI environment
+ * @param workspace
+ */
+void qp_workspace_free(qp_workspace *workspace);
+
+/**
+ * @brief Condense the cost function over the next N time steps into the weights of the quadratic problem in u
+ *
+ *      min u'.P.u + q'.u
+ *
+ * with
+ *
+ *      P = Q'.Q + Ct'.R'.R.Ct
+ *      q = {([x^T.A_N^T + (A_K.K_hat)^T].[R'.R.Ct])+(0.5*r^T.Ct)}^T
+ *
+ *           |B         0    ...  0|
+ *      Ct = |AB        B    ...  0|  (lower block-Toeplitz matrix of the Markov parameters A^kB)
+ *           |...                  |
+ *           |A^(N-1)B  ...  AB   B|
+ *
+ * The dense Ct, A_N, A_K are never formed: the free response x_bar = A_N.x + A_K.K_hat is computed in one forward pass
+ * and, for stage-wise weights (R and Q block diagonal), P and q are computed by a backward recursion over the stages
+ * directly from A, B, R and Q in O(N^2.n.m) (instead of O(N^3.n^2.m)).
+ * Weights coupling different time steps fall back to dense products with a Ct built from the Markov parameters.
+ *
+ * @param P empty matrix dim[N*m x N*m] when passed in, quadratic weight at the end
+ * @param q empty vector dim[N*m] when passed in, linear weight at the end
+ * @param x current state x(0)
+ * @param s_dyn system dynamics
+ * @param f_cost cost function (trailing blocks of R, Q and r are used if N is smaller than the full time horizon)
+ * @param N current time horizon
+ */
+void condense_cost_function(gsl_matrix *P,
+                            gsl_vector *q,
+                            gsl_vector *x,
+                            system_dynamics *s_dyn,
+                            cost_function *f_cost,
+                            size_t N);
 
 /**
  * @brief Set up weight matrices for the quadratic problem
@@ -42,6 +318,9 @@ polytope *set_cost_function(gsl_matrix *P,
  * @param opt_constraints
  * @param time_horizon
  * @param n
+ * @param env GUROBI environment of the calling worker (NULL: a temporary one is loaded for this qp)
+ * @param cancel checked periodically during the optimization (NULL: never cancelled), a cancelled qp leaves low_u
+ * and low_cost untouched
  */
 void compute_optimal_control_qp(gsl_matrix *low_u,
                                 double *low_cost,
@@ -49,7 +328,9 @@ void compute_optimal_control_qp(gsl_matrix *low_u,
                                 gsl_vector* q,
                                 polytope *opt_constraints,
                                 size_t time_horizon,
-                                size_t n);
+                                size_t n,
+                                GRBenv *env,
+                                cancel_token *cancel);
 
 /**
  * @brief Calculate (optimal) input that will be applied to take plant from current state (now) to target_abs_state.
@@ -95,15 +376,24 @@ void compute_optimal_control_qp(gsl_matrix *low_u,
  * @param s_dyn system dynamics (including auxiliary matrices)
  * @param target_abs_state index of target region in discrete dynamics (d_dyn)
  * @param f_cost cost func matrices: f(x, u) = |Rx|_{ord} + |Qu|_{ord} + r'x + distance_error_weight *|xc - x(N)|_{ord}
+ *        (read only: d_dyn, s_dyn and f_cost can be shared by computations of several plants running concurrently)
+ * @param r_target memory of the caller for the cost vector r of a target cell, size of f_cost->r
+ *        (NULL: allocated if distance_error_weight > 0)
+ * @param workspace memory of the calling worker (NULL: a temporary one is allocated for this call)
+ * @param cancel checked between the cells of the target region and during every qp (NULL: never cancelled)
+ * @return cost of the input, INFINITY if no trajectory was found (or the computation was cancelled before)
  */
-void get_input (gsl_matrix *u,
-                current_state * now,
-                discrete_dynamics *d_dyn,
-                system_dynamics *s_dyn,
-                int target_abs_state,
-                cost_function * f_cost,
-                size_t current_time_horizon,
-                polytope **polytope_list_backup);
+double get_input (gsl_matrix *u,
+                  current_state * now,
+                  discrete_dynamics *d_dyn,
+                  system_dynamics *s_dyn,
+                  int target_abs_state,
+                  cost_function * f_cost,
+                  size_t current_time_horizon,
+                  polytope **polytope_list_backup,
+                  gsl_vector *r_target,
+                  qp_workspace *workspace,
+                  cancel_token *cancel);
 
 
 /**
@@ -128,6 +418,11 @@ void get_input (gsl_matrix *u,
  * @param time_horizon
  * @param f_cost predefined cost functions |Rx|_{ord} + |Qu|_{ord} + r'x + mid_weight * |xc - x(N)|_{ord}
  * @param low_cost cost associate to low_u
+ * @param polytope_list_backup polytopes x(total_time-N),...,x(total_time) have to be in (replaced only if this cell
+ * lowers low_cost, thus they always belong to the plan in low_u; NULL entries were never filled)
+ * @param precomputed path constraints of this horizon from the horizon family (NULL to compute them on the fly)
+ * @param workspace memory of the main computation (see qp_workspace)
+ * @param cancel see compute_optimal_control_qp()
  */
 void search_better_path(gsl_matrix *low_u,
                         current_state *now,
@@ -139,15 +434,18 @@ void search_better_path(gsl_matrix *low_u,
                         cost_function * f_cost,
                         double* low_cost,
                         polytope **polytope_list_backup,
-                        size_t total_time);
+                        size_t total_time,
+                        path_constraints *precomputed,
+                        qp_workspace *workspace,
+                        cancel_token *cancel);
 
 /**
  * @brief Compute a polytope that constraints the system over the next N time steps to fullfill the GR(1) specifications
  *
- * @param L_full empty matrix when passed in, left side of constraint polytope at the end
- * @param M_full empty vector when passed in, right side of constraint polytope at the end
+ * @param now current state
  * @param s_dyn system dynamics (including auxiliary matrices)
- * @param list_polytopes list of N+1 polytopes in which the systems needs to be in to reach new desired state at time N
+ * @param horizon N+1 stages of polytopes in which the systems needs to be in to reach new desired state at time N
+ *        (every distinct polytope is made robust against the disturbance only once)
  * @param N time horizon
  *
  * Compute the components of the polytope:
@@ -164,7 +462,7 @@ void search_better_path(gsl_matrix *low_u,
  */
 polytope * set_path_constraints(current_state * now,
                                 system_dynamics * s_dyn,
-                                polytope **list_polytopes,
+                                horizon_polytopes *horizon,
                                 size_t N);
 
 
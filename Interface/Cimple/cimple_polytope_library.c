@@ -52,28 +52,50 @@ struct cell *cell_alloc(size_t k,
 {
 
     struct cell *return_cell = malloc (sizeof (struct cell));
-
-    return_cell->safe_mode = malloc(sizeof(polytope)*time_horizon);
-    if (return_cell->safe_mode == NULL) {
-        free (return_cell);
+    if (return_cell == NULL) {
         return NULL;
     }
 
+    //The safe mode path is set (N+1 polytopes owned by the cell) when safe mode is computed
+    return_cell->safe_mode = NULL;
+    return_cell->time_horizon = time_horizon;
+
     return_cell->polytope_description = polytope_alloc(k,n);
     if (return_cell->polytope_description == NULL) {
         free (return_cell);
         return NULL;
     }
+    return_cell->invariant_set = NULL;
     return return_cell;
 };
 
+/**
+ * Deallocates the safe mode path of the cell (safe_mode[0],...,safe_mode[N]) if it is set
+ */
+void cell_clear_safe_mode(cell *cell)
+{
+    if(cell->safe_mode == NULL){
+        return;
+    }
+    for(int j = 0; j <= cell->time_horizon; j++){
+        if(cell->safe_mode[j] != NULL){
+            polytope_free(cell->safe_mode[j]);
+        }
+    }
+    free(cell->safe_mode);
+    cell->safe_mode = NULL;
+};
+
 /**
  * "Destructor" Deallocates the dynamically allocated memory of the region of polytopes
  */
 void cell_free(cell *cell)
 {
     polytope_free(cell->polytope_description);
-    free(cell->safe_mode);
+    if(cell->invariant_set != NULL){
+        polytope_free(cell->invariant_set);
+    }
+    cell_clear_safe_mode(cell);
     free(cell);
 
 };
@@ -96,11 +118,12 @@ struct abstract_state *abstract_state_alloc(size_t *k,
      * Default values: at initialization safe mode is not yet computed.
      * Thus it is assumed that the state does not contain an invariant set => invariant_set = NULL
      * next_state (next state the system has to transition to reach an invariant set) is unknown at initialization.
+     * distance_invariant_set = -1 until the state is reached by the burning method.
      */
 
     return_abstract_state->next_state = NULL;
     return_abstract_state->invariant_set = NULL;
-//    return_abstract_state->distance_invariant_set = INFINITY;
+    return_abstract_state->distance_invariant_set = -1;
 
     return_abstract_state->cells = malloc(sizeof(cell)*cells_count);
     if (return_abstract_state->cells == NULL) {
@@ -244,49 +267,238 @@ polytope * polytope_scaled_unit_cube(double scale,
 bool polytope_check_state(polytope *polytope,
                          gsl_vector *x)
 {
-    gsl_vector * result = gsl_vector_alloc(polytope->G->size);
-    gsl_blas_dgemv(CblasNoTrans, 1.0, polytope->H, x, 0.0, result);
+    //Row by row: no temporary vector (called every time step of the control loop)
     for(size_t i = 0; i< polytope->G->size; i++){
-        if(gsl_vector_get(result, i) > gsl_vector_get(polytope->G, i)){
-            gsl_vector_free(result);
+        gsl_vector_const_view row = gsl_matrix_const_row(polytope->H, i);
+        double value;
+        gsl_blas_ddot(&row.vector, x, &value);
+        if(value > gsl_vector_get(polytope->G, i)){
             return false;
         }
     }
-    gsl_vector_free(result);
     return true;
 };
 
 /**
- * Checks whether polytope P1 \ issubset P2
+ * Largest violation max_i (H2_i.v - G2_i) of P2 over the vertices v of P1 (cdd vertex enumeration)
+ * Returns false if P1 has rays (unbounded), the result is then not valid.
  */
-bool polytope_is_subset(polytope *P1,
-                        polytope *P2)
+static bool subset_violation_vertices(polytope *P1,
+                                      polytope *P2,
+                                      bool stop_at_violation,
+                                      double *max_violation)
 {
     dd_ErrorType err = dd_NoError;
     dd_PolyhedraPtr first = polytope_to_cdd(P1, &err);
     dd_MatrixPtr verticesFirst = dd_CopyGenerators(first);
     gsl_vector *vertex = gsl_vector_alloc(P1->H->size2);
+    gsl_vector *result = gsl_vector_alloc(P2->G->size);
     gsl_vector_set_zero(vertex);
-    int is_included;
-    bool is_subset = true;
+    bool bounded = true;
+    *max_violation = -INFINITY;
     for(int i = 0; i<verticesFirst->rowsize;i++){
         double valueFirst0 = dd_get_d(verticesFirst->matrix[i][0]);
-        if(valueFirst0 == 1){
-            for(int j = 0; j<vertex->size; j++){
-                double valueFirstj = dd_get_d(verticesFirst->matrix[i][j+1]);
-                gsl_vector_set(vertex,(size_t)j, valueFirstj);
-            }
-            is_included = polytope_check_state(P2,vertex);
-            if(!is_included){
-                is_subset = false;
-                break;
-            }
+        if(valueFirst0 != 1){
+            bounded = false;
+            break;
+        }
+        for(int j = 0; j<vertex->size; j++){
+            double valueFirstj = dd_get_d(verticesFirst->matrix[i][j+1]);
+            gsl_vector_set(vertex,(size_t)j, valueFirstj);
+        }
+        gsl_blas_dgemv(CblasNoTrans, 1.0, P2->H, vertex, 0.0, result);
+        gsl_vector_sub(result, P2->G);
+        double violation = gsl_vector_max(result);
+        if(violation > *max_violation){
+            *max_violation = violation;
+        }
+        if(stop_at_violation && *max_violation > 0){
+            break;
         }
     }
+    //Clean up!
+    gsl_vector_free(result);
     gsl_vector_free(vertex);
     dd_FreePolyhedra(first);
     dd_FreeMatrix(verticesFirst);
-    return is_subset;
+    return bounded;
+}
+
+/**
+ * Largest violation max_i (h_P1(H2_i) - G2_i) of P2 over P1, one support function LP per row of P2
+ */
+static void subset_violation_lp(polytope *P1,
+                                polytope *P2,
+                                bool stop_at_violation,
+                                double *max_violation)
+{
+    *max_violation = -INFINITY;
+    for(size_t i = 0; i<P2->H->size1; i++){
+        gsl_vector_view H2_i = gsl_matrix_row(P2->H, i);
+        double support = polytope_support_function(P1, &H2_i.vector);
+        if(support == -INFINITY){
+            //P1 is empty
+            return;
+        }
+        double violation = support - gsl_vector_get(P2->G, i);
+        if(violation > *max_violation){
+            *max_violation = violation;
+        }
+        if(stop_at_violation && *max_violation > 0){
+            return;
+        }
+    }
+}
+
+/**
+ * Estimated cost of the vertex strategy compared to the LP strategy
+ *
+ * Vertex strategy: enumeration of at most C(k1, floor(n/2)) vertices (upper bound theorem, up to a constant),
+ * each checked against k2 rows.
+ * LP strategy: k2 LPs with k1 rows, each about k1*n pivot work.
+ */
+static bool subset_prefer_vertices(polytope *P1,
+                                   polytope *P2)
+{
+    double k1 = (double)P1->H->size1;
+    double k2 = (double)P2->H->size1;
+    double n = (double)P1->H->size2;
+
+    double vertices = 1;
+    size_t half = P1->H->size2/2;
+    for(size_t j = 0; j < half; j++){
+        vertices *= (k1-(double)j)/(double)(j+1);
+    }
+    double cost_vertices = vertices*(k1*n + k2*n);
+    double cost_lp = k2*k1*k1*n;
+
+    return cost_vertices <= cost_lp;
+}
+
+/**
+ * Checks whether polytope P1 \ issubset P2 and how far P1 reaches out of P2
+ */
+bool polytope_is_subset_violation(polytope *P1,
+                                  polytope *P2,
+                                  double *max_violation)
+{
+    double violation;
+    bool stop_at_violation = (max_violation == NULL);
+
+    if(!subset_prefer_vertices(P1, P2)
+       || !subset_violation_vertices(P1, P2, stop_at_violation, &violation)){
+        subset_violation_lp(P1, P2, stop_at_violation, &violation);
+    }
+
+    if(max_violation != NULL){
+        *max_violation = violation;
+    }
+    return violation <= 0;
+};
+
+/**
+ * Checks whether polytope P1 \ issubset P2
+ */
+bool polytope_is_subset(polytope *P1,
+                        polytope *P2)
+{
+    return polytope_is_subset_violation(P1, P2, NULL);
+};
+
+/**
+ * Support function of a polytope in a direction: h_P(d) = max{d'.x | x in P}
+ * (INFINITY if cdd fails)
+ */
+double polytope_support_function(polytope *P,
+                                 gsl_vector *direction)
+{
+    dd_ErrorType err = dd_NoError;
+
+    // cdd form of H.x <= G: G - H.x >= 0
+    dd_MatrixPtr constraints = dd_CreateMatrix(P->H->size1, (P->H->size2+1));
+    for(size_t i = 0; i<P->H->size1; i++){
+        dd_set_d(constraints->matrix[i][0], gsl_vector_get(P->G, i));
+        for (size_t j = 1; j < (P->H->size2+1); j++) {
+            dd_set_d(constraints->matrix[i][j], -1*gsl_matrix_get(P->H, i, j-1));
+        }
+    }
+    constraints->representation = dd_Inequality;
+
+    // max d'.x
+    constraints->objective = dd_LPmax;
+    dd_set_d(constraints->rowvec[0], 0);
+    for (size_t j = 1; j < (P->H->size2+1); j++) {
+        dd_set_d(constraints->rowvec[j], gsl_vector_get(direction, j-1));
+    }
+
+    // No answer of cdd: unbounded, which is conservative for subset tests and gaps
+    dd_LPPtr lp = dd_Matrix2LP(constraints, &err);
+    if(err != dd_NoError || lp == NULL){
+        if(lp != NULL){
+            dd_FreeLPData(lp);
+        }
+        dd_FreeMatrix(constraints);
+        return INFINITY;
+    }
+    dd_LPSolve(lp, dd_DualSimplex, &err);
+    if(err != dd_NoError){
+        dd_FreeLPData(lp);
+        dd_FreeMatrix(constraints);
+        return INFINITY;
+    }
+
+    double support;
+    switch(lp->LPS){
+        case dd_Optimal:
+            support = dd_get_d(lp->optvalue);
+            break;
+        case dd_Inconsistent:
+        case dd_StrucInconsistent:
+            support = -INFINITY;
+            break;
+        default:
+            support = INFINITY;
+            break;
+    }
+
+    //Clean up!
+    dd_FreeLPData(lp);
+    dd_FreeMatrix(constraints);
+
+    return support;
+};
+
+/**
+ * Smallest axis aligned box containing a bounded polytope
+ */
+polytope * polytope_bounding_box(polytope *P)
+{
+    size_t n = P->H->size2;
+    polytope *box = polytope_alloc(2*n, n);
+    gsl_matrix_set_zero(box->H);
+    gsl_vector *direction = gsl_vector_alloc(n);
+
+    for(size_t i = 0; i < n; i++){
+        for(size_t side = 0; side < 2; side++){
+            double sign = (side == 0) ? 1 : -1;
+            gsl_vector_set_zero(direction);
+            gsl_vector_set(direction, i, sign);
+            double support = polytope_support_function(P, direction);
+            if(support == -INFINITY){
+                //P is empty
+                gsl_vector_free(direction);
+                polytope_free(box);
+                return NULL;
+            }
+            gsl_matrix_set(box->H, 2*i+side, i, sign);
+            gsl_vector_set(box->G, 2*i+side, support);
+        }
+    }
+
+    //Clean up!
+    gsl_vector_free(direction);
+
+    return box;
 };
 
 /**
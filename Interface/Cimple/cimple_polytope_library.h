@@ -47,11 +47,16 @@ void polytope_free(polytope *polytope);
 /**
  * Subdivision of abstract state containing additionally to the polytope also safe mode instructions
  * The array of polytopes "polytope **safe_mode" contains N polytopes the system has to go through to reach the invariant set
+ * (safe_mode[0],...,safe_mode[N], owned by the cell, NULL until safe mode is computed)
+ * invariant_set: robust control invariant subset of the cell (NULL if none was found)
+ * time_horizon: N
  */
 typedef struct cell{
 
     polytope **safe_mode;
+    int time_horizon;
     polytope *polytope_description;
+    polytope *invariant_set;
 
 }cell;
 
@@ -71,11 +76,21 @@ struct cell *cell_alloc(size_t k,
  */
 void cell_free(cell *cell);
 
+/**
+ * @brief Deallocates the safe mode path of the cell (all N+1 polytopes) and sets it NULL
+ * @param cell
+ */
+void cell_clear_safe_mode(cell *cell);
+
 
 /**
  * Convex region of several (cells_count) polytopes (array of polytopes**)
  * hull_over_polytopes is the convex hull of polytopes in that abstract state
  * hull.A = NULL if only one polytope exists in that region
+ *
+ * distance_invariant_set: number of transitions to the closest state containing an invariant set
+ *                         (-1 if no such state can be reached)
+ * next_state: first state on that way (the state itself if it contains an invariant set)
  */
 typedef struct abstract_state{
 
@@ -171,6 +186,9 @@ bool polytope_check_state(polytope *polytope, gsl_vector *x);
 
 /**
  * @brief Check whether P1 \ subset P2
+ *
+ * Stops at the first violated constraint, see polytope_is_subset_violation().
+ *
  * @param P1
  * @param P2
  * @return
@@ -178,6 +196,42 @@ bool polytope_check_state(polytope *polytope, gsl_vector *x);
 bool polytope_is_subset(polytope *P1,
                         polytope *P2);
 
+/**
+ * @brief Check whether P1 \ subset P2 and compute the maximal violation max_i (h_P1(H2_i) - G2_i)
+ *
+ * P1 \ subset P2 iff the support function of P1 in the direction of every row of P2 stays below G2_i.
+ * Depending on the estimated cost either the vertices of P1 are enumerated and checked against P2,
+ * or one support function LP is solved per row of P2 (no vertex enumeration, preferred in higher dimensions).
+ *
+ * @param P1
+ * @param P2
+ * @param max_violation if not NULL: maximal violation (<= 0 if P1 \ subset P2, -INFINITY if P1 is empty,
+ * INFINITY if P1 is unbounded outside of P2); if NULL the check stops at the first violated row
+ * @return
+ */
+bool polytope_is_subset_violation(polytope *P1,
+                                  polytope *P2,
+                                  double *max_violation);
+
+/**
+ * @brief Support function of a polytope in a direction: h_P(d) = max{d'.x | x in P}
+ *
+ * Solved as a linear program with cdd (no vertex enumeration).
+ *
+ * @param P
+ * @param direction d
+ * @return h_P(d), INFINITY if P is unbounded in direction d or the LP could not be solved, -INFINITY if P is empty
+ */
+double polytope_support_function(polytope *P,
+                                 gsl_vector *direction);
+
+/**
+ * @brief Smallest axis aligned box containing a bounded polytope (2n support function LPs)
+ * @param P
+ * @return box with rows +e_i.x <= h_P(e_i), -e_i.x <= h_P(-e_i) (i = 0,...,n-1), NULL if P is empty
+ */
+polytope * polytope_bounding_box(polytope *P);
+
 /**
  * @brief Unite inequalities of P1 and P2 in new polytope and remove redundancies
  * @param P1
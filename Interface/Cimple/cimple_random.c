@@ -0,0 +1,168 @@
+//
+// Created by L.Jonathan Feldstein
+//
+
+#include <math.h>
+#include "cimple_random.h"
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+/**
+ * Numbers generated at once by the batches (multiple of 4)
+ */
+#define RANDOM_CHUNK 64
+
+#define RANDOM_TWO_PI 6.283185307179586476925286766559
+#define RANDOM_2_POW_MINUS_32 2.3283064365386962890625e-10
+
+static uint64_t thread_seed = RANDOM_DEFAULT_SEED;
+static uint64_t threads_count = 0;
+static __thread random_stream thread_stream;
+static __thread int thread_stream_ready = 0;
+
+/**
+ * Philox4x32-10 block of the counter
+ */
+static void philox4x32(const uint32_t counter[4],
+                       const uint32_t key[2],
+                       uint32_t out[4])
+{
+    uint32_t x0 = counter[0], x1 = counter[1], x2 = counter[2], x3 = counter[3];
+    uint32_t k0 = key[0], k1 = key[1];
+
+    for(int r = 0; r < PHILOX_ROUNDS; r++){
+        uint64_t product0 = (uint64_t)PHILOX_M0*x0;
+        uint64_t product1 = (uint64_t)PHILOX_M1*x2;
+        uint32_t y0 = (uint32_t)(product1 >> 32) ^ x1 ^ k0;
+        uint32_t y1 = (uint32_t)product1;
+        uint32_t y2 = (uint32_t)(product0 >> 32) ^ x3 ^ k1;
+        uint32_t y3 = (uint32_t)product0;
+        x0 = y0; x1 = y1; x2 = y2; x3 = y3;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+
+    out[0] = x0;
+    out[1] = x1;
+    out[2] = x2;
+    out[3] = x3;
+}
+
+/**
+ * Uniform numbers in (0,1) of the next count/4 blocks (count multiple of 4)
+ */
+static void uniform_chunk(random_stream *stream,
+                          double *uniform,
+                          size_t count)
+{
+    uint32_t counter[4] = {0, 0, stream->stream[0], stream->stream[1]};
+    uint32_t out[4];
+    for(size_t i = 0; i < count; i += 4){
+        counter[0] = (uint32_t)stream->block;
+        counter[1] = (uint32_t)(stream->block >> 32);
+        philox4x32(counter, stream->key, out);
+        stream->block++;
+        for(int j = 0; j < 4; j++){
+            uniform[i+j] = ((double)out[j] + 0.5)*RANDOM_2_POW_MINUS_32;
+        }
+    }
+}
+
+/**
+ * Start stream stream_id of seed at its first block
+ */
+void random_stream_init(random_stream *stream,
+                        uint64_t seed,
+                        uint64_t stream_id)
+{
+    stream->key[0] = (uint32_t)seed;
+    stream->key[1] = (uint32_t)(seed >> 32);
+    stream->stream[0] = (uint32_t)stream_id;
+    stream->stream[1] = (uint32_t)(stream_id >> 32);
+    stream->block = 0;
+}
+
+/**
+ * Uniformly distributed numbers in (0,1)
+ */
+void random_uniform_batch(random_stream *stream,
+                          double *values,
+                          size_t count,
+                          size_t stride)
+{
+    double uniform[RANDOM_CHUNK];
+    for(size_t done = 0; done < count; done += RANDOM_CHUNK){
+        size_t chunk = (count-done < RANDOM_CHUNK) ? count-done : RANDOM_CHUNK;
+        uniform_chunk(stream, uniform, (chunk+3) & ~(size_t)3);
+        for(size_t i = 0; i < chunk; i++){
+            values[(done+i)*stride] = uniform[i];
+        }
+    }
+}
+
+/**
+ * Normally distributed numbers (Box-Muller)
+ */
+void random_gaussian_batch(random_stream *stream,
+                           double *values,
+                           size_t count,
+                           size_t stride,
+                           double mu,
+                           double sigma)
+{
+    double uniform[RANDOM_CHUNK];
+    double normal[RANDOM_CHUNK];
+    for(size_t done = 0; done < count; done += RANDOM_CHUNK){
+        size_t chunk = (count-done < RANDOM_CHUNK) ? count-done : RANDOM_CHUNK;
+        size_t generated = (chunk+3) & ~(size_t)3;
+        uniform_chunk(stream, uniform, generated);
+
+        //Pairs (u1, u2) -> r.cos(2.pi.u2), r.sin(2.pi.u2), r = sqrt(-2.ln(u1)): no branches, one pass over the chunk
+        for(size_t i = 0; i < generated; i += 2){
+            double radius = sigma*sqrt(-2.0*log(uniform[i]));
+            double angle = RANDOM_TWO_PI*uniform[i+1];
+            normal[i] = mu + radius*cos(angle);
+            normal[i+1] = mu + radius*sin(angle);
+        }
+        for(size_t i = 0; i < chunk; i++){
+            values[(done+i)*stride] = normal[i];
+        }
+    }
+}
+
+/**
+ * One normally distributed number
+ */
+double random_gaussian(random_stream *stream,
+                       double mu,
+                       double sigma)
+{
+    double value;
+    random_gaussian_batch(stream, &value, 1, 1, mu, sigma);
+    return value;
+}
+
+/**
+ * Seed of the streams of the threads
+ */
+void random_seed_threads(uint64_t seed)
+{
+    __atomic_store_n(&thread_seed, seed, __ATOMIC_RELAXED);
+}
+
+/**
+ * Stream of the calling thread
+ */
+random_stream *random_thread_stream(void)
+{
+    if(!thread_stream_ready){
+        uint64_t stream_id = __atomic_fetch_add(&threads_count, 1, __ATOMIC_RELAXED);
+        random_stream_init(&thread_stream, __atomic_load_n(&thread_seed, __ATOMIC_RELAXED), stream_id);
+        thread_stream_ready = 1;
+    }
+    return &thread_stream;
+}
@@ -0,0 +1,98 @@
+//
+// Created by L.Jonathan Feldstein
+//
+
+#ifndef CIMPLE_CIMPLE_RANDOM_H
+#define CIMPLE_CIMPLE_RANDOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Counter-based random numbers (Philox4x32-10, Salmon et al. "Parallel random numbers: as easy as 1, 2, 3")
+ *
+ * Every block of four 32 bit numbers is a pure function of (key, counter): key = seed, counter = stream id (high
+ * 64 bits) and block number (low 64 bits). Streams with different ids never overlap, no state is shared between them
+ * and a sequence only depends on seed, stream id and the calls on that stream: simulations running in parallel are
+ * reproducible whichever thread runs them.
+ *
+ * Batches are generated in chunks (first the uniform numbers of the whole chunk, then Box-Muller over it), a batch
+ * uses ceil(count/4) blocks, the unused numbers of its last block are discarded.
+ */
+
+#define RANDOM_DEFAULT_SEED 0x43494d504c45ULL
+
+/**
+ * One stream: key (seed), stream id and the number of the next block
+ */
+typedef struct random_stream{
+
+    uint32_t key[2];
+    uint32_t stream[2];
+    uint64_t block;
+
+}random_stream;
+
+/**
+ * @brief Start stream stream_id of seed at its first block
+ * @param stream
+ * @param seed
+ * @param stream_id
+ */
+void random_stream_init(random_stream *stream,
+                        uint64_t seed,
+                        uint64_t stream_id);
+
+/**
+ * @brief Uniformly distributed numbers in (0,1)
+ * @param stream
+ * @param values count values, values[i*stride] is written
+ * @param count
+ * @param stride
+ */
+void random_uniform_batch(random_stream *stream,
+                          double *values,
+                          size_t count,
+                          size_t stride);
+
+/**
+ * @brief Normally distributed numbers (Box-Muller)
+ * @param stream
+ * @param values count values, values[i*stride] is written (e.g. data and stride of a gsl_vector)
+ * @param count
+ * @param stride
+ * @param mu mean
+ * @param sigma standard deviation
+ */
+void random_gaussian_batch(random_stream *stream,
+                           double *values,
+                           size_t count,
+                           size_t stride,
+                           double mu,
+                           double sigma);
+
+/**
+ * @brief One normally distributed number (one block, prefer random_gaussian_batch() for many)
+ * @param stream
+ * @param mu
+ * @param sigma
+ * @return
+ */
+double random_gaussian(random_stream *stream,
+                       double mu,
+                       double sigma);
+
+/**
+ * @brief Seed of the streams of the threads (random_thread_stream()), set before the threads draw numbers
+ * @param seed
+ */
+void random_seed_threads(uint64_t seed);
+
+/**
+ * @brief Stream of the calling thread: stream ids are assigned in the order the threads first use it
+ *        (reproducible only if that order is, use own streams for parallel simulations)
+ * @return
+ */
+random_stream *random_thread_stream(void);
+
+#endif //CIMPLE_CIMPLE_RANDOM_H
@@ -0,0 +1,278 @@
+//
+// Created by L.Jonathan Feldstein
+//
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include "cimple_rt_executor.h"
+#include "cimple_trace.h"
+
+#define NSEC_PER_SEC 1000000000L
+
+/**
+ * t += add (normalized)
+ */
+static void timespec_add(struct timespec *t,
+                         const struct timespec *add)
+{
+    t->tv_sec += add->tv_sec;
+    t->tv_nsec += add->tv_nsec;
+    if(t->tv_nsec >= NSEC_PER_SEC){
+        t->tv_sec++;
+        t->tv_nsec -= NSEC_PER_SEC;
+    }
+}
+
+/**
+ * a - b in seconds
+ */
+static double timespec_diff(const struct timespec *a,
+                            const struct timespec *b)
+{
+    return (double)(a->tv_sec - b->tv_sec) + (double)(a->tv_nsec - b->tv_nsec)*1e-9;
+}
+
+/**
+ * Apply SCHED_FIFO and the pinning to the calling thread (failures are reported, the thread keeps running)
+ */
+static void apply_options(rt_executor *executor)
+{
+    executor->fifo = 0;
+    executor->pinned = 0;
+
+    if(executor->options.cpu >= 0){
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(executor->options.cpu, &cpus);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if(err == 0){
+            executor->pinned = 1;
+        } else{
+            fprintf(stderr, "\nControl loop executor could not be pinned to cpu %d: %s\n", executor->options.cpu,
+                    strerror(err));
+        }
+    }
+    if(executor->options.priority > 0){
+        struct sched_param parameter;
+        memset(&parameter, 0, sizeof(parameter));
+        parameter.sched_priority = executor->options.priority;
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &parameter);
+        if(err == 0){
+            executor->fifo = 1;
+        } else{
+            fprintf(stderr, "\nControl loop executor runs without SCHED_FIFO priority %d: %s\n",
+                    executor->options.priority, strerror(err));
+        }
+    }
+}
+
+/**
+ * Update the statistics with one finished period
+ */
+static void record_period(rt_executor *executor,
+                          double latency,
+                          double execution,
+                          int overrun)
+{
+    pthread_mutex_lock(&executor->lock);
+    rt_executor_statistics *statistics = &executor->statistics;
+    statistics->periods++;
+    statistics->overruns += (size_t)overrun;
+    statistics->last_latency = latency;
+    statistics->mean_latency += (latency - statistics->mean_latency)/(double)statistics->periods;
+    if(latency > statistics->max_latency){
+        statistics->max_latency = latency;
+    }
+    statistics->last_execution = execution;
+    if(execution > statistics->max_execution){
+        statistics->max_execution = execution;
+    }
+    pthread_mutex_unlock(&executor->lock);
+}
+
+/**
+ * Periods of one run: sleep until the absolute release time, run the step, advance the release time by one period
+ */
+static void run_periods(rt_executor *executor)
+{
+    struct timespec release;
+    clock_gettime(CLOCK_MONOTONIC, &release);
+
+    for(size_t k = 0; k < executor->periods_count; k++){
+        int err;
+        do{
+            err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &release, NULL);
+        }while(err == EINTR);
+
+        struct timespec woken;
+        clock_gettime(CLOCK_MONOTONIC, &woken);
+        double latency = timespec_diff(&woken, &release);
+
+        trace_set_step((uint32_t)k);
+        executor->step(k, executor->step_context);
+
+        struct timespec finished;
+        clock_gettime(CLOCK_MONOTONIC, &finished);
+
+        //A late step does not shift the schedule: the next period is released as soon as possible
+        timespec_add(&release, &executor->period);
+        int overrun = k+1 < executor->periods_count && timespec_diff(&finished, &release) > 0;
+        record_period(executor, latency, timespec_diff(&finished, &woken), overrun);
+        TRACE_INFO(TRACE_TIMING, -1, latency, timespec_diff(&finished, &woken), overrun);
+    }
+}
+
+/**
+ * Executor thread: waits for a run, runs its periods, reports it finished
+ */
+static void *rt_executor_work(void *arg)
+{
+    rt_executor *executor = (rt_executor *)arg;
+    unsigned long seen_run = 0;
+
+    apply_options(executor);
+
+    pthread_mutex_lock(&executor->lock);
+    while(1){
+        while(!executor->shutdown && executor->run == seen_run){
+            pthread_cond_wait(&executor->run_started, &executor->lock);
+        }
+        if(executor->shutdown){
+            break;
+        }
+        seen_run = executor->run;
+        pthread_mutex_unlock(&executor->lock);
+
+        run_periods(executor);
+
+        pthread_mutex_lock(&executor->lock);
+        executor->running = 0;
+        pthread_cond_signal(&executor->run_finished);
+    }
+    pthread_mutex_unlock(&executor->lock);
+
+    return NULL;
+}
+
+/**
+ * "Constructor" Dynamically allocates the executor and starts its thread
+ */
+struct rt_executor *rt_executor_alloc(rt_executor_options *options)
+{
+    struct rt_executor *return_executor = malloc (sizeof (struct rt_executor));
+    if (return_executor == NULL){
+        return NULL;
+    }
+
+    return_executor->options.priority = (options != NULL) ? options->priority : 0;
+    return_executor->options.cpu = (options != NULL) ? options->cpu : -1;
+    return_executor->fifo = 0;
+    return_executor->pinned = 0;
+    return_executor->run = 0;
+    return_executor->running = 0;
+    return_executor->shutdown = 0;
+    return_executor->period.tv_sec = 0;
+    return_executor->period.tv_nsec = 0;
+    return_executor->periods_count = 0;
+    return_executor->step = NULL;
+    return_executor->step_context = NULL;
+    memset(&return_executor->statistics, 0, sizeof(rt_executor_statistics));
+    pthread_mutex_init(&return_executor->lock, NULL);
+    pthread_cond_init(&return_executor->run_started, NULL);
+    pthread_cond_init(&return_executor->run_finished, NULL);
+
+    if(pthread_create(&return_executor->thread, NULL, rt_executor_work, return_executor) != 0){
+        pthread_cond_destroy(&return_executor->run_finished);
+        pthread_cond_destroy(&return_executor->run_started);
+        pthread_mutex_destroy(&return_executor->lock);
+        free(return_executor);
+        return NULL;
+    }
+
+    return return_executor;
+}
+
+/**
+ * "Destructor" Stops the thread and deallocates the executor
+ */
+void rt_executor_free(rt_executor *executor)
+{
+    pthread_mutex_lock(&executor->lock);
+    executor->shutdown = 1;
+    pthread_cond_broadcast(&executor->run_started);
+    pthread_mutex_unlock(&executor->lock);
+
+    pthread_join(executor->thread, NULL);
+    pthread_cond_destroy(&executor->run_finished);
+    pthread_cond_destroy(&executor->run_started);
+    pthread_mutex_destroy(&executor->lock);
+
+    free(executor);
+}
+
+/**
+ * Run step once every period and block until all periods are finished
+ */
+void rt_executor_run(rt_executor *executor,
+                     double period,
+                     size_t periods_count,
+                     rt_executor_step step,
+                     void *context)
+{
+    if(periods_count == 0){
+        return;
+    }
+
+    pthread_mutex_lock(&executor->lock);
+    executor->period.tv_sec = (time_t)period;
+    executor->period.tv_nsec = (long)((period - (double)executor->period.tv_sec)*(double)NSEC_PER_SEC);
+    executor->periods_count = periods_count;
+    executor->step = step;
+    executor->step_context = context;
+    memset(&executor->statistics, 0, sizeof(rt_executor_statistics));
+    executor->running = 1;
+    executor->run++;
+    pthread_cond_broadcast(&executor->run_started);
+
+    while(executor->running){
+        pthread_cond_wait(&executor->run_finished, &executor->lock);
+    }
+    pthread_mutex_unlock(&executor->lock);
+}
+
+/**
+ * Copy of the statistics of the current (or last) run
+ */
+void rt_executor_get_statistics(rt_executor *executor,
+                                rt_executor_statistics *statistics)
+{
+    pthread_mutex_lock(&executor->lock);
+    *statistics = executor->statistics;
+    pthread_mutex_unlock(&executor->lock);
+}
+
+/**
+ * Attributes for threads started by a step: default scheduling on every processor
+ */
+void rt_executor_worker_attributes(pthread_attr_t *attributes)
+{
+    struct sched_param parameter;
+    memset(&parameter, 0, sizeof(parameter));
+    pthread_attr_setinheritsched(attributes, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(attributes, SCHED_OTHER);
+    pthread_attr_setschedparam(attributes, &parameter);
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    for(long i = 0; i < online && i < CPU_SETSIZE; i++){
+        CPU_SET(i, &cpus);
+    }
+    pthread_attr_setaffinity_np(attributes, sizeof(cpus), &cpus);
+}
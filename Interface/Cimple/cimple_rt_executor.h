@@ -0,0 +1,134 @@
+//
+// Created by L.Jonathan Feldstein
+//
+
+#ifndef CIMPLE_CIMPLE_RT_EXECUTOR_H
+#define CIMPLE_CIMPLE_RT_EXECUTOR_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <time.h>
+
+/**
+ * Work of one period of the control loop, called at the release time of the period
+ *
+ *      period: number of the period in the current run {0,...,periods_count-1}
+ */
+typedef void (*rt_executor_step)(size_t period,
+                                 void *context);
+
+/**
+ * Scheduling of the executor thread
+ *
+ * priority: SCHED_FIFO priority (0: default scheduling of the process)
+ * cpu: processor the thread is pinned to (-1: no pinning)
+ *
+ * Both need privileges (e.g. CAP_SYS_NICE), if they can not be applied the executor runs with default scheduling.
+ */
+typedef struct rt_executor_options{
+
+    int priority;
+    int cpu;
+
+}rt_executor_options;
+
+/**
+ * Timing of the periods of the current run (seconds)
+ *
+ * latency: release jitter, i.e. time between the absolute release time of a period and the wake up of the executor
+ * execution: time the step took
+ * overruns: periods whose step did not finish before the release time of the next period
+ *           (the next period is released late, the schedule itself does not shift)
+ */
+typedef struct rt_executor_statistics{
+
+    size_t periods;
+    size_t overruns;
+    double last_latency;
+    double mean_latency;
+    double max_latency;
+    double last_execution;
+    double max_execution;
+
+}rt_executor_statistics;
+
+/**
+ * Persistent executor of the control loop
+ *
+ * One thread, created once, runs the steps of every run. The release time of period k is start + k*period on
+ * CLOCK_MONOTONIC and the thread sleeps until it with clock_nanosleep(TIMER_ABSTIME): neither thread creation nor
+ * the duration of the steps makes the period drift.
+ *
+ * run: number of the current run (the thread waits until it changes)
+ * running: a run is not finished yet
+ * fifo, pinned: the scheduling options could be applied
+ */
+typedef struct rt_executor{
+
+    pthread_t thread;
+    rt_executor_options options;
+    int fifo;
+    int pinned;
+
+    pthread_mutex_t lock;
+    pthread_cond_t run_started;
+    pthread_cond_t run_finished;
+    unsigned long run;
+    int running;
+    int shutdown;
+
+    struct timespec period;
+    size_t periods_count;
+    rt_executor_step step;
+    void *step_context;
+
+    rt_executor_statistics statistics;
+
+}rt_executor;
+
+/**
+ * @brief "Constructor" Dynamically allocates the executor and starts its thread
+ * @param options scheduling of the thread (NULL: default scheduling, no pinning)
+ * @return
+ */
+struct rt_executor *rt_executor_alloc(rt_executor_options *options);
+
+/**
+ * @brief "Destructor" Stops the thread and deallocates the executor
+ * @param executor
+ */
+void rt_executor_free(rt_executor *executor);
+
+/**
+ * @brief Run step once every period (the first period is released immediately) and block until all are finished
+ * @param executor
+ * @param period duration of one period in seconds
+ * @param periods_count
+ * @param step work of one period
+ * @param context passed to step
+ */
+void rt_executor_run(rt_executor *executor,
+                     double period,
+                     size_t periods_count,
+                     rt_executor_step step,
+                     void *context);
+
+/**
+ * @brief Copy of the statistics of the current (or last) run, updated after every period
+ * @param executor
+ * @param statistics
+ */
+void rt_executor_get_statistics(rt_executor *executor,
+                                rt_executor_statistics *statistics);
+
+/**
+ * @brief Attributes for threads started by a step: default scheduling on every processor
+ *
+ * Threads inherit SCHED_FIFO and the pinning of the executor otherwise, and could then keep it from waking up on
+ * time.
+ *
+ * @param attributes initialized attributes
+ */
+void rt_executor_worker_attributes(pthread_attr_t *attributes);
+
+#endif //CIMPLE_CIMPLE_RT_EXECUTOR_H
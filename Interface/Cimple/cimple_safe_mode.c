@@ -1,5 +1,9 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <time.h>
 #include <gsl/gsl_matrix.h>
 #include "cimple_safe_mode.h"
+#include "cimple_trace.h"
 
 /**
  * Adds a node to the beginning of the list
@@ -35,7 +39,7 @@ void pop_burn_node(burn_graph_node ** head)
  */
 void clear_burn_list(burn_graph_node **head)
 {
-    while (head !=NULL){
+    while (*head !=NULL){
         pop_burn_node(head);
     }
 };
@@ -48,226 +52,376 @@ abstract_state* fastest_burn(abstract_state **transitions,
                              int transitions_count)
 {
     //Initialize
-    abstract_state* fastest = transitions[0];
-    int distance = transitions[0]->distance_invariant_set;
-
-    //Check that there are more than 1 transition to evaluate, else trivial
-    if(transitions_count >1){
+    abstract_state* fastest = NULL;
 
-        //Compare transitions
-        for(int i = 1; i<transitions_count; i++){
-            if(transitions[i]->distance_invariant_set<distance){
-                distance = transitions[i]->distance_invariant_set;
-                fastest = transitions[i];
-            }
+    //Compare transitions (states that were not reached by the burning method are skipped)
+    for(int i = 0; i<transitions_count; i++){
+        if(transitions[i]->distance_invariant_set < 0){
+            continue;
+        }
+        if(fastest == NULL || transitions[i]->distance_invariant_set < fastest->distance_invariant_set){
+            fastest = transitions[i];
         }
-
     }
 
     return fastest;
 }
 
 /**
- * Given two polytopes, computes one step backwards from second polytope towards first polytope.
+ * "Constructor" Dynamically allocates the robust Pre operator of the system dynamics
  */
-polytope* previous_polytope(polytope *P1,
-                            polytope *P2,
-                            system_dynamics *s_dyn)
+struct robust_pre *robust_pre_alloc(system_dynamics *s_dyn)
 {
-
     size_t n = s_dyn->A->size2;  // State space dimension;
     size_t m = s_dyn->B->size2;  // Input space dimension;
-    polytope *scaled_W_set = polytope_linear_transform(s_dyn->W_set, s_dyn->E); // multiplication: EW
-
+    polytope *U_set = s_dyn->U_set;
 
-    polytope * robust_P1 = polytope_pontryagin(P1, scaled_W_set);
-    polytope * robust_P2 = polytope_pontryagin(P2, scaled_W_set);
+    struct robust_pre *return_pre = malloc (sizeof (struct robust_pre));
+    if (return_pre == NULL){
+        return NULL;
+    }
 
+    return_pre->EW = polytope_linear_transform(s_dyn->W_set, s_dyn->E); // multiplication: EW
+    if (return_pre->EW == NULL) {
+        free (return_pre);
+        return NULL;
+    }
 
-    size_t sum_dim = robust_P1->H->size1+robust_P2->H->size1;
+    return_pre->U_lifted = polytope_alloc(U_set->H->size1, n+m);
+    if (return_pre->U_lifted == NULL) {
+        polytope_free(return_pre->EW);
+        free (return_pre);
+        return NULL;
+    }
 
-    polytope *precedent_polytope = polytope_alloc(sum_dim+s_dyn->U_set->H->size1, n+m);
+    return_pre->n = n;
+    return_pre->m = m;
+    return_pre->A = s_dyn->A;
+    return_pre->B = s_dyn->B;
 
-    // FOR precedent_polytope G
+    // U_set.H is either |input| or |input state|, the lifted polytope has the columns |state input|
     /*
-     *     |P1_G|
-     * G = |P2_G|
-     *     |  0 |
+     * |m m m m n n n|    |n n n m m m m|
+     * |m m m m n n n| => |n n n m m m m|
+     * |m m m m n n n|    |n n n m m m m|
      */
-    gsl_vector_set_zero(precedent_polytope->G);
-    gsl_vector_view G_P1 = gsl_vector_subvector(precedent_polytope->G, 0, robust_P1->G->size);
-    gsl_vector_memcpy(&G_P1.vector, robust_P1->G);
-    gsl_vector_view G_P2 = gsl_vector_subvector(precedent_polytope->G, robust_P1->G->size,robust_P2->G->size);
-    gsl_vector_memcpy(&G_P2.vector, robust_P2->G);
-//    gsl_vector * P2_HdotK = gsl_vector_alloc(robust_P2->G->size);
-//    gsl_blas_dgemv(CblasNoTrans,1.0, robust_P2->H, s_dyn->K, 0.0, P2_HdotK);
-//    gsl_vector_sub(&G_P2.vector, P2_HdotK);
-//    //Clean up!
-//    gsl_vector_free(P2_HdotK);
-
-    // FOR Dist
-    /*
-     *         |  0   |
-     * Dist =  |P2_H.E|
-     *         |  0   |
-     */
-//    gsl_matrix *Dist = gsl_matrix_alloc(sum_dim+s_dyn->U_set->H->size1, p);
-//    gsl_matrix_set_zero(Dist);
-//    gsl_matrix_view Dist_P2 = gsl_matrix_submatrix(Dist, P1->H->size1, 0, P2->H->size1, Dist->size2);
-//    gsl_blas_dgemm(CblasNoTrans,CblasNoTrans, 1.0, P2->H, s_dyn->E, 0.0, &Dist_P2.matrix);
+    gsl_matrix_set_zero(return_pre->U_lifted->H);
+    gsl_matrix_view U_input = gsl_matrix_submatrix(U_set->H, 0, 0, U_set->H->size1, m);
+    gsl_matrix_view HU_input = gsl_matrix_submatrix(return_pre->U_lifted->H, 0, n, U_set->H->size1, m);
+    gsl_matrix_memcpy(&HU_input.matrix, &U_input.matrix);
+    if (U_set->H->size2 == m+n){
+        gsl_matrix_view U_state = gsl_matrix_submatrix(U_set->H, 0, m, U_set->H->size1, n);
+        gsl_matrix_view HU_state = gsl_matrix_submatrix(return_pre->U_lifted->H, 0, 0, U_set->H->size1, n);
+        gsl_matrix_memcpy(&HU_state.matrix, &U_state.matrix);
+    }
+    gsl_vector_memcpy(return_pre->U_lifted->G, U_set->G);
+
+    return return_pre;
+};
+
+/**
+ * "Destructor" Deallocates the robust Pre operator (A and B belong to the system dynamics)
+ */
+void robust_pre_free(robust_pre *pre)
+{
+    polytope_free(pre->U_lifted);
+    polytope_free(pre->EW);
+    free(pre);
+};
+
+/**
+ * Robust one step controllable set of target:
+ * all x (in state_constraints) for which some admissible u keeps A.x + B.u + d in target for every d in disturbance
+ */
+polytope *robust_pre_polytope(robust_pre *pre,
+                              polytope *target,
+                              polytope *disturbance,
+                              polytope *state_constraints)
+{
+    polytope *robust_target = polytope_pontryagin(target, (disturbance != NULL) ? disturbance : pre->EW);
+    polytope *pre_set = robust_pre_eroded_polytope(pre, robust_target, state_constraints);
+
+    //Clean up!
+    polytope_free(robust_target);
+
+    return pre_set;
+};
+
+/**
+ * Robust one step controllable set of a target already eroded by the disturbance:
+ * all x (in state_constraints) for which some admissible u brings A.x + B.u into robust_target
+ */
+polytope *robust_pre_eroded_polytope(robust_pre *pre,
+                                     polytope *robust_target,
+                                     polytope *state_constraints)
+{
+    size_t n = pre->n;
+    size_t m = pre->m;
+
+    size_t k_x = (state_constraints != NULL) ? state_constraints->H->size1 : 0;
+    size_t k_t = robust_target->H->size1;
+    size_t k_u = pre->U_lifted->H->size1;
+
+    polytope *lifted = polytope_alloc(k_x+k_t+k_u, n+m);
 
-    // FOR precedent_polytope H
     /*
-     *  H = |H1   0 |  OR  H = |H1    0 |
-     *      |H2A H2B|          |H2A  H2B|
-     *      | 0  HU |          |   HU   |
+     *  H = |H_X      0  |      G = |G_X|
+     *      |H_T.A  H_T.B|          |G_T|
+     *      |     HU     |          |GU |
      */
-    gsl_matrix_set_zero(precedent_polytope->H);
-
-    gsl_matrix_view H_P1 = gsl_matrix_submatrix(precedent_polytope->H, 0, 0, robust_P1->H->size1, n);
-    gsl_matrix_memcpy(&H_P1.matrix, robust_P1->H);
-    gsl_matrix_view H_P2_1 = gsl_matrix_submatrix(precedent_polytope->H, robust_P1->H->size1, 0, robust_P2->H->size1, n);
-    gsl_blas_dgemm(CblasNoTrans,CblasNoTrans, 1.0, robust_P2->H, s_dyn->A, 0.0, &H_P2_1.matrix);
-    gsl_matrix_view H_P2_2 = gsl_matrix_submatrix(precedent_polytope->H, robust_P1->H->size1, n, robust_P2->H->size1, m);
-    gsl_blas_dgemm(CblasNoTrans,CblasNoTrans, 1.0, robust_P2->H, s_dyn->B, 0.0, &H_P2_2.matrix);
-
-    if (s_dyn->U_set->H->size2 == m){
-        gsl_matrix_view HU = gsl_matrix_submatrix(precedent_polytope->H,sum_dim, n, s_dyn->U_set->H->size1,m);
-        gsl_matrix_memcpy(&HU.matrix,s_dyn->U_set->H);
-    } else if (s_dyn->U_set->H->size2 == m+n){
-        // transforms U_set.H from |constraints_ input constraints_state| to |constraints_state constraints_input|
-        /*
-         * |m m m m n n n|    |n n n m m m m|
-         * |m m m m n n n| => |n n n m m m m|
-         * |m m m m n n n|    |n n n m m m m|
-         */
-        gsl_matrix_view HU = gsl_matrix_submatrix(precedent_polytope->H,sum_dim, 0, s_dyn->U_set->H->size1,m+n);
-        gsl_matrix * exchange_matrix = gsl_matrix_alloc(n+m,n+m);
-        gsl_matrix_set_zero(exchange_matrix);
-        gsl_matrix_view eye_m = gsl_matrix_submatrix(exchange_matrix, 0, n, m, m);
-        gsl_matrix_set_identity(&eye_m.matrix);
-        gsl_matrix_view eye_n = gsl_matrix_submatrix(exchange_matrix, m, 0, n, n);
-        gsl_matrix_set_identity(&eye_n.matrix);
-        gsl_blas_dgemm(CblasNoTrans,CblasNoTrans,1.0, s_dyn->U_set->H,exchange_matrix, 0.0, &HU.matrix);
-    }
-
-
-    polytope *return_polytope = polytope_projection(precedent_polytope, n);
+    gsl_matrix_set_zero(lifted->H);
+    if(k_x > 0){
+        gsl_matrix_view H_X = gsl_matrix_submatrix(lifted->H, 0, 0, k_x, n);
+        gsl_matrix_memcpy(&H_X.matrix, state_constraints->H);
+        gsl_vector_view G_X = gsl_vector_subvector(lifted->G, 0, k_x);
+        gsl_vector_memcpy(&G_X.vector, state_constraints->G);
+    }
+    gsl_matrix_view H_TA = gsl_matrix_submatrix(lifted->H, k_x, 0, k_t, n);
+    gsl_blas_dgemm(CblasNoTrans,CblasNoTrans, 1.0, robust_target->H, pre->A, 0.0, &H_TA.matrix);
+    gsl_matrix_view H_TB = gsl_matrix_submatrix(lifted->H, k_x, n, k_t, m);
+    gsl_blas_dgemm(CblasNoTrans,CblasNoTrans, 1.0, robust_target->H, pre->B, 0.0, &H_TB.matrix);
+    gsl_vector_view G_T = gsl_vector_subvector(lifted->G, k_x, k_t);
+    gsl_vector_memcpy(&G_T.vector, robust_target->G);
+
+    gsl_matrix_view HU = gsl_matrix_submatrix(lifted->H, k_x+k_t, 0, k_u, n+m);
+    gsl_matrix_memcpy(&HU.matrix, pre->U_lifted->H);
+    gsl_vector_view GU = gsl_vector_subvector(lifted->G, k_x+k_t, k_u);
+    gsl_vector_memcpy(&GU.vector, pre->U_lifted->G);
+
+    polytope *pre_set = polytope_projection(lifted, n);
+
+    //Clean up!
+    polytope_free(lifted);
+
+    return pre_set;
+};
+
+/**
+ * Robust Pre operator of the system dynamics, allocated on first use
+ * (only called before work is handed to other threads)
+ */
+static robust_pre *system_robust_pre(system_dynamics *s_dyn)
+{
+    if(s_dyn->robust_pre == NULL){
+        s_dyn->robust_pre = robust_pre_alloc(s_dyn);
+        if(s_dyn->robust_pre == NULL){
+            fprintf(stderr, "\nCould not allocate the robust Pre operator\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return s_dyn->robust_pre;
+}
+
+/**
+ * Given two polytopes, computes one step backwards from second polytope towards first polytope.
+ */
+polytope* previous_polytope(polytope *P1,
+                            polytope *P2,
+                            system_dynamics *s_dyn)
+{
+
+    polytope * robust_P1 = polytope_pontryagin(P1, s_dyn->robust_pre->EW);
+    polytope *return_polytope = robust_pre_polytope(s_dyn->robust_pre, P2, NULL, robust_P1);
 
     //Clean up!
-//    gsl_matrix_free(Dist);
-//    gsl_vector_free(D_hat);
-    polytope_free(precedent_polytope);
+    polytope_free(robust_P1);
 
     return return_polytope;
 };
 
 /**
- * Computes N-1 polytopes the system has to transition to go from origin to target in N time steps
+ * Computes N-1 polytopes the system has to transition to go from origin to target in N time steps:
+ * path[N] = target, path[j] = Pre(path[j+1]) \cap (origin - EW) for j = N-1,...,1, path[0] = origin
+ * (the first backward step starts from robust_target = target - EW if the caller already has it)
  */
 polytope ** compute_path(polytope *origin,
                          polytope *target,
+                         polytope *robust_target,
                          system_dynamics *s_dyn,
                          int N)
 {
 
-    //Initialize
-    polytope **path = malloc(sizeof(polytope) * N);
+    //Initialize (path[0],...,path[N])
+    polytope **path = malloc(sizeof(polytope *) * (N+1));
 
     //Instead of just pointing path[N] = target, the memory is copied,
     // thus when the target polytope is freed somewhere the path stays complete
     path[N] = polytope_alloc(target->H->size1,target->H->size2);
     gsl_matrix_memcpy(path[N]->H,target->H);
+    gsl_vector_memcpy(path[N]->G,target->G);
 
     path[0] = polytope_alloc(origin->H->size1,origin->H->size2);
     gsl_matrix_memcpy(path[0]->H,origin->H);
+    gsl_vector_memcpy(path[0]->G,origin->G);
 
-    //Compute intermediate steps
+    //Compute intermediate steps: the origin constraint is part of every backward step,
+    //thus a state in path[j] can be brought into path[j+1] (not only into the backward reachable set of the target)
+    polytope *robust_origin = polytope_pontryagin(origin, s_dyn->robust_pre->EW);
     for(int j = N-1; j>0;j--){
-        path[j]=previous_polytope(path[0], path[j+1], s_dyn);
+        if(j == N-1 && robust_target != NULL){
+            path[j] = robust_pre_eroded_polytope(s_dyn->robust_pre, robust_target, robust_origin);
+        } else{
+            path[j] = robust_pre_polytope(s_dyn->robust_pre, path[j+1], NULL, robust_origin);
+        }
     }
 
+    //Clean up!
+    polytope_free(robust_origin);
+
     return path;
 };
 
+/**
+ * One step robust pre-image of R_i: all x for which some admissible u keeps A.x + B.u + w in R_i for every
+ * w in W_set_scaled (disturbance set already enlarged by the alpha cube)
+ */
 polytope *pre_alpha(polytope *R_i,
-                    gsl_matrix *A,
-                    gsl_matrix *B,
-                    polytope *W_set,
-                    polytope *U_set,
-                    polytope *scaled_unit_cube)
-{
-    size_t n = A->size2;
-    size_t m = B->size2;
-    polytope *W_set_scaled = polytope_minkowski(W_set, scaled_unit_cube);
-    polytope *R_i_scaled = polytope_pontryagin(R_i, W_set_scaled);
-
-    polytope *P0 = polytope_alloc(R_i_scaled->H->size1+U_set->H->size1, n+m);
-    gsl_matrix_set_zero(P0->H);
-    gsl_matrix_view H_P2_1 = gsl_matrix_submatrix(P0->H, 0, 0, R_i_scaled->H->size1, n);
-    gsl_blas_dgemm(CblasNoTrans,CblasNoTrans, 1.0, R_i_scaled->H, A, 0.0, &H_P2_1.matrix);
-    gsl_matrix_view H_P2_2 = gsl_matrix_submatrix(P0->H, 0, n, R_i_scaled->H->size1, m);
-    gsl_blas_dgemm(CblasNoTrans,CblasNoTrans, 1.0, R_i_scaled->H, B, 0.0, &H_P2_2.matrix);
-    if (U_set->H->size2 == m){
-        gsl_matrix_view HU = gsl_matrix_submatrix(P0->H,R_i_scaled->H->size1, n, U_set->H->size1,m);
-        gsl_matrix_memcpy(&HU.matrix,U_set->H);
-    } else if (U_set->H->size2 == m+n){
-        // transforms U_set.H from |constraints_ input constraints_state| to |constraints_state constraints_input|
-        /*
-         * |m m m m n n n|    |n n n m m m m|
-         * |m m m m n n n| => |n n n m m m m|
-         * |m m m m n n n|    |n n n m m m m|
-         */
-        gsl_matrix_view HU = gsl_matrix_submatrix(P0->H,R_i_scaled->H->size1, 0, U_set->H->size1,m+n);
-        gsl_matrix * exchange_matrix = gsl_matrix_alloc(n+m,n+m);
-        gsl_matrix_set_zero(exchange_matrix);
-        gsl_matrix_view eye_m = gsl_matrix_submatrix(exchange_matrix, 0, n, m, m);
-        gsl_matrix_set_identity(&eye_m.matrix);
-        gsl_matrix_view eye_n = gsl_matrix_submatrix(exchange_matrix, m, 0, n, n);
-        gsl_matrix_set_identity(&eye_n.matrix);
-        gsl_blas_dgemm(CblasNoTrans,CblasNoTrans,1.0, U_set->H,exchange_matrix, 0.0, &HU.matrix);
-    }
-    gsl_vector_set_zero(P0->G);
-    gsl_vector_view G_P1 = gsl_vector_subvector(P0->G, 0, R_i_scaled->G->size);
-    gsl_vector_memcpy(&G_P1.vector, R_i_scaled->G);
-    gsl_vector_view G_P2 = gsl_vector_subvector(P0->G, R_i_scaled->G->size,U_set->G->size);
-    gsl_vector_memcpy(&G_P2.vector, U_set->G);
-
-    polytope *pre_R_1 = polytope_projection(P0, n);
-    polytope_free(P0);
-    return pre_R_1;
+                    robust_pre *pre,
+                    polytope *W_set_scaled)
+{
+    return robust_pre_polytope(pre, R_i, W_set_scaled, NULL);
+}
+
+/**
+ * Seconds passed since start
+ */
+static double seconds_since(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec)*1e-9;
+}
+
+/**
+ * Append the rows selected in cuts to R (R is freed, the intersection is returned)
+ */
+static polytope *append_rows(polytope *R,
+                             polytope *rows,
+                             bool *cuts,
+                             size_t cuts_count)
+{
+    size_t k = R->H->size1;
+    polytope *intersection = polytope_alloc(k+cuts_count, R->H->size2);
+    gsl_matrix_view H_R = gsl_matrix_submatrix(intersection->H, 0, 0, k, R->H->size2);
+    gsl_matrix_memcpy(&H_R.matrix, R->H);
+    gsl_vector_view G_R = gsl_vector_subvector(intersection->G, 0, k);
+    gsl_vector_memcpy(&G_R.vector, R->G);
+
+    for(size_t j = 0; j < rows->H->size1; j++){
+        if(cuts[j]){
+            gsl_vector_view row = gsl_matrix_row(rows->H, j);
+            gsl_matrix_set_row(intersection->H, k, &row.vector);
+            gsl_vector_set(intersection->G, k, gsl_vector_get(rows->G, j));
+            k++;
+        }
+    }
+    polytope_free(R);
+    return intersection;
 }
+
+/**
+ * Robust control invariant subset of X: fixed point of R_(i+1) = Pre(R_i) \cap X (R_0 = X)
+ *
+ * The sequence is decreasing, thus R_(i+1) = R_i \cap Pre(R_i) and every iteration only has to add the rows of
+ * the latest pre-image that actually cut R_i (support function h_(R_i)(H_j) > G_j, one LP per row).
+ * The same LPs give the convergence gap
+ *
+ *      gap = max_j (h_(R_i)(H_j) - G_j)/|H_j|_1
+ *
+ * R_i is returned once gap <= alpha/2, i.e. R_i lies within the alpha cube around every new constraint
+ * (R_i \subseteq R_(i+1) + alpha cube, tested on the facet directions of R_(i+1)).
+ * Redundant rows are only removed once the number of rows has doubled since the last removal.
+ */
 polytope * compute_invariant_set(polytope* X,
-                                 gsl_matrix *A,
-                                 gsl_matrix *B,
-                                 polytope *W_set,
-                                 polytope *U_set,
-                                 double alpha)
+                                 robust_pre *pre,
+                                 double alpha,
+                                 int max_iterations,
+                                 invariant_set_telemetry telemetry,
+                                 void *telemetry_context)
 {
+    //Disturbance enlarged by the alpha cube only has to be computed once
     polytope * scaled_unit_cube = polytope_scaled_unit_cube(alpha, (int)X->H->size2);
+    polytope * W_set_scaled = polytope_minkowski(pre->EW, scaled_unit_cube);
+    polytope_free(scaled_unit_cube);
 
     polytope *R_i = polytope_alloc(X->H->size1,X->H->size2);
     gsl_matrix_memcpy(R_i->H,X->H);
     gsl_vector_memcpy(R_i->G,X->G);
-    polytope *pre_R_i = pre_alpha(R_i,A,B,W_set,U_set,scaled_unit_cube);
-    polytope *R_i_plus = polytope_unite_inequalities(pre_R_i, X);
-    dd_ErrorType err = dd_NoError;
-    dd_WriteMatrix(stdout,dd_CopyGenerators(polytope_to_cdd(R_i_plus,&err)));
+    size_t rows_after_pruning = R_i->H->size1;
+
+    polytope *invariant_set = NULL;
+    for(int iteration = 1; iteration <= max_iterations; iteration++){
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        invariant_set_iteration report;
+        report.iteration = iteration;
+        report.rows_added = 0;
+        report.rows_dropped = 0;
+        report.gap = -INFINITY;
+
+        polytope *pre_R_i = pre_alpha(R_i, pre, W_set_scaled);
 
-    polytope *R_scaled = polytope_minkowski(R_i_plus, scaled_unit_cube);
-    while(!(polytope_is_subset(R_i, R_scaled))){
+        //Which rows of the pre-image cut R_i and by how much
+        //(a pre-image without rows or with a row 0.x <= G_j < 0 is empty: the projection found no feasible point)
+        size_t rows = (pre_R_i->H != NULL) ? pre_R_i->H->size1 : 0;
+        bool empty = rows == 0;
+        bool *cuts = malloc(sizeof(bool)*(rows+1));
+        for(size_t j = 0; !empty && j < rows; j++){
+            gsl_vector_view H_j = gsl_matrix_row(pre_R_i->H, j);
+            double norm = gsl_blas_dasum(&H_j.vector);
+            if(norm == 0 && gsl_vector_get(pre_R_i->G, j) < 0){
+                empty = true;
+                break;
+            }
+            double support = polytope_support_function(R_i, &H_j.vector);
+            if(support == -INFINITY){
+                empty = true;
+                break;
+            }
+            double violation = support - gsl_vector_get(pre_R_i->G, j);
+            cuts[j] = violation > 1e-9;
+            if(cuts[j]){
+                report.rows_added++;
+            }
+            if(norm > 0 && violation/norm > report.gap){
+                report.gap = violation/norm;
+            }
+        }
+        bool converged = !empty && report.gap <= alpha/2;
+
+        if(!empty && !converged){
+            R_i = append_rows(R_i, pre_R_i, cuts, report.rows_added);
+            if(R_i->H->size1 > 2*rows_after_pruning){
+                size_t rows_before = R_i->H->size1;
+                polytope *minimized = polytope_minimize(R_i);
+                polytope_free(R_i);
+                R_i = minimized;
+                report.rows_dropped = rows_before - R_i->H->size1;
+                rows_after_pruning = R_i->H->size1;
+            }
+        }
+        free(cuts);
         polytope_free(pre_R_i);
-        polytope_free(R_scaled);
-        polytope_free(R_i);
-        R_i = R_i_plus;
-        pre_R_i = pre_alpha(R_i,A,B,W_set,U_set,scaled_unit_cube);
-        R_i_plus = polytope_unite_inequalities(pre_R_i, X);
-        R_scaled = polytope_minkowski(R_i_plus, scaled_unit_cube);
+
+        report.rows = R_i->H->size1;
+        report.seconds = seconds_since(&start);
+        bool abort = (telemetry != NULL) && telemetry(&report, telemetry_context);
+
+        if(empty || abort){
+            break;
+        }
+        if(converged){
+            invariant_set = polytope_minimize(R_i);
+            break;
+        }
     }
-    polytope_free(pre_R_i);
-    polytope_free(R_i_plus);
-    polytope_free(R_scaled);
-    return R_i;
+
+    //Clean up!
+    polytope_free(R_i);
+    polytope_free(W_set_scaled);
+
+    return invariant_set;
 
 };
 
@@ -283,13 +437,372 @@ bool has_transition(abstract_state *state,
 
     return transition_found;
 };
+/**
+ * Per-cell work of set_invariant_sets: task k only writes into cells[k]
+ * targets[k]: polytope the path of cell k leads to (only for the paths towards an invariant set of the same state)
+ * store: artefacts of an earlier run that are reused if their inputs did not change (may be NULL)
+ *
+ * The first backward step of a batch only depends on the target, target - EW is thus computed once per distinct
+ * target of the batch (the origin of every cell stays part of each step of its own path):
+ * distinct_targets[i]: i-th distinct target, robust_targets[i]: distinct_targets[i] - EW,
+ * target_index[k]: distinct target of task k
+ */
+typedef struct cell_tasks{
+
+    cell **cells;
+    polytope **targets;
+    system_dynamics *s_dyn;
+    int N;
+    safe_mode_store *store;
+
+    polytope **distinct_targets;
+    polytope **robust_targets;
+    size_t *target_index;
+
+}cell_tasks;
+
+static const double alpha_candidates[INVARIANT_SET_ALPHA_CANDIDATES_COUNT] = INVARIANT_SET_ALPHA_CANDIDATES;
+
+/**
+ * State of one (cell, alpha candidate) pair of the alpha search
+ */
+enum alpha_candidate_status{
+
+    ALPHA_STOPPED,      // not run, preempted by a preferred candidate or iteration limit reached
+    ALPHA_CONVERGED,    // box over-approximation converged
+    ALPHA_EMPTY         // box over-approximation became empty: no invariant set exists for this alpha
+
+};
+
+/**
+ * Alpha search of set_invariant_sets: cells[i] is screened with every candidate c in parallel, results of the
+ * pair (i, c) are stored at [c*cells_count+i] (candidate major, thus the candidates of one cell end up on
+ * different workers).
+ *
+ * winner[i]: most preferred candidate whose box converged so far (INVARIANT_SET_ALPHA_CANDIDATES_COUNT: none),
+ *            candidates behind it are stopped
+ * abstract_states[i]: abstract state of cells[i] (cell of its telemetry events)
+ */
+typedef struct alpha_search{
+
+    cell **cells;
+    int *abstract_states;
+    size_t cells_count;
+    robust_pre *pre;
+
+    polytope **boxes;
+    int *status;
+    int *winner;
+    pthread_mutex_t lock;
+
+}alpha_search;
+
+/**
+ * True if a candidate preferred to this one already converged for the cell
+ */
+static bool alpha_candidate_preempted(alpha_search *search,
+                                      size_t cell_index,
+                                      int candidate)
+{
+    pthread_mutex_lock(&search->lock);
+    bool preempted = search->winner[cell_index] < candidate;
+    pthread_mutex_unlock(&search->lock);
+    return preempted;
+}
+
+/**
+ * Fixed point of R_(i+1) = box(Pre(R_i) \cap X) \cap R_i on axis aligned boxes (R_0 = box(X))
+ *
+ * Pre is monotone, thus every R_i contains the exact iterate of compute_invariant_set(): an empty box proves that
+ * no invariant set exists for alpha, a converged box contains the invariant set.
+ */
+static int invariant_box(polytope *X,
+                         double alpha,
+                         alpha_search *search,
+                         size_t cell_index,
+                         int candidate,
+                         polytope **box)
+{
+    *box = NULL;
+    polytope * scaled_unit_cube = polytope_scaled_unit_cube(alpha, (int)X->H->size2);
+    polytope * W_set_scaled = polytope_minkowski(search->pre->EW, scaled_unit_cube);
+    polytope_free(scaled_unit_cube);
+
+    polytope *R_i = polytope_bounding_box(X);
+    int status = (R_i == NULL) ? ALPHA_EMPTY : ALPHA_STOPPED;
+    for(int iteration = 1; R_i != NULL && iteration <= INVARIANT_SET_MAX_ITERATIONS; iteration++){
+        if(alpha_candidate_preempted(search, cell_index, candidate)){
+            break;
+        }
+
+        polytope *pre_R_i = pre_alpha(R_i, search->pre, W_set_scaled);
+        polytope *restricted = polytope_unite_inequalities(pre_R_i, X);
+        polytope *R_next = polytope_bounding_box(restricted);
+        polytope_free(restricted);
+        polytope_free(pre_R_i);
+        if(R_next == NULL){
+            status = ALPHA_EMPTY;
+            break;
+        }
+
+        //R_next \cap R_i (same row order) and how far the box shrank
+        double gap = 0;
+        for(size_t j = 0; j < R_i->G->size; j++){
+            double bound = gsl_vector_get(R_i->G, j);
+            double next_bound = gsl_vector_get(R_next->G, j);
+            if(next_bound < bound){
+                gap = fmax(gap, bound - next_bound);
+            } else{
+                gsl_vector_set(R_next->G, j, bound);
+            }
+        }
+        polytope_free(R_i);
+        R_i = R_next;
+
+        if(gap <= alpha/2){
+            status = ALPHA_CONVERGED;
+            *box = R_i;
+            R_i = NULL;
+        }
+    }
+
+    //Clean up!
+    if(R_i != NULL){
+        polytope_free(R_i);
+    }
+    polytope_free(W_set_scaled);
+
+    return status;
+}
+
+/**
+ * Screen one (cell, alpha candidate) pair with boxes, skipped if a preferred candidate already converged
+ */
+static void alpha_screening_task(size_t index,
+                                 void *context)
+{
+    alpha_search *search = (alpha_search *)context;
+    size_t cell_index = index % search->cells_count;
+    int candidate = (int)(index / search->cells_count);
+
+    search->boxes[index] = NULL;
+    search->status[index] = ALPHA_STOPPED;
+    if(alpha_candidate_preempted(search, cell_index, candidate)){
+        return;
+    }
+
+    search->status[index] = invariant_box(search->cells[cell_index]->polytope_description,
+                                          alpha_candidates[candidate],
+                                          search,
+                                          cell_index,
+                                          candidate,
+                                          &search->boxes[index]);
+
+    if(search->status[index] == ALPHA_CONVERGED){
+        pthread_mutex_lock(&search->lock);
+        if(candidate < search->winner[cell_index]){
+            search->winner[cell_index] = candidate;
+        }
+        pthread_mutex_unlock(&search->lock);
+    }
+}
+
+/**
+ * Cell and alpha of one exact invariant set computation (context of invariant_set_trace())
+ */
+typedef struct invariant_set_trace_context{
+
+    int abstract_state;
+    double alpha;
+
+}invariant_set_trace_context;
+
+/**
+ * Telemetry of compute_invariant_set(): every iteration is recorded as TRACE_INVARIANT_SET event, never aborts
+ */
+static int invariant_set_trace(invariant_set_iteration *report,
+                               void *telemetry_context)
+{
+    invariant_set_trace_context *context = (invariant_set_trace_context *)telemetry_context;
+    TRACE_INFO(TRACE_INVARIANT_SET, context->abstract_state, (double)report->iteration, context->alpha,
+               (double)report->rows, (double)report->rows_added, (double)report->rows_dropped, report->seconds,
+               report->gap);
+    (void)context;
+    return 0;
+}
+
+/**
+ * Exact invariant set of the cell: the winner of the screening first (started from its box), then the candidates
+ * behind it that were stopped before they could finish (candidates with an empty box are skipped)
+ */
+static void alpha_refinement_task(size_t index,
+                                  void *context)
+{
+    alpha_search *search = (alpha_search *)context;
+    polytope *X = search->cells[index]->polytope_description;
+
+    search->cells[index]->invariant_set = NULL;
+    for(int c = search->winner[index]; c < INVARIANT_SET_ALPHA_CANDIDATES_COUNT; c++){
+        size_t pair = (size_t)c*search->cells_count+index;
+        if(search->status[pair] == ALPHA_EMPTY){
+            continue;
+        }
+        //The invariant set lies in the converged box: start the exact iteration from X \cap box
+        polytope *start = (search->boxes[pair] != NULL) ? polytope_unite_inequalities(X, search->boxes[pair]) : X;
+        invariant_set_trace_context telemetry = {search->abstract_states[index], alpha_candidates[c]};
+        search->cells[index]->invariant_set = compute_invariant_set(start,
+                                                                    search->pre,
+                                                                    alpha_candidates[c],
+                                                                    INVARIANT_SET_MAX_ITERATIONS,
+                                                                    invariant_set_trace,
+                                                                    &telemetry);
+        if(start != X){
+            polytope_free(start);
+        }
+        if(search->cells[index]->invariant_set != NULL){
+            break;
+        }
+    }
+}
+
+/**
+ * Invariant sets of cells_count cells: screening of all alpha candidates with boxes (one batch, in parallel),
+ * then exact computation for the winner of every cell (second batch)
+ */
+static void run_alpha_search(cell **cells,
+                             int *abstract_states,
+                             size_t cells_count,
+                             system_dynamics *s_dyn,
+                             thread_pool *pool,
+                             thread_pool_progress progress,
+                             void *progress_context)
+{
+    size_t pairs_count = cells_count*INVARIANT_SET_ALPHA_CANDIDATES_COUNT;
+
+    alpha_search search;
+    search.cells = cells;
+    search.abstract_states = abstract_states;
+    search.cells_count = cells_count;
+    search.pre = s_dyn->robust_pre;
+    search.boxes = malloc(sizeof(polytope *)*pairs_count);
+    search.status = malloc(sizeof(int)*pairs_count);
+    search.winner = malloc(sizeof(int)*cells_count);
+    pthread_mutex_init(&search.lock, NULL);
+    for(size_t i = 0; i < cells_count; i++){
+        search.winner[i] = INVARIANT_SET_ALPHA_CANDIDATES_COUNT;
+    }
+
+    thread_pool_run(pool, alpha_screening_task, &search, pairs_count, progress, progress_context);
+
+    //Cells without any converged box try every candidate whose box did not become empty
+    for(size_t i = 0; i < cells_count; i++){
+        if(search.winner[i] == INVARIANT_SET_ALPHA_CANDIDATES_COUNT){
+            search.winner[i] = 0;
+        }
+    }
+    thread_pool_run(pool, alpha_refinement_task, &search, cells_count, progress, progress_context);
+
+    //Clean up!
+    for(size_t k = 0; k < pairs_count; k++){
+        if(search.boxes[k] != NULL){
+            polytope_free(search.boxes[k]);
+        }
+    }
+    pthread_mutex_destroy(&search.lock);
+    free(search.winner);
+    free(search.status);
+    free(search.boxes);
+}
+
+/**
+ * Erode one distinct target of the batch by the disturbance
+ */
+static void robust_target_task(size_t index,
+                               void *context)
+{
+    cell_tasks *tasks = (cell_tasks *)context;
+    tasks->robust_targets[index] = polytope_pontryagin(tasks->distinct_targets[index], tasks->s_dyn->robust_pre->EW);
+}
+
+/**
+ * Compute the path of one cell of the batch
+ */
+static void path_task(size_t index,
+                      void *context)
+{
+    cell_tasks *tasks = (cell_tasks *)context;
+    tasks->cells[index]->safe_mode = compute_path(tasks->cells[index]->polytope_description,
+                                                  tasks->targets[index],
+                                                  tasks->robust_targets[tasks->target_index[index]],
+                                                  tasks->s_dyn,
+                                                  tasks->N);
+}
+
+/**
+ * Compute the paths of tasks 0,...,tasks_count-1:
+ * paths whose inputs did not change are taken from the store, the others are computed in parallel (one batch),
+ * after the robust targets shared by them (one batch per distinct target)
+ */
+static void run_path_tasks(cell_tasks *tasks,
+                           size_t tasks_count,
+                           thread_pool *pool,
+                           thread_pool_progress progress,
+                           void *progress_context)
+{
+    size_t remaining = 0;
+    for(size_t k = 0; k < tasks_count; k++){
+        if(!safe_mode_store_reuse_path(tasks->store, tasks->cells[k], tasks->targets[k])){
+            tasks->cells[remaining] = tasks->cells[k];
+            tasks->targets[remaining] = tasks->targets[k];
+            remaining++;
+        }
+    }
+    tasks_count = remaining;
+
+    tasks->distinct_targets = malloc(sizeof(polytope *)*(tasks_count+1));
+    tasks->robust_targets = malloc(sizeof(polytope *)*(tasks_count+1));
+    tasks->target_index = malloc(sizeof(size_t)*(tasks_count+1));
+
+    //Tasks of one batch share few targets (the polytope of the states of one frontier)
+    size_t targets_count = 0;
+    for(size_t k = 0; k < tasks_count; k++){
+        size_t i = 0;
+        while(i < targets_count && tasks->distinct_targets[i] != tasks->targets[k]){
+            i++;
+        }
+        if(i == targets_count){
+            tasks->distinct_targets[targets_count] = tasks->targets[k];
+            targets_count++;
+        }
+        tasks->target_index[k] = i;
+    }
+
+    thread_pool_run(pool, robust_target_task, tasks, targets_count, progress, progress_context);
+    thread_pool_run(pool, path_task, tasks, tasks_count, progress, progress_context);
+
+    //Clean up!
+    for(size_t i = 0; i < targets_count; i++){
+        polytope_free(tasks->robust_targets[i]);
+    }
+    free(tasks->target_index);
+    free(tasks->robust_targets);
+    free(tasks->distinct_targets);
+}
+
 /**
  * 1) Runs through all abstract states,
  * 2) checks if invariant set is contained
  * 3) sets path for all cells in those states containing an invariant set if possible
+ *
+ * Cells are independent, thus 2) and 3) are run as batches of per-cell tasks on the pool.
+ * Invariant sets and paths whose inputs did not change are taken from the store instead.
  */
 burn_graph_node *set_invariant_sets(discrete_dynamics *d_dyn,
-                                    system_dynamics *s_dyn)
+                                    system_dynamics *s_dyn,
+                                    safe_mode_store *store,
+                                    thread_pool *pool,
+                                    thread_pool_progress progress,
+                                    void *progress_context)
 {
 
     //Initialize graph
@@ -298,35 +811,68 @@ burn_graph_node *set_invariant_sets(discrete_dynamics *d_dyn,
     head_node->state = NULL;
     head_node->next = NULL;
     int N = (int)d_dyn->time_horizon;
-    double unit_cube_scale = 1;
+    system_robust_pre(s_dyn);
+
+    //Number all cells state by state
+    size_t cells_count = 0;
+    for(int i = 0; i< d_dyn->abstract_states_count; i++){
+        cells_count += d_dyn->abstract_states_set[i]->cells_count;
+    }
+    cell_tasks tasks;
+    tasks.cells = malloc(sizeof(cell *)*cells_count);
+    tasks.targets = malloc(sizeof(polytope *)*cells_count);
+    tasks.s_dyn = s_dyn;
+    tasks.N = N;
+    tasks.store = store;
+    int *abstract_states = malloc(sizeof(int)*(cells_count+1));
+
+    //Invariant sets whose inputs did not change are taken from the store
+    //(safe_mode is cleared because later safe_mode==NULL cells will be picked out)
+    size_t k = 0;
+    for(int i = 0; i< d_dyn->abstract_states_count; i++){
+        for(int j=0; j<d_dyn->abstract_states_set[i]->cells_count; j++){
+            cell *current = d_dyn->abstract_states_set[i]->cells[j];
+            cell_clear_safe_mode(current);
+            if(!safe_mode_store_reuse_invariant_set(store, current, alpha_candidates, INVARIANT_SET_ALPHA_CANDIDATES_COUNT,
+                                                    INVARIANT_SET_MAX_ITERATIONS)){
+                tasks.cells[k] = current;
+                abstract_states[k] = i;
+                k++;
+            }
+        }
+    }
+
+    //Try to compute invariant set of every other cell (adaptive alpha, in parallel, iterations are traced)
+    run_alpha_search(tasks.cells, abstract_states, k, s_dyn, pool, progress, progress_context);
+    free(abstract_states);
+
+    //Compute path for rest of cell to its invariant set (may be just a subset of that polytope)
+    k = 0;
+    for(int i = 0; i< d_dyn->abstract_states_count; i++){
+        for(int j=0; j<d_dyn->abstract_states_set[i]->cells_count; j++){
+            cell *current = d_dyn->abstract_states_set[i]->cells[j];
+            if(current->invariant_set != NULL){
+                tasks.cells[k] = current;
+                tasks.targets[k] = current->invariant_set;
+                k++;
+            }
+        }
+    }
+    run_path_tasks(&tasks, k, pool, progress, progress_context);
+
     //Create graph by
     // 1) running through all abstract_states and
     // 2) check whether it contains an invariant set
+    size_t path_count = 0;
     for(int i = 0; i< d_dyn->abstract_states_count; i++){
         bool found_set = false;
         for(int j=0; j<d_dyn->abstract_states_set[i]->cells_count; j++){
-            //Try to compute invariant set
-            polytope *invariant_set = compute_invariant_set(d_dyn->abstract_states_set[i]->cells[j]->polytope_description,
-                                                            s_dyn->A,
-                                                            s_dyn->B,
-                                                            s_dyn->W_set,
-                                                            s_dyn->U_set,
-                                                            unit_cube_scale);
-
             //if invariant set is found
-            if(invariant_set != NULL){
+            if(d_dyn->abstract_states_set[i]->cells[j]->invariant_set != NULL){
                 found_set = true;
                 //Set invariant_set cell to A cell containing an invariant set
                 //(may be more than one invariant set!!)
                 d_dyn->abstract_states_set[i]->invariant_set = d_dyn->abstract_states_set[i]->cells[j];
-                //Compute path for rest of cell to invariant set (may be just a subset of that polytope)
-                d_dyn->abstract_states_set[i]->cells[j]->safe_mode = compute_path(d_dyn->abstract_states_set[i]->cells[j]->polytope_description,
-                                                                      invariant_set,
-                                                                      s_dyn,
-                                                                      N);
-            }else{
-                //Set NULL because later safe_mode==NULL cells will be picked out
-                d_dyn->abstract_states_set[i]->cells[j]->safe_mode = NULL;
             }
         }
 
@@ -334,13 +880,12 @@ burn_graph_node *set_invariant_sets(discrete_dynamics *d_dyn,
         if(found_set){
             //Check whether state has a transition to itself
             if(has_transition(d_dyn->abstract_states_set[i], d_dyn->abstract_states_set[i])){
-                //if yes compute the safe_mode path for the cells that do not contain an invariant set
+                //if yes the safe_mode path for the cells that do not contain an invariant set is computed below
                 for(int j = 0; j < d_dyn->abstract_states_set[i]->cells_count; j++){
                     if(d_dyn->abstract_states_set[i]->cells[j]->safe_mode == NULL){
-                        d_dyn->abstract_states_set[i]->cells[j]->safe_mode = compute_path(d_dyn->abstract_states_set[i]->cells[j]->polytope_description,
-                                                                              d_dyn->abstract_states_set[i]->invariant_set->polytope_description,
-                                                                              s_dyn,
-                                                                              N);
+                        tasks.cells[path_count] = d_dyn->abstract_states_set[i]->cells[j];
+                        tasks.targets[path_count] = d_dyn->abstract_states_set[i]->invariant_set->polytope_description;
+                        path_count++;
                     }
                 }
             }
@@ -352,179 +897,335 @@ burn_graph_node *set_invariant_sets(discrete_dynamics *d_dyn,
             }
         }
     }
+
+    //Compute paths of the remaining cells of those states towards their invariant set (in parallel)
+    run_path_tasks(&tasks, path_count, pool, progress, progress_context);
+
+    //Clean up!
+    free(tasks.cells);
+    free(tasks.targets);
+
     return head_node;
 
 };
 
+/**
+ * Polytope describing the whole abstract state (convex hull if it consists of several cells)
+ */
+static polytope *state_polytope(abstract_state *state)
+{
+    if(state->convex_hull->H != NULL){
+        return state->convex_hull;
+    }
+    return state->cells[0]->polytope_description;
+}
+
+/**
+ * Queue the path computation of every cell of the state that has no safe mode path yet
+ */
+static void append_path_tasks(cell_tasks *tasks,
+                              size_t *tasks_count,
+                              abstract_state *state,
+                              polytope *target)
+{
+    for(int i = 0; i<state->cells_count; i++){
+        if(state->cells[i]->safe_mode == NULL){
+            tasks->cells[*tasks_count] = state->cells[i];
+            tasks->targets[*tasks_count] = target;
+            (*tasks_count)++;
+        }
+    }
+}
+
 /**
  * Gets list of states containing invariant sets.
  * Burns through transition system, setting all other safe mode paths.
+ *
+ * Breadth-first search backwards over the transitions starting from the seeds (distance 0):
+ * every state that can transition into a state of the current frontier and was not reached yet gets
+ * distance = burning_round and next_state = that state. The paths of all cells of one frontier only depend on the
+ * previous frontier and are computed as one batch on the pool.
  */
-//void burning_method(burn_graph_node *seeds,
-//                    discrete_dynamics *d_dyn,
-//                    system_dynamics *s_dyn)
-//{
-//
-//    //Initialize needed variables
-//    bool graph_burnt = false;
-//    int N = (int)d_dyn->time_horizon;
-//    burn_graph_node *current_burning = seeds;
-//    int burning_round = 0;
-//
-//
-//    while(!graph_burnt){
-//        burning_round +=1;
-//        burn_graph_node *next_burning = current_burning;
-//        while (current_burning != NULL) {
-//            if(current_burning->state->distance_invariant_set == INFINITY){
-//                for(int i = 0; i<current_burning->state->cells_count;i++){
-//                    if(current_burning->state->cells[i]->safe_mode == NULL){
-//                        current_burning->state->cells[i]->safe_mode = compute_path(current_burning->state->cells[i]->polytope_description,
-//                                                                                             current_burning->state->next_state->convex_hull,
-//                                                                                             s_dyn,
-//                                                                                             N);
-//                    }
-//
-//                }
-//                current_burning->state->distance_invariant_set = burning_round;
-//            }
-//            current_burning = current_burning->next;
-//        }
-//        while(next_burning != NULL){
-//            for(int i = 0;i<next_burning->state->transitions_in_count;i++){
-//                if(next_burning->state->transitions_in[i]->distance_invariant_set == NULL){
-//                    push_burn_node(&current_burning,next_burning->state->transitions_in[i]);
-//                }
-//            }
-//            next_burning = next_burning->next;
-//        }
-//        if(current_burning == NULL){
-//            graph_burnt = true;
-//        }
-//    }
-//    while (seeds !=NULL){
-//        if(seeds->state->next_state != seeds->state){
-//            abstract_state* fastest = fastest_burn(seeds->state->transitions_out,seeds->state->transitions_out_count);
-//            for(int i = 0; i< seeds->state->cells_count; i++){
-//                if(seeds->state->cells[i]->safe_mode == NULL){
-//                    seeds->state->cells[i]->safe_mode = compute_path(seeds->state->cells[i]->polytope_description, fastest->convex_hull,s_dyn,N);
-//                }
-//            }
-//        }
-//        seeds = seeds->next;
-//    }
-//};
+void burning_method(burn_graph_node *seeds,
+                    discrete_dynamics *d_dyn,
+                    system_dynamics *s_dyn,
+                    safe_mode_store *store,
+                    thread_pool *pool,
+                    thread_pool_progress progress,
+                    void *progress_context)
+{
+
+    //Initialize needed variables
+    int N = (int)d_dyn->time_horizon;
+    int burning_round = 0;
+    system_robust_pre(s_dyn);
+
+    size_t cells_count = 0;
+    for(int i = 0; i< d_dyn->abstract_states_count; i++){
+        cells_count += d_dyn->abstract_states_set[i]->cells_count;
+    }
+    cell_tasks tasks;
+    tasks.cells = malloc(sizeof(cell *)*cells_count);
+    tasks.targets = malloc(sizeof(polytope *)*cells_count);
+    tasks.s_dyn = s_dyn;
+    tasks.N = N;
+    tasks.store = store;
+
+    //Seeds are burnt first
+    burn_graph_node *current_burning = NULL;
+    for(burn_graph_node *seed = seeds; seed != NULL; seed = seed->next){
+        if(seed->state != NULL && seed->state->distance_invariant_set < 0){
+            seed->state->distance_invariant_set = 0;
+            seed->state->next_state = seed->state;
+            push_burn_node(&current_burning, seed->state);
+        }
+    }
+
+    while(current_burning != NULL){
+        burning_round += 1;
+
+        //Next frontier: all states not yet burnt with a transition into the current frontier
+        burn_graph_node *next_burning = NULL;
+        size_t tasks_count = 0;
+        for(burn_graph_node *node = current_burning; node != NULL; node = node->next){
+            for(int i = 0; i<node->state->transitions_in_count; i++){
+                abstract_state *previous = node->state->transitions_in[i];
+                if(previous->distance_invariant_set < 0){
+                    previous->distance_invariant_set = burning_round;
+                    previous->next_state = node->state;
+                    push_burn_node(&next_burning, previous);
+                    append_path_tasks(&tasks, &tasks_count, previous, state_polytope(node->state));
+                }
+            }
+        }
+
+        //Paths of the whole frontier in parallel
+        run_path_tasks(&tasks, tasks_count, pool, progress, progress_context);
+
+        clear_burn_list(&current_burning);
+        current_burning = next_burning;
+    }
+
+    //Cells of seeds that neither contain an invariant set nor can stay in the state: go to the closest burnt neighbour
+    size_t tasks_count = 0;
+    for(burn_graph_node *seed = seeds; seed != NULL; seed = seed->next){
+        if(seed->state == NULL){
+            continue;
+        }
+        abstract_state *fastest = fastest_burn(seed->state->transitions_out, seed->state->transitions_out_count);
+        if(fastest != NULL){
+            append_path_tasks(&tasks, &tasks_count, seed->state, state_polytope(fastest));
+        }
+    }
+    run_path_tasks(&tasks, tasks_count, pool, progress, progress_context);
+
+    //Clean up!
+    free(tasks.cells);
+    free(tasks.targets);
+};
 
 /**
  * Set the safe_mode path for every cell in every abstract_state:
  * 1) Compute invariant sets
  * 2) Find path towards invariant sets for other abstract_states
  */
-//void compute_safe_mode(discrete_dynamics *d_dyn,
-//                       system_dynamics *s_dyn)
-//{
-//
-//    burn_graph_node * invariant_sets = set_invariant_sets(d_dyn, s_dyn);
-//    burning_method(invariant_sets, d_dyn, s_dyn);
-//    free(invariant_sets);
-//};
-
-//gsl_vector *one_step_input(polytope *A, polytope *B)
-//{
-//    gsl_vector *u;
-//    return u;
-//};
-
-//abstract_state *find_current_state(gsl_vector *x,
-//                                   discrete_dynamics *d_dyn)
-//{
-//    abstract_state *now;
-//    return now;
-//};
-//
-//void *apply_safe_mode(current_state *now,
-//                      discrete_dynamics *d_dyn,
-//                      system_dynamics *s_dyn,
-//                      void *arg)
-//{
-//
-//    //find correct cell
-//    cell * current_cell = NULL;
-//    int N = (int)d_dyn->time_horizon;
-//    int found = 0;
-//    int i;
-//    for(i = 0; i < d_dyn->abstract_states_set[now->current_abs_state]->cells_count; i++){
-//        found = polytope_check_state(d_dyn->abstract_states_set[now->current_abs_state]->cells[i]->polytope_description, now->x);
-//        if(found){
-//            current_cell = d_dyn->abstract_states_set[now->current_abs_state]->cells[i];
-//            break;
-//        }
-//    }
-//
-//    //if not found check all other abstract_states_set all other cells
-//    if(current_cell ==NULL){
-//        for(i = 0; i<d_dyn->abstract_states_count; i++){
-//            for(int j = 0; j < d_dyn->abstract_states_set[i]->cells_count; j++){
-//                found = polytope_check_state(d_dyn->abstract_states_set[i]->cells[j]->polytope_description, now->x);
-//                if(found){
-//                    now->current_abs_state = i;
-//                    current_cell = d_dyn->abstract_states_set[i]->cells[j];
-//                }
-//            }
-//        }
-//    }
-//    int safe_mode_state = 0;
-//    found = 0;
-//    for(i = N; i>0; i--){
-//        found = polytope_check_state(current_cell->safe_mode[i], now->x);
-//        if(found){
-//            safe_mode_state = i;
-//            break;
-//        }
-//    }
-//    pthread_mutex_t *mx = arg;
-//
-//    //while ! in invariant set
-//    while(d_dyn->abstract_states_set[now->current_abs_state]->invariant_set == NULL && !needQuit(mx)){
-//        //find polytope of safe_mode
-//        int check = polytope_check_state(current_cell->safe_mode[safe_mode_state], now->x);
-//        if(!check){
-//            safe_mode_state = 0;
-//            found = 0;
-//            for(i = N; i>0; i--){
-//                found = polytope_check_state(current_cell->safe_mode[i], now->x);
-//                if(found){
-//                    safe_mode_state = i;
-//                    break;
-//                }
-//            }
-//        }
-//
-//        //linear combination to next polytope in line
-//        gsl_vector *u = one_step_input(current_cell->safe_mode[safe_mode_state],
-//                                               current_cell->safe_mode[safe_mode_state+1]);
-//        gsl_vector *w = gsl_vector_alloc(s_dyn->E->size2);
-//        simulate_disturbance(w, 0, 0.01);
-//        apply_control(now->x, u, s_dyn->A, s_dyn->B, s_dyn->E, w, (size_t)safe_mode_state);
-//
-//    }
-//
-//    //while not interrupted stay in invariant set
-//
-//    while( !needQuit(mx) ) {
-//        int check = polytope_check_state(d_dyn->abstract_states_set[now->current_abs_state]->invariant_set->polytope_description, now->x);
-//        if(!check){
-//            safe_mode_state = 0;
-//            found = 0;
-//            for(i = N; i>0; i--){
-//                found = polytope_check_state(current_cell->safe_mode[i], now->x);
-//                if(found){
-//                    safe_mode_state = i;
-//                    break;
-//                }
-//            }
-//        }
-//        one_step_input(d_dyn->abstract_states_set[now->current_abs_state]->invariant_set->polytope_description, d_dyn->abstract_states_set[now->current_abs_state]->invariant_set->polytope_description);
-//    }
-//    return NULL;
-//};
+void compute_safe_mode(discrete_dynamics *d_dyn,
+                       system_dynamics *s_dyn,
+                       safe_mode_store *store,
+                       thread_pool *pool,
+                       thread_pool_progress progress,
+                       void *progress_context)
+{
+
+    burn_graph_node * invariant_sets = set_invariant_sets(d_dyn, s_dyn, store, pool, progress, progress_context);
+    burning_method(invariant_sets, d_dyn, s_dyn, store, pool, progress, progress_context);
+    clear_burn_list(&invariant_sets);
+};
+
+/**
+ * Check whether the nominal successor A.x + B.u of x_real lies in check_polytope
+ */
+int check_backup(gsl_vector *x_real,
+                 gsl_vector *u,
+                 gsl_matrix *A,
+                 gsl_matrix *B,
+                 polytope *check_polytope,
+                 gsl_vector *x_next)
+{
+    gsl_vector *successor = (x_next != NULL) ? x_next : gsl_vector_alloc(x_real->size);
+    gsl_blas_dgemv(CblasNoTrans, 1.0, A, x_real, 0.0, successor);
+    gsl_blas_dgemv(CblasNoTrans, 1.0, B, u, 1.0, successor);
+
+    int is_included = polytope_check_state(check_polytope, successor);
+
+    //Clean up!
+    if(x_next == NULL){
+        gsl_vector_free(successor);
+    }
+
+    return is_included;
+};
+
+/**
+ * Cell the state is in: cells of the current abstract state first, then the cells of all other abstract states
+ */
+static cell *locate_cell(current_state *now,
+                         discrete_dynamics *d_dyn)
+{
+    abstract_state *state = d_dyn->abstract_states_set[now->current_abs_state];
+    for(int j = 0; j < state->cells_count; j++){
+        if(polytope_check_state(state->cells[j]->polytope_description, now->x)){
+            return state->cells[j];
+        }
+    }
+    for(int i = 0; i < d_dyn->abstract_states_count; i++){
+        state = d_dyn->abstract_states_set[i];
+        for(int j = 0; j < state->cells_count; j++){
+            if(polytope_check_state(state->cells[j]->polytope_description, now->x)){
+                now->current_abs_state = i;
+                return state->cells[j];
+            }
+        }
+    }
+    return NULL;
+};
+
+/**
+ * Safe mode path (safe_mode[0],...,safe_mode[N]) of the cell the state is in
+ */
+polytope **safe_mode_polytopes(current_state *now,
+                               discrete_dynamics *d_dyn)
+{
+    cell *current = locate_cell(now, d_dyn);
+    if(current == NULL){
+        return NULL;
+    }
+    return current->safe_mode;
+};
+
+/**
+ * Polytope of the safe mode path the state has to be driven into within one time step:
+ * successor of the furthest polytope of the path the state already is in (safe_mode[N] is its own successor)
+ */
+polytope *safe_mode_next_polytope(polytope **safe_mode,
+                                  gsl_vector *x,
+                                  int N)
+{
+    for(int j = N; j >= 0; j--){
+        if(polytope_check_state(safe_mode[j], x)){
+            return safe_mode[(j < N) ? j+1 : N];
+        }
+    }
+    return NULL;
+};
+
+/**
+ * One step input driving A.x + B.u as deep as possible into next (tightened by EW): LP in (u, t)
+ *
+ *      max t
+ *      s.t. H_i.B.u + |H_i|_2.t <= G_i - h_EW(H_i) - H_i.A.x      (rows of next)
+ *           HU_u.u <= GU - HU_x.x                                  (input constraints)
+ *
+ * t >= 0: every disturbance keeps the state in next, t < 0: input with the smallest violation
+ */
+int next_safemode_input(gsl_vector *u,
+                        current_state *now,
+                        polytope *next,
+                        system_dynamics *s_dyn)
+{
+    size_t n = s_dyn->A->size2;
+    size_t m = s_dyn->B->size2;
+    size_t k = next->H->size1;
+    polytope *U_set = s_dyn->U_set;
+    size_t k_u = U_set->H->size1;
+    robust_pre *pre = system_robust_pre(s_dyn);
+
+    //Nominal part H.A.x and input part H.B of the rows of next
+    gsl_vector *Ax = gsl_vector_alloc(n);
+    gsl_blas_dgemv(CblasNoTrans, 1.0, s_dyn->A, now->x, 0.0, Ax);
+    gsl_vector *HAx = gsl_vector_alloc(k);
+    gsl_blas_dgemv(CblasNoTrans, 1.0, next->H, Ax, 0.0, HAx);
+    gsl_matrix *HB = gsl_matrix_alloc(k, m);
+    gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, next->H, s_dyn->B, 0.0, HB);
+
+    // cdd form b - A.(u,t) >= 0
+    dd_ErrorType err = dd_NoError;
+    dd_MatrixPtr constraints = dd_CreateMatrix(k+k_u, m+2);
+    for(size_t i = 0; i < k; i++){
+        gsl_vector_view H_i = gsl_matrix_row(next->H, i);
+        double tightening = polytope_support_function(pre->EW, &H_i.vector);
+
+        dd_set_d(constraints->matrix[i][0], gsl_vector_get(next->G, i) - tightening - gsl_vector_get(HAx, i));
+        for(size_t j = 0; j < m; j++){
+            dd_set_d(constraints->matrix[i][j+1], -gsl_matrix_get(HB, i, j));
+        }
+        dd_set_d(constraints->matrix[i][m+1], -gsl_blas_dnrm2(&H_i.vector));
+    }
+    for(size_t i = 0; i < k_u; i++){
+        // U_set.H is either |input| or |input state|
+        double rhs = gsl_vector_get(U_set->G, i);
+        if(U_set->H->size2 == m+n){
+            for(size_t j = 0; j < n; j++){
+                rhs -= gsl_matrix_get(U_set->H, i, m+j)*gsl_vector_get(now->x, j);
+            }
+        }
+        dd_set_d(constraints->matrix[k+i][0], rhs);
+        for(size_t j = 0; j < m; j++){
+            dd_set_d(constraints->matrix[k+i][j+1], -gsl_matrix_get(U_set->H, i, j));
+        }
+        dd_set_d(constraints->matrix[k+i][m+1], 0);
+    }
+    constraints->representation = dd_Inequality;
+
+    // max t
+    constraints->objective = dd_LPmax;
+    for(size_t j = 0; j < m+2; j++){
+        dd_set_d(constraints->rowvec[j], 0);
+    }
+    dd_set_d(constraints->rowvec[m+1], 1);
+
+    dd_LPPtr lp = dd_Matrix2LP(constraints, &err);
+    dd_LPSolve(lp, dd_DualSimplex, &err);
+
+    int status;
+    if(lp->LPS == dd_Optimal){
+        for(size_t j = 0; j < m; j++){
+            gsl_vector_set(u, j, dd_get_d(lp->sol[j+1]));
+        }
+        status = (dd_get_d(lp->sol[m+1]) >= 0) ? 0 : 1;
+    } else{
+        gsl_vector_set_zero(u);
+        status = -1;
+    }
+
+    //Clean up!
+    dd_FreeLPData(lp);
+    dd_FreeMatrix(constraints);
+    gsl_matrix_free(HB);
+    gsl_vector_free(HAx);
+    gsl_vector_free(Ax);
+
+    return status;
+};
+
+/**
+ * Safe mode input of the current time step: locate the cell, find the next polytope of its safe mode path
+ * and compute the one step input towards it
+ */
+int total_safe_mode_computation(gsl_vector *u,
+                                current_state *now,
+                                discrete_dynamics *d_dyn,
+                                system_dynamics *s_dyn)
+{
+    gsl_vector_set_zero(u);
+
+    polytope **safe_mode = safe_mode_polytopes(now, d_dyn);
+    if(safe_mode == NULL){
+        return -1;
+    }
+    polytope *next = safe_mode_next_polytope(safe_mode, now->x, (int)d_dyn->time_horizon);
+    if(next == NULL){
+        return -1;
+    }
+    return next_safemode_input(u, now, next, s_dyn);
+};
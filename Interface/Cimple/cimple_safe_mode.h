@@ -7,6 +7,8 @@
 
 #include "cimple_controller.h"
 #include "cimple_auxiliary_functions.h"
+#include "cimple_thread_pool.h"
+#include "cimple_safe_mode_storage.h"
 
 /**
  * List node:
@@ -37,6 +39,64 @@ void pop_burn_node(burn_graph_node ** head);
  */
 void clear_burn_list(burn_graph_node **head);
 
+/**
+ * Robust one step controllable set (Pre) operator of the system dynamics:
+ *
+ *      Pre(T) = {x | exists u: U_lifted.[x u]' <= GU, A.x + B.u + d in T for all d in D}      (D = EW by default)
+ *
+ * Everything that does not depend on the target set T is computed once per system dynamics:
+ *      EW: disturbance set mapped into the state space
+ *      U_lifted: input constraints reordered to the columns |state input| of the lifted (n+m) polytope
+ *      A, B: dynamics blocks (owned by the system dynamics)
+ */
+typedef struct robust_pre{
+
+    size_t n;
+    size_t m;
+    gsl_matrix *A;
+    gsl_matrix *B;
+    polytope *EW;
+    polytope *U_lifted;
+
+}robust_pre;
+
+/**
+ * @brief "Constructor" Dynamically allocates the robust Pre operator of the system dynamics
+ * @param s_dyn
+ * @return NULL if the allocation failed
+ */
+struct robust_pre *robust_pre_alloc(system_dynamics *s_dyn);
+
+/**
+ * @brief "Destructor" Deallocates the robust Pre operator
+ * @param pre
+ */
+void robust_pre_free(robust_pre *pre);
+
+/**
+ * @brief Robust one step controllable set of a target polytope
+ * @param pre robust Pre operator of the system dynamics
+ * @param target polytope the state has to be in after one time step
+ * @param disturbance disturbance the target has to be robust against (NULL: EW)
+ * @param state_constraints polytope the state has to be in before the time step (NULL: none)
+ * @return all x (in state_constraints) for which some admissible u keeps A.x + B.u + d in target for every d
+ */
+polytope *robust_pre_polytope(robust_pre *pre,
+                              polytope *target,
+                              polytope *disturbance,
+                              polytope *state_constraints);
+
+/**
+ * @brief Robust one step controllable set of a target that is already robust against the disturbance
+ * @param pre robust Pre operator of the system dynamics
+ * @param robust_target target - disturbance (e.g. polytope_pontryagin(target, pre->EW))
+ * @param state_constraints polytope the state has to be in before the time step (NULL: none)
+ * @return all x (in state_constraints) for which some admissible u brings A.x + B.u into robust_target
+ */
+polytope *robust_pre_eroded_polytope(robust_pre *pre,
+                                     polytope *robust_target,
+                                     polytope *state_constraints);
+
 /**
  * @brief Computes one step backwards from second polytope towards first polytope
  * @param P1 Polytope of origin
@@ -50,47 +110,228 @@ polytope* previous_polytope(polytope *P1,
 
 /**
  * @brief Computes N-1 polytopes the system has to transition to go from origin to target in N time steps
+ *
+ * path[j] = Pre(path[j+1]) \cap (origin - EW): every state of path[j] can be brought into path[j+1].
+ *
  * @param origin
  * @param target
+ * @param robust_target target - EW, shared by all paths towards target (NULL: computed)
  * @param s_dyn
  * @param N time horizon within which target needs to be reached
  * @return Array of polytopes
  */
 polytope ** compute_path(polytope *origin,
                          polytope *target,
+                         polytope *robust_target,
                          system_dynamics *s_dyn,
                          int N);
 
 abstract_state* fastest_burn(abstract_state **transitions,
                              int transitions_count);
+
+/**
+ * @brief Check whether the nominal successor A.x + B.u of the state lies in check_polytope
+ * @param x_real current state
+ * @param u input to be applied
+ * @param A
+ * @param B
+ * @param check_polytope polytope the state has to be in after the time step
+ * @param x_next memory for the successor (e.g. of the control_workspace, NULL: allocated)
+ * @return 1 if it does, 0 otherwise
+ */
 int check_backup(gsl_vector *x_real,
                  gsl_vector *u,
                  gsl_matrix *A,
                  gsl_matrix *B,
-                 polytope *check_polytope);
+                 polytope *check_polytope,
+                 gsl_vector *x_next);
+
+/**
+ * Maximal number of iterations of the invariant set fixed point before a cell is given up
+ */
+#define INVARIANT_SET_MAX_ITERATIONS 100
+
+/**
+ * Candidates for alpha (side length of the cube the disturbance is enlarged with) in order of preference.
+ * set_invariant_sets() screens all of them in parallel with box over-approximations and computes the exact invariant
+ * set for the most preferred candidate whose box converged.
+ */
+#define INVARIANT_SET_ALPHA_CANDIDATES {1.0, 0.5, 0.25, 0.125}
+#define INVARIANT_SET_ALPHA_CANDIDATES_COUNT 4
+
+/**
+ * Telemetry of one iteration of compute_invariant_set():
+ *
+ *      rows: rows of R_(i+1) (after redundancy removal if it took place)
+ *      rows_added: rows of the pre-image that cut R_i
+ *      rows_dropped: redundant rows removed in this iteration
+ *      seconds: duration of the iteration
+ *      gap: convergence gap max_j (h_(R_i)(H_j) - G_j)/|H_j|_1 over the rows of the pre-image (converged if <= alpha/2)
+ */
+typedef struct invariant_set_iteration{
 
+    int iteration;
+    size_t rows;
+    size_t rows_added;
+    size_t rows_dropped;
+    double seconds;
+    double gap;
+
+}invariant_set_iteration;
+
+/**
+ * Called after every iteration of compute_invariant_set(), returning nonzero aborts the computation
+ */
+typedef int (*invariant_set_telemetry)(invariant_set_iteration *report,
+                                       void *telemetry_context);
+
+/**
+ * @brief One step robust pre-image of R_i under x(k+1) = A.x(k) + B.u(k) + w, u admissible, w in W_set_scaled
+ * @param R_i
+ * @param pre robust Pre operator of the system dynamics
+ * @param W_set_scaled disturbance set (already enlarged by the alpha cube)
+ * @return
+ */
+polytope *pre_alpha(polytope *R_i,
+                    robust_pre *pre,
+                    polytope *W_set_scaled);
+
+/**
+ * @brief Compute a robust control invariant subset of X as incremental fixed point
+ *
+ * Every iteration only adds the rows of the latest pre-image that cut the current set (one LP per row),
+ * redundant rows are removed lazily.
+ *
+ * @param X polytope the invariant set has to be in
+ * @param pre robust Pre operator of the system dynamics
+ * @param alpha side length of the cube the disturbance EW is enlarged with (also convergence tolerance)
+ * @param max_iterations
+ * @param telemetry called after every iteration (may be NULL)
+ * @param telemetry_context passed to telemetry
+ * @return invariant set or NULL if the set became empty, max_iterations was reached or telemetry aborted
+ */
 polytope * compute_invariant_set(polytope* X,
-                                 gsl_matrix *A,
-                                 gsl_matrix *B,
-                                 polytope *W_set,
-                                 polytope *U_set,
-                                 double alpha);
-
-void safe_mode_polytopes(system_dynamics *s_dyn,
-                         polytope *current_polytope,
-                         polytope *safe_polytope,
-                         size_t time_horizon,
-                         polytope **polytope_list_safemode);
-
-void next_safemode_input(gsl_matrix *u,
-                         current_state *now,
-                         polytope *current,
-                         polytope *next,
-                         system_dynamics *s_dyn,
-                         cost_function *f_cost);
+                                 robust_pre *pre,
+                                 double alpha,
+                                 int max_iterations,
+                                 invariant_set_telemetry telemetry,
+                                 void *telemetry_context);
+
+/**
+ * @brief Compute the invariant set of every cell and the safe mode paths of the states containing one
+ *
+ * The per-cell computations are run on the pool, the results are placed in the cells independently of the
+ * order in which they finish.
+ *
+ * @param d_dyn discrete abstraction of the system
+ * @param s_dyn system dynamics
+ * @param store artefacts reused if their inputs did not change, records the artefacts computed (may be NULL)
+ * @param pool worker pool
+ * @param progress progress report after every finished cell (may be NULL)
+ * @param progress_context passed to progress
+ * @return List of abstract states containing an invariant set (seeds of the burning method)
+ */
+burn_graph_node *set_invariant_sets(discrete_dynamics *d_dyn,
+                                    system_dynamics *s_dyn,
+                                    safe_mode_store *store,
+                                    thread_pool *pool,
+                                    thread_pool_progress progress,
+                                    void *progress_context);
+
+/**
+ * @brief Burn through the transition system starting from the states containing an invariant set
+ *
+ * Sets distance_invariant_set, next_state and the safe mode path of every cell of every state that can reach an
+ * invariant set. States are burnt frontier by frontier, the paths of one frontier are computed in parallel.
+ *
+ * @param seeds states containing an invariant set (see set_invariant_sets())
+ * @param d_dyn discrete abstraction of the system
+ * @param s_dyn system dynamics
+ * @param store artefacts reused if their inputs did not change, records the artefacts computed (may be NULL)
+ * @param pool worker pool
+ * @param progress progress report after every finished path (may be NULL)
+ * @param progress_context passed to progress
+ */
+void burning_method(burn_graph_node *seeds,
+                    discrete_dynamics *d_dyn,
+                    system_dynamics *s_dyn,
+                    safe_mode_store *store,
+                    thread_pool *pool,
+                    thread_pool_progress progress,
+                    void *progress_context);
+
+/**
+ * @brief Set the safe mode path for every cell in every abstract state: invariant sets first, then burning method
+ *
+ * Every iteration of an invariant set computed here is traced as TRACE_INVARIANT_SET event (cimple_trace.h).
+ * @param d_dyn discrete abstraction of the system
+ * @param s_dyn system dynamics
+ * @param store artefacts reused if their inputs did not change, records the artefacts computed (may be NULL)
+ * @param pool worker pool
+ * @param progress progress report after every finished cell (may be NULL)
+ * @param progress_context passed to progress
+ */
+void compute_safe_mode(discrete_dynamics *d_dyn,
+                       system_dynamics *s_dyn,
+                       safe_mode_store *store,
+                       thread_pool *pool,
+                       thread_pool_progress progress,
+                       void *progress_context);
 
-void *next_safemode_computation(void *arg);
+/**
+ * @brief Safe mode path of the cell the state is in (current abstract state first, then all others)
+ *
+ * now->current_abs_state is updated if the state is found in another abstract state.
+ *
+ * @param now current state of the plant
+ * @param d_dyn discrete abstraction of the system
+ * @return safe_mode[0],...,safe_mode[N] of the cell, NULL if the state is in no cell or the cell has no safe mode path
+ */
+polytope **safe_mode_polytopes(current_state *now,
+                               discrete_dynamics *d_dyn);
 
-void * total_safe_mode_computation(void *arg);
+/**
+ * @brief Polytope of the safe mode path the state has to be driven into within the next time step
+ *
+ * Successor of the furthest polytope of the path the state already is in, safe_mode[N] is its own successor.
+ *
+ * @param safe_mode safe mode path of the cell
+ * @param x current state
+ * @param N time horizon
+ * @return NULL if the state is in no polytope of the path
+ */
+polytope *safe_mode_next_polytope(polytope **safe_mode,
+                                  gsl_vector *x,
+                                  int N);
+
+/**
+ * @brief One step input driving the state as deep as possible into next, robust against the disturbance EW
+ *
+ * Small LP in the m inputs and the depth t (cdd, no horizon), respecting U_set.
+ *
+ * @param u input (m)
+ * @param now current state of the plant
+ * @param next polytope the state has to be in after the time step
+ * @param s_dyn system dynamics
+ * @return 0 if every disturbance keeps the state in next, 1 if only the smallest violation could be achieved,
+ * -1 if the input constraints are infeasible (u is set to zero)
+ */
+int next_safemode_input(gsl_vector *u,
+                        current_state *now,
+                        polytope *next,
+                        system_dynamics *s_dyn);
+
+/**
+ * @brief Safe mode input of the current time step (fallback if the main computation misses its deadline)
+ * @param u input (m)
+ * @param now current state of the plant
+ * @param d_dyn discrete abstraction of the system
+ * @param s_dyn system dynamics
+ * @return see next_safemode_input(), -1 also if no safe mode path is known for the state
+ */
+int total_safe_mode_computation(gsl_vector *u,
+                                current_state *now,
+                                discrete_dynamics *d_dyn,
+                                system_dynamics *s_dyn);
 
 #endif //CIMPLE_CIMPLE_SAFE_MODE_H
@@ -0,0 +1,476 @@
+//
+// Created by L.Jonathan Feldstein
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cimple_safe_mode_storage.h"
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+static const char safe_mode_magic[4] = {'C', 'S', 'M', 'A'};
+
+/**
+ * FNV-1a over len bytes
+ */
+static uint64_t hash_bytes(uint64_t hash,
+                           const void *data,
+                           size_t len)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    for(size_t i = 0; i < len; i++){
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static uint64_t hash_size(uint64_t hash,
+                          size_t value)
+{
+    uint64_t fixed = (uint64_t)value;
+    return hash_bytes(hash, &fixed, sizeof(fixed));
+}
+
+static uint64_t hash_matrix(uint64_t hash,
+                            gsl_matrix *X)
+{
+    hash = hash_size(hash, X->size1);
+    hash = hash_size(hash, X->size2);
+    for(size_t i = 0; i < X->size1; i++){
+        hash = hash_bytes(hash, gsl_matrix_ptr(X, i, 0), sizeof(double)*X->size2);
+    }
+    return hash;
+}
+
+static uint64_t hash_vector(uint64_t hash,
+                            gsl_vector *X)
+{
+    hash = hash_size(hash, X->size);
+    for(size_t i = 0; i < X->size; i++){
+        double value = gsl_vector_get(X, i);
+        hash = hash_bytes(hash, &value, sizeof(double));
+    }
+    return hash;
+}
+
+static uint64_t hash_polytope(uint64_t hash,
+                              polytope *P)
+{
+    hash = hash_matrix(hash, P->H);
+    return hash_vector(hash, P->G);
+}
+
+/**
+ * Fingerprint of the system dynamics every artefact depends on
+ */
+static uint64_t dynamics_fingerprint(system_dynamics *s_dyn)
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+
+    hash = hash_matrix(hash, s_dyn->A);
+    hash = hash_matrix(hash, s_dyn->B);
+    hash = hash_matrix(hash, s_dyn->E);
+    hash = hash_polytope(hash, s_dyn->W_set);
+    hash = hash_polytope(hash, s_dyn->U_set);
+
+    return hash;
+}
+
+/**
+ * "Constructor" Dynamically allocates an empty store for the artefacts of the system dynamics
+ */
+struct safe_mode_store *safe_mode_store_alloc(system_dynamics *s_dyn,
+                                              int N)
+{
+    struct safe_mode_store *return_store = malloc (sizeof (struct safe_mode_store));
+    if (return_store == NULL){
+        return NULL;
+    }
+
+    return_store->N = N;
+    return_store->n = s_dyn->A->size2;
+    return_store->dynamics = dynamics_fingerprint(s_dyn);
+
+    return_store->invariant_sets_count = 0;
+    return_store->invariant_sets = NULL;
+    return_store->paths_count = 0;
+    return_store->paths = NULL;
+
+    return_store->recorded_invariant_sets_count = 0;
+    return_store->recorded_invariant_sets_capacity = 0;
+    return_store->recorded_invariant_sets = NULL;
+    return_store->recorded_paths_count = 0;
+    return_store->recorded_paths_capacity = 0;
+    return_store->recorded_paths = NULL;
+
+    return_store->reused = 0;
+    return_store->recomputed = 0;
+
+    return return_store;
+}
+
+/**
+ * Deallocates count entries of polytopes_count polytopes each
+ */
+static void free_entries(safe_mode_entry *entries,
+                         size_t count,
+                         size_t polytopes_count)
+{
+    for(size_t i = 0; i < count; i++){
+        if(entries[i].polytopes == NULL){
+            continue;
+        }
+        for(size_t j = 0; j < polytopes_count; j++){
+            if(entries[i].polytopes[j] != NULL){
+                polytope_free(entries[i].polytopes[j]);
+            }
+        }
+        free(entries[i].polytopes);
+    }
+    free(entries);
+}
+
+/**
+ * "Destructor" Deallocates the store and all loaded artefacts
+ */
+void safe_mode_store_free(safe_mode_store *store)
+{
+    free_entries(store->invariant_sets, store->invariant_sets_count, 1);
+    free_entries(store->paths, store->paths_count, (size_t)store->N+1);
+    free(store->recorded_invariant_sets);
+    free(store->recorded_paths);
+    free(store);
+}
+
+/**
+ * Write a polytope (or only the absent flag if NULL)
+ */
+static int write_polytope(FILE *f,
+                          polytope *P)
+{
+    uint8_t present = (P != NULL);
+    if(fwrite(&present, sizeof(present), 1, f) != 1){
+        return -1;
+    }
+    if(!present){
+        return 0;
+    }
+    uint64_t k = P->H->size1;
+    uint64_t n = P->H->size2;
+    if(fwrite(&k, sizeof(k), 1, f) != 1 || fwrite(&n, sizeof(n), 1, f) != 1){
+        return -1;
+    }
+    for(size_t i = 0; i < k; i++){
+        if(n > 0 && fwrite(gsl_matrix_ptr(P->H, i, 0), sizeof(double), n, f) != n){
+            return -1;
+        }
+    }
+    for(size_t i = 0; i < k; i++){
+        double value = gsl_vector_get(P->G, i);
+        if(fwrite(&value, sizeof(double), 1, f) != 1){
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Read a polytope of dimension n (NULL if stored as absent)
+ */
+static int read_polytope(FILE *f,
+                         size_t n,
+                         polytope **P)
+{
+    *P = NULL;
+    uint8_t present;
+    if(fread(&present, sizeof(present), 1, f) != 1){
+        return -1;
+    }
+    if(!present){
+        return 0;
+    }
+    uint64_t k, stored_n;
+    if(fread(&k, sizeof(k), 1, f) != 1 || fread(&stored_n, sizeof(stored_n), 1, f) != 1){
+        return -1;
+    }
+    if(stored_n != n || k == 0 || k > (1u << 24)){
+        return -1;
+    }
+    polytope *read = polytope_alloc((size_t)k, n);
+    for(size_t i = 0; i < k; i++){
+        if(fread(gsl_matrix_ptr(read->H, i, 0), sizeof(double), n, f) != n){
+            polytope_free(read);
+            return -1;
+        }
+    }
+    for(size_t i = 0; i < k; i++){
+        if(fread(gsl_vector_ptr(read->G, i), sizeof(double), 1, f) != 1){
+            polytope_free(read);
+            return -1;
+        }
+    }
+    *P = read;
+    return 0;
+}
+
+static int compare_entries(const void *a,
+                           const void *b)
+{
+    uint64_t key_a = ((const safe_mode_entry *)a)->key;
+    uint64_t key_b = ((const safe_mode_entry *)b)->key;
+    return (key_a > key_b) - (key_a < key_b);
+}
+
+/**
+ * Read count (uint64) entries of polytopes_count polytopes each
+ */
+static int read_entries(FILE *f,
+                        size_t n,
+                        size_t polytopes_count,
+                        safe_mode_entry **entries,
+                        size_t *count)
+{
+    *entries = NULL;
+    *count = 0;
+    uint64_t stored_count;
+    if(fread(&stored_count, sizeof(stored_count), 1, f) != 1 || stored_count > (1u << 24)){
+        return -1;
+    }
+    *entries = calloc((size_t)stored_count, sizeof(safe_mode_entry));
+    if(stored_count > 0 && *entries == NULL){
+        return -1;
+    }
+    for(size_t i = 0; i < stored_count; i++){
+        safe_mode_entry *entry = &(*entries)[i];
+        entry->polytopes = calloc(polytopes_count, sizeof(polytope *));
+        *count = i+1;
+        if(fread(&entry->key, sizeof(entry->key), 1, f) != 1){
+            return -1;
+        }
+        for(size_t j = 0; j < polytopes_count; j++){
+            if(read_polytope(f, n, &entry->polytopes[j]) != 0){
+                return -1;
+            }
+        }
+    }
+    qsort(*entries, *count, sizeof(safe_mode_entry), compare_entries);
+    return 0;
+}
+
+/**
+ * Add the artefacts stored in a file to the store
+ */
+int safe_mode_store_load(safe_mode_store *store,
+                         const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if(f == NULL){
+        return -1;
+    }
+
+    //Header
+    char magic[4];
+    uint32_t version, N;
+    if(fread(magic, sizeof(magic), 1, f) != 1 || memcmp(magic, safe_mode_magic, sizeof(magic)) != 0
+       || fread(&version, sizeof(version), 1, f) != 1 || version != SAFE_MODE_FILE_VERSION
+       || fread(&N, sizeof(N), 1, f) != 1 || N != (uint32_t)store->N){
+        fclose(f);
+        return -1;
+    }
+
+    //Read everything into temporaries first: nothing is added from a corrupt file
+    safe_mode_entry *invariant_sets, *paths = NULL;
+    size_t invariant_sets_count, paths_count = 0;
+    int error = read_entries(f, store->n, 1, &invariant_sets, &invariant_sets_count) != 0;
+    if(!error){
+        error = read_entries(f, store->n, N+1, &paths, &paths_count) != 0;
+    }
+    fclose(f);
+
+    if(error){
+        free_entries(invariant_sets, invariant_sets_count, 1);
+        free_entries(paths, paths_count, N+1);
+        return -1;
+    }
+
+    free_entries(store->invariant_sets, store->invariant_sets_count, 1);
+    free_entries(store->paths, store->paths_count, N+1);
+    store->invariant_sets = invariant_sets;
+    store->invariant_sets_count = invariant_sets_count;
+    store->paths = paths;
+    store->paths_count = paths_count;
+
+    return 0;
+}
+
+/**
+ * Write the artefacts of the current computation to a file
+ */
+int safe_mode_store_save(safe_mode_store *store,
+                         const char *path)
+{
+    size_t path_length = strlen(path);
+    char *tmp_path = malloc(path_length+5);
+    memcpy(tmp_path, path, path_length);
+    memcpy(tmp_path+path_length, ".tmp", 5);
+
+    FILE *f = fopen(tmp_path, "wb");
+    if(f == NULL){
+        free(tmp_path);
+        return -1;
+    }
+
+    int error = 0;
+    uint32_t version = SAFE_MODE_FILE_VERSION;
+    uint32_t N = (uint32_t)store->N;
+    error |= fwrite(safe_mode_magic, sizeof(safe_mode_magic), 1, f) != 1;
+    error |= fwrite(&version, sizeof(version), 1, f) != 1;
+    error |= fwrite(&N, sizeof(N), 1, f) != 1;
+
+    uint64_t count = store->recorded_invariant_sets_count;
+    error |= fwrite(&count, sizeof(count), 1, f) != 1;
+    for(size_t i = 0; i < store->recorded_invariant_sets_count && !error; i++){
+        safe_mode_record *record = &store->recorded_invariant_sets[i];
+        error |= fwrite(&record->key, sizeof(record->key), 1, f) != 1;
+        error |= write_polytope(f, record->cell->invariant_set) != 0;
+    }
+
+    //Only paths that were actually computed (a cell may have been recorded before a failed computation)
+    count = 0;
+    for(size_t i = 0; i < store->recorded_paths_count; i++){
+        count += (store->recorded_paths[i].cell->safe_mode != NULL);
+    }
+    error |= fwrite(&count, sizeof(count), 1, f) != 1;
+    for(size_t i = 0; i < store->recorded_paths_count && !error; i++){
+        safe_mode_record *record = &store->recorded_paths[i];
+        if(record->cell->safe_mode == NULL){
+            continue;
+        }
+        error |= fwrite(&record->key, sizeof(record->key), 1, f) != 1;
+        for(uint32_t k = 0; k < N+1 && !error; k++){
+            error |= write_polytope(f, record->cell->safe_mode[k]) != 0;
+        }
+    }
+
+    error |= fclose(f) != 0;
+    if(!error){
+        error = rename(tmp_path, path) != 0;
+    }
+    if(error){
+        remove(tmp_path);
+    }
+
+    //Clean up!
+    free(tmp_path);
+
+    return error ? -1 : 0;
+}
+
+/**
+ * Append a record (capacity doubles)
+ */
+static void record(safe_mode_record **records,
+                   size_t *count,
+                   size_t *capacity,
+                   uint64_t key,
+                   cell *current)
+{
+    if(*count == *capacity){
+        *capacity = (*capacity == 0) ? 16 : 2*(*capacity);
+        *records = realloc(*records, sizeof(safe_mode_record)*(*capacity));
+        if(*records == NULL){
+            fprintf(stderr, "\nCould not allocate the records of the safe mode store\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    (*records)[*count].key = key;
+    (*records)[*count].cell = current;
+    (*count)++;
+}
+
+/**
+ * Stored entry with the key (NULL if none)
+ */
+static safe_mode_entry *find_entry(safe_mode_entry *entries,
+                                   size_t count,
+                                   uint64_t key)
+{
+    safe_mode_entry wanted;
+    wanted.key = key;
+    return bsearch(&wanted, entries, count, sizeof(safe_mode_entry), compare_entries);
+}
+
+static polytope *copy_polytope(polytope *original)
+{
+    if(original == NULL){
+        return NULL;
+    }
+    polytope *copy = polytope_alloc(original->H->size1, original->H->size2);
+    gsl_matrix_memcpy(copy->H, original->H);
+    gsl_vector_memcpy(copy->G, original->G);
+    return copy;
+}
+
+/**
+ * Record the invariant set of a cell and attach a copy of the stored one if its inputs did not change
+ */
+int safe_mode_store_reuse_invariant_set(safe_mode_store *store,
+                                        cell *current,
+                                        const double *alphas,
+                                        int alphas_count,
+                                        int max_iterations)
+{
+    if(store == NULL){
+        return 0;
+    }
+
+    uint64_t key = store->dynamics;
+    key = hash_polytope(key, current->polytope_description);
+    key = hash_size(key, (size_t)alphas_count);
+    key = hash_bytes(key, alphas, sizeof(double)*(size_t)alphas_count);
+    key = hash_size(key, (size_t)max_iterations);
+    record(&store->recorded_invariant_sets, &store->recorded_invariant_sets_count,
+           &store->recorded_invariant_sets_capacity, key, current);
+
+    safe_mode_entry *entry = find_entry(store->invariant_sets, store->invariant_sets_count, key);
+    if(entry == NULL){
+        store->recomputed++;
+        return 0;
+    }
+    current->invariant_set = copy_polytope(entry->polytopes[0]);
+    store->reused++;
+    return 1;
+}
+
+/**
+ * Record the safe mode path of a cell and attach a copy of the stored one if its inputs did not change
+ */
+int safe_mode_store_reuse_path(safe_mode_store *store,
+                               cell *current,
+                               polytope *target)
+{
+    if(store == NULL){
+        return 0;
+    }
+
+    uint64_t key = store->dynamics;
+    key = hash_size(key, (size_t)store->N);
+    key = hash_polytope(key, current->polytope_description);
+    key = hash_polytope(key, target);
+    record(&store->recorded_paths, &store->recorded_paths_count, &store->recorded_paths_capacity, key, current);
+
+    safe_mode_entry *entry = find_entry(store->paths, store->paths_count, key);
+    if(entry == NULL){
+        store->recomputed++;
+        return 0;
+    }
+    current->safe_mode = malloc(sizeof(polytope *)*(store->N+1));
+    for(int j = 0; j <= store->N; j++){
+        current->safe_mode[j] = copy_polytope(entry->polytopes[j]);
+    }
+    store->reused++;
+    return 1;
+}
@@ -0,0 +1,166 @@
+//
+// Created by L.Jonathan Feldstein
+//
+
+#ifndef CIMPLE_CIMPLE_SAFE_MODE_STORAGE_H
+#define CIMPLE_CIMPLE_SAFE_MODE_STORAGE_H
+
+#include <stdint.h>
+#include "cimple_system.h"
+#include "cimple_polytope_library.h"
+
+/**
+ * Default file the safe mode artefacts are stored in
+ */
+#define SAFE_MODE_FILE "cimple_safe_mode.dat"
+
+/**
+ * Version of the file layout (increase whenever the layout or the meaning of a stored artefact changes)
+ */
+#define SAFE_MODE_FILE_VERSION 3
+
+/**
+ * Every artefact is stored under a key: FNV-1a fingerprint of exactly the inputs it depends on
+ *
+ *      invariant set of a cell: dynamics | cell polytope | alpha candidates | maximal number of iterations
+ *      safe mode path of a cell: dynamics | time horizon | cell polytope | target polytope
+ *
+ *      dynamics: A, B, E, W_set, U_set
+ *
+ * After a change of the model (refined cells, other disturbance set, ...) only artefacts whose key changed are
+ * recomputed, all others are taken from the store (loaded from the file of an earlier run).
+ * Keys do not depend on the numbering of states and cells.
+ *
+ * Layout of the (binary, native byte order) file:
+ *
+ *      header: "CSMA" | version (uint32) | N (uint32)
+ *      invariant sets: count (uint64) | count * (key (uint64) | polytope)
+ *      safe mode paths: count (uint64) | count * (key (uint64) | N+1 polytopes)
+ *
+ *      polytope: present (uint8) | k (uint64) | n (uint64) | H row by row (k*n doubles) | G (k doubles)
+ */
+
+/**
+ * Stored artefact: one polytope (invariant set, NULL if none exists) or N+1 polytopes (safe mode path)
+ */
+typedef struct safe_mode_entry{
+
+    uint64_t key;
+    polytope **polytopes;
+
+}safe_mode_entry;
+
+/**
+ * Artefact of the current computation: key and cell it is attached to
+ */
+typedef struct safe_mode_record{
+
+    uint64_t key;
+    cell *cell;
+
+}safe_mode_record;
+
+/**
+ * Artefacts available for reuse and artefacts of the current computation
+ *
+ * dynamics: fingerprint of the current system dynamics
+ * invariant_sets, paths: loaded artefacts (sorted by key)
+ * recorded_invariant_sets, recorded_paths: artefacts of the current computation (written by safe_mode_store_save())
+ * reused, recomputed: number of artefacts taken from the store or computed anew
+ */
+typedef struct safe_mode_store{
+
+    int N;
+    size_t n;
+    uint64_t dynamics;
+
+    size_t invariant_sets_count;
+    safe_mode_entry *invariant_sets;
+    size_t paths_count;
+    safe_mode_entry *paths;
+
+    size_t recorded_invariant_sets_count;
+    size_t recorded_invariant_sets_capacity;
+    safe_mode_record *recorded_invariant_sets;
+    size_t recorded_paths_count;
+    size_t recorded_paths_capacity;
+    safe_mode_record *recorded_paths;
+
+    size_t reused;
+    size_t recomputed;
+
+}safe_mode_store;
+
+/**
+ * @brief "Constructor" Dynamically allocates an empty store for the artefacts of the system dynamics
+ * @param s_dyn
+ * @param N time horizon
+ * @return
+ */
+struct safe_mode_store *safe_mode_store_alloc(system_dynamics *s_dyn,
+                                              int N);
+
+/**
+ * @brief "Destructor" Deallocates the store and all loaded artefacts (artefacts attached to cells are not touched)
+ * @param store
+ */
+void safe_mode_store_free(safe_mode_store *store);
+
+/**
+ * @brief Add the artefacts stored in a file to the store
+ *
+ * Nothing is added if the file does not exist, has another version or time horizon, or is corrupt.
+ * Artefacts of other dynamics or cells are loaded but never match a key.
+ *
+ * @param store
+ * @param path
+ * @return 0 on success, -1 otherwise
+ */
+int safe_mode_store_load(safe_mode_store *store,
+                         const char *path);
+
+/**
+ * @brief Write the artefacts of the current computation (recorded in the store) to a file
+ *
+ * The file is written to path.tmp first and renamed afterwards, thus a crash never leaves a truncated file behind.
+ *
+ * @param store
+ * @param path
+ * @return 0 on success, -1 otherwise
+ */
+int safe_mode_store_save(safe_mode_store *store,
+                         const char *path);
+
+/**
+ * @brief Record the invariant set of a cell and attach a copy of the stored one if its inputs did not change
+ *
+ * Not thread safe: to be called before the work is handed to other threads.
+ *
+ * @param store (NULL: nothing is reused)
+ * @param current cell
+ * @param alphas alpha candidates tried (see set_invariant_sets())
+ * @param alphas_count
+ * @param max_iterations see compute_invariant_set()
+ * @return 1 if the invariant set was attached (it may be NULL if none exists), 0 if it has to be computed
+ */
+int safe_mode_store_reuse_invariant_set(safe_mode_store *store,
+                                        cell *current,
+                                        const double *alphas,
+                                        int alphas_count,
+                                        int max_iterations);
+
+/**
+ * @brief Record the safe mode path of a cell and attach a copy of the stored one if its inputs did not change
+ *
+ * Not thread safe: to be called before the work is handed to other threads.
+ *
+ * @param store (NULL: nothing is reused)
+ * @param current cell
+ * @param target polytope the path leads to
+ * @return 1 if the path was attached, 0 if it has to be computed
+ */
+int safe_mode_store_reuse_path(safe_mode_store *store,
+                               cell *current,
+                               polytope *target);
+
+#endif //CIMPLE_CIMPLE_SAFE_MODE_STORAGE_H
@@ -2,6 +2,8 @@
 // Created by L. Jonathan Feldstein
 
 #include "cimple_system.h"
+#include "cimple_mpc_computation.h"
+#include "cimple_safe_mode.h"
 
 
 /**
@@ -27,6 +29,18 @@ struct control_computation_arguments *cc_arguments_alloc(current_state *now, gsl
 
     return_control_computation_arguments->polytope_list_backup = polytope_list;
 
+    return_control_computation_arguments->mailbox = NULL;
+
+    return_control_computation_arguments->ticket = 0;
+
+    return_control_computation_arguments->result = NULL;
+
+    return_control_computation_arguments->cancel = NULL;
+
+    return_control_computation_arguments->r_target = NULL;
+
+    return_control_computation_arguments->qp_workspace = NULL;
+
     return return_control_computation_arguments;
 };
 /**
@@ -144,6 +158,136 @@ struct auxiliary_matrices *aux_matrices_alloc(size_t n,
     return return_aux_matrices;
 }
 
+/**
+ * Compute the auxiliary matrices from the system dynamics (A, B, E, K, U_set) for time horizon N
+ */
+void aux_matrices_init(system_dynamics *s_dyn,
+                       size_t N){
+
+    size_t n = s_dyn->A->size2;
+    size_t m = s_dyn->B->size2;
+    size_t p = s_dyn->E->size2;
+    size_t u_set_size = s_dyn->U_set->H->size1;
+    auxiliary_matrices *aux = s_dyn->aux_matrices;
+
+    //Powers of A: A_pow[k] = A^k, k = 0,...,N
+    gsl_matrix **A_pow = malloc(sizeof(gsl_matrix *)*(N+1));
+    A_pow[0] = gsl_matrix_alloc(n, n);
+    gsl_matrix_set_identity(A_pow[0]);
+    for(size_t k = 1; k<N+1; k++){
+        A_pow[k] = gsl_matrix_alloc(n, n);
+        gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, s_dyn->A, A_pow[k-1], 0.0, A_pow[k]);
+    }
+    //Markov parameters: AB_pow[k] = A^k.B, k = 0,...,N-1
+    gsl_matrix **AB_pow = malloc(sizeof(gsl_matrix *)*N);
+    for(size_t k = 0; k<N; k++){
+        AB_pow[k] = gsl_matrix_alloc(n, m);
+        gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, A_pow[k], s_dyn->B, 0.0, AB_pow[k]);
+    }
+
+    gsl_matrix_set_zero(aux->A_N);
+    gsl_matrix_set_zero(aux->A_K);
+    gsl_matrix_set_zero(aux->Ct);
+    gsl_matrix_set_zero(aux->B_diag);
+    gsl_matrix_set_zero(aux->E_diag);
+    gsl_matrix_set_zero(aux->L_default);
+    gsl_matrix_set_zero(aux->E_default);
+    gsl_matrix_set_zero(aux->LU);
+    gsl_matrix_set_zero(aux->GU);
+
+    for(size_t i = 0; i<N; i++){
+        //A_N block i = A^(i+1)
+        gsl_matrix_view A_N_i = gsl_matrix_submatrix(aux->A_N, i*n, 0, n, n);
+        gsl_matrix_memcpy(&A_N_i.matrix, A_pow[i+1]);
+
+        //B_diag, E_diag block diagonal
+        gsl_matrix_view B_ii = gsl_matrix_submatrix(aux->B_diag, i*n, i*m, n, m);
+        gsl_matrix_memcpy(&B_ii.matrix, s_dyn->B);
+        gsl_matrix_view E_ii = gsl_matrix_submatrix(aux->E_diag, i*n, i*p, n, p);
+        gsl_matrix_memcpy(&E_ii.matrix, s_dyn->E);
+
+        //K_hat block i = K
+        gsl_vector_view K_hat_i = gsl_vector_subvector(aux->K_hat, i*n, n);
+        gsl_vector_memcpy(&K_hat_i.vector, s_dyn->K);
+
+        //A_K block (i,j) = A^(i-j), Ct = A_K.B_diag block (i,j) = A^(i-j)B
+        for(size_t j = 0; j<=i; j++){
+            gsl_matrix_view A_K_ij = gsl_matrix_submatrix(aux->A_K, i*n, j*n, n, n);
+            gsl_matrix_memcpy(&A_K_ij.matrix, A_pow[i-j]);
+            gsl_matrix_view Ct_ij = gsl_matrix_submatrix(aux->Ct, i*n, j*m, n, m);
+            gsl_matrix_memcpy(&Ct_ij.matrix, AB_pow[i-j]);
+        }
+    }
+
+    /*
+     * Block row i of L_default: x(i) = |A^i  A^(i-1)B ... B  0 ... 0|.[x(0)' u(0)' ... u(N-1)']', i = 0,...,N
+     * Block row i of E_default: influence of the disturbance |A^(i-1)E ... E 0 ... 0| (for i = 1,...,N-1)
+     */
+    for(size_t i = 0; i<N+1; i++){
+        gsl_matrix_view L_x_i = gsl_matrix_submatrix(aux->L_default, i*n, 0, n, n);
+        gsl_matrix_memcpy(&L_x_i.matrix, A_pow[i]);
+        for(size_t j = 0; j<i; j++){
+            gsl_matrix_view L_u_ij = gsl_matrix_submatrix(aux->L_default, i*n, n+j*m, n, m);
+            gsl_matrix_memcpy(&L_u_ij.matrix, AB_pow[i-1-j]);
+            if(i < N){
+                gsl_matrix_view E_default_ij = gsl_matrix_submatrix(aux->E_default, i*n, j*p, n, p);
+                gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, A_pow[i-1-j], s_dyn->E, 0.0, &E_default_ij.matrix);
+            }
+        }
+    }
+
+    /*
+     * Input constraints over the horizon: LU.[x(0)' u(0)' ... u(N-1)']' <= MU + GU.[d(0)' ... d(N-1)']'
+     */
+    for(size_t i = 0; i<N; i++){
+        gsl_vector_view MU_i = gsl_vector_subvector(aux->MU, i*u_set_size, u_set_size);
+        gsl_vector_memcpy(&MU_i.vector, s_dyn->U_set->G);
+
+        if(s_dyn->U_set->H->size2 == m){
+            //U_set only constrains u(i)
+            gsl_matrix_view LU_ii = gsl_matrix_submatrix(aux->LU, i*u_set_size, n+i*m, u_set_size, m);
+            gsl_matrix_memcpy(&LU_ii.matrix, s_dyn->U_set->H);
+        } else if(s_dyn->U_set->H->size2 == m+n){
+            //U_set constrains [u(i); x(i)]: HU = |HU_u HU_x|
+            gsl_matrix_view HU_u = gsl_matrix_submatrix(s_dyn->U_set->H, 0, 0, u_set_size, m);
+            gsl_matrix_view HU_x = gsl_matrix_submatrix(s_dyn->U_set->H, 0, m, u_set_size, n);
+
+            //LU block row i = HU_u.(unit block of u(i)) + HU_x.(L_default block row i)
+            gsl_matrix_view LU_i = gsl_matrix_submatrix(aux->LU, i*u_set_size, 0, u_set_size, n+m*N);
+            gsl_matrix_view L_default_i = gsl_matrix_submatrix(aux->L_default, i*n, 0, n, n+m*N);
+            gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, &HU_x.matrix, &L_default_i.matrix, 0.0, &LU_i.matrix);
+            gsl_matrix_view LU_ii = gsl_matrix_submatrix(aux->LU, i*u_set_size, n+i*m, u_set_size, m);
+            gsl_matrix_add(&LU_ii.matrix, &HU_u.matrix);
+
+            //MU block i -= HU_x.(sum_j<i A^(i-1-j)K)
+            gsl_vector *K_sum = gsl_vector_alloc(n);
+            gsl_vector_set_zero(K_sum);
+            for(size_t j = 0; j<i; j++){
+                gsl_blas_dgemv(CblasNoTrans, 1.0, A_pow[i-1-j], s_dyn->K, 1.0, K_sum);
+            }
+            gsl_blas_dgemv(CblasNoTrans, -1.0, &HU_x.matrix, K_sum, 1.0, &MU_i.vector);
+            gsl_vector_free(K_sum);
+
+            //GU block row i = HU_x.(E_default block row i)
+            if(i > 0){
+                gsl_matrix_view GU_i = gsl_matrix_submatrix(aux->GU, i*u_set_size, 0, u_set_size, p*N);
+                gsl_matrix_view E_default_i = gsl_matrix_submatrix(aux->E_default, i*n, 0, n, p*N);
+                gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, &HU_x.matrix, &E_default_i.matrix, 0.0, &GU_i.matrix);
+            }
+        }
+    }
+
+    //Clean up!
+    for(size_t k = 0; k<N+1; k++){
+        gsl_matrix_free(A_pow[k]);
+    }
+    for(size_t k = 0; k<N; k++){
+        gsl_matrix_free(AB_pow[k]);
+    }
+    free(A_pow);
+    free(AB_pow);
+}
+
 /**
  * "Destructor" Deallocates the dynamically allocated memory of the auxiliary matrices
  */
@@ -218,6 +362,8 @@ struct system_dynamics *system_dynamics_alloc (size_t n,
         free(return_dynamics);
         return NULL;
     }
+    return_dynamics->horizon_family = NULL;
+    return_dynamics->robust_pre = NULL;
 
     return return_dynamics;
 }
@@ -226,6 +372,12 @@ struct system_dynamics *system_dynamics_alloc (size_t n,
  * "Destructor" Deallocates the dynamically allocated memory of the system dynamics
  */
 void system_dynamics_free(system_dynamics * system_dynamics){
+    if(system_dynamics->horizon_family != NULL){
+        horizon_family_free(system_dynamics->horizon_family);
+    }
+    if(system_dynamics->robust_pre != NULL){
+        robust_pre_free(system_dynamics->robust_pre);
+    }
     aux_matrices_free(system_dynamics->aux_matrices);
     polytope_free(system_dynamics->U_set);
     polytope_free(system_dynamics->W_set);
@@ -103,6 +103,8 @@ typedef struct cost_function{
  *
  * closed_loop: if 'true' only first input of next N calculated inputs is applied.
  *              All others are discarded.
+ *              if 'false' the calculated inputs are applied one after the other as long as the plan holds
+ *              (open loop, see ACT())
  * conservative: if 'true' x(0)...x(N-1) are in starting polytope, x(N) is in final polytope
  *               if false x(1)...x(N-1) can be anywhere
  *
@@ -133,6 +135,9 @@ typedef struct discrete_dynamics{
  * E disturbance
  * U_set, W_set constraints on states and inputs
  * aux_matrices: auxiliary matrices to fasten calculation of next input
+ * horizon_family: set-up of the control problem for every horizon 1,...,N precomputed at start-up
+ *                 (NULL if not precomputed, everything is then computed on the fly)
+ * robust_pre: robust one step controllable set operator (NULL until first used by the safe mode)
  */
 typedef struct system_dynamics{
 
@@ -143,6 +148,8 @@ typedef struct system_dynamics{
     polytope *W_set;
     polytope *U_set;
     auxiliary_matrices *aux_matrices;
+    struct horizon_family *horizon_family;
+    struct robust_pre *robust_pre;
 
 }system_dynamics;
 
@@ -173,6 +180,19 @@ struct auxiliary_matrices *aux_matrices_alloc(size_t n,
                                               size_t u_set_size,
                                               size_t N);
 
+/**
+ * @brief Computes all auxiliary matrices from the base system (A, B, E, K, U_set) for time horizon N
+ *
+ * Called at load time (system_init) once A, B, E, K and U_set are set, instead of copying precomputed literals.
+ * All matrices are block lower triangular in time, thus the matrices of a shorter horizon N-i are the
+ * leading submatrices of the ones computed for the full horizon N.
+ *
+ * @param s_dyn system dynamics with allocated auxiliary matrices
+ * @param N time horizon
+ */
+void aux_matrices_init(system_dynamics *s_dyn,
+                       size_t N);
+
 /**
  * @brief "Destructor" Deallocates the dynamically allocated memory of the auxiliary matrices
  * @param aux_matrices
@@ -272,7 +292,28 @@ void discrete_dynamics_free(discrete_dynamics *d_dyn);
 
 
 /**
+ * Model of the control problem: dynamics, abstraction and cost function
+ *
+ * Read only once it is set up (system_init(), horizon_family_compute(), compute_safe_mode()), thus one model is
+ * shared by all plants controlled with it. Everything a plant changes (state, plan, workspace) is kept per plant,
+ * see plant_context.
+ */
+typedef struct control_model{
+
+    system_dynamics *s_dyn;
+    discrete_dynamics *d_dyn;
+    cost_function *f_cost;
+
+}control_model;
+
+/**
+ * Arguments of the main computation thread
  *
+ * mailbox, ticket: the result is published under ticket (NULL: not published)
+ * result: published as result of the computation (e.g. the buffer u belongs to)
+ * cancel: checked by the solver (NULL: never cancelled)
+ * r_target: memory for the cost vector of a target cell (NULL: allocated by get_input())
+ * qp_workspace: memory and GUROBI environment of the worker (NULL: allocated by get_input())
  */
 typedef struct control_computation_arguments{
 
@@ -285,6 +326,13 @@ typedef struct control_computation_arguments{
     size_t current_time_horizon;
     polytope **polytope_list_backup;
 
+    struct result_mailbox *mailbox;
+    unsigned long ticket;
+    void *result;
+    struct cancel_token *cancel;
+    gsl_vector *r_target;
+    struct qp_workspace *qp_workspace;
+
 }control_computation_arguments;
 
 typedef struct total_safemode_computation_arguments{
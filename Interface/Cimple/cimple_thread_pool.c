@@ -0,0 +1,255 @@
+//
+// Created by L.Jonathan Feldstein
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "cimple_thread_pool.h"
+
+/**
+ * Seconds passed since start
+ */
+static double seconds_since(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec)*1e-9;
+}
+
+/**
+ * Take a task of the batch: first from the tail of the own queue, else steal from the head of another queue.
+ * Returns 0 if all queues are empty.
+ */
+static int take_task(thread_pool *pool,
+                     size_t id,
+                     size_t *index)
+{
+    thread_pool_queue *own = &pool->queues[id];
+    pthread_mutex_lock(&own->lock);
+    if(own->head < own->tail){
+        own->tail--;
+        *index = own->tasks[own->tail];
+        pthread_mutex_unlock(&own->lock);
+        return 1;
+    }
+    pthread_mutex_unlock(&own->lock);
+
+    for(size_t k = 1; k < pool->threads_count; k++){
+        thread_pool_queue *victim = &pool->queues[(id+k)%pool->threads_count];
+        pthread_mutex_lock(&victim->lock);
+        if(victim->head < victim->tail){
+            *index = victim->tasks[victim->head];
+            victim->head++;
+            pthread_mutex_unlock(&victim->lock);
+            return 1;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return 0;
+}
+
+/**
+ * Worker: waits for a batch, works through its own queue, then steals until every queue is empty
+ */
+static void *thread_pool_work(void *arg)
+{
+    thread_pool_worker *worker = (thread_pool_worker *)arg;
+    thread_pool *pool = worker->pool;
+    unsigned long seen_batch = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while(1){
+        while(!pool->shutdown && pool->batch == seen_batch){
+            pthread_cond_wait(&pool->batch_started, &pool->lock);
+        }
+        if(pool->shutdown){
+            break;
+        }
+        seen_batch = pool->batch;
+        pthread_mutex_unlock(&pool->lock);
+
+        size_t index;
+        while(take_task(pool, worker->id, &index)){
+            pool->task(index, pool->task_context);
+
+            pthread_mutex_lock(&pool->lock);
+            pool->completed++;
+            if(pool->progress != NULL){
+                double elapsed = seconds_since(&pool->start);
+                double eta = elapsed/(double)pool->completed*(double)(pool->tasks_count-pool->completed);
+                pool->progress(pool->completed, pool->tasks_count, elapsed, eta, pool->progress_context);
+            }
+            pthread_mutex_unlock(&pool->lock);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        pool->workers_active--;
+        if(pool->workers_active == 0){
+            pthread_cond_signal(&pool->batch_finished);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+/**
+ * "Constructor" Dynamically allocates the pool and starts its workers
+ */
+struct thread_pool *thread_pool_alloc(size_t threads_count)
+{
+    if(threads_count == 0){
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads_count = (online > 0) ? (size_t)online : 1;
+    }
+
+    struct thread_pool *return_pool = malloc (sizeof (struct thread_pool));
+    if (return_pool == NULL){
+        return NULL;
+    }
+
+    return_pool->threads = malloc(sizeof(pthread_t)*threads_count);
+    if (return_pool->threads == NULL) {
+        free (return_pool);
+        return NULL;
+    }
+
+    return_pool->workers = malloc(sizeof(thread_pool_worker)*threads_count);
+    if (return_pool->workers == NULL) {
+        free (return_pool->threads);
+        free (return_pool);
+        return NULL;
+    }
+
+    return_pool->queues = malloc(sizeof(thread_pool_queue)*threads_count);
+    if (return_pool->queues == NULL) {
+        free (return_pool->workers);
+        free (return_pool->threads);
+        free (return_pool);
+        return NULL;
+    }
+
+    return_pool->threads_count = threads_count;
+    return_pool->batch = 0;
+    return_pool->workers_active = 0;
+    return_pool->shutdown = 0;
+    return_pool->task = NULL;
+    return_pool->task_context = NULL;
+    return_pool->tasks_count = 0;
+    return_pool->completed = 0;
+    return_pool->progress = NULL;
+    return_pool->progress_context = NULL;
+    pthread_mutex_init(&return_pool->lock, NULL);
+    pthread_cond_init(&return_pool->batch_started, NULL);
+    pthread_cond_init(&return_pool->batch_finished, NULL);
+
+    for(size_t i = 0; i < threads_count; i++){
+        pthread_mutex_init(&return_pool->queues[i].lock, NULL);
+        return_pool->queues[i].tasks = NULL;
+        return_pool->queues[i].head = 0;
+        return_pool->queues[i].tail = 0;
+    }
+    for(size_t i = 0; i < threads_count; i++){
+        return_pool->workers[i].pool = return_pool;
+        return_pool->workers[i].id = i;
+        pthread_create(&return_pool->threads[i], NULL, thread_pool_work, &return_pool->workers[i]);
+    }
+
+    return return_pool;
+}
+
+/**
+ * "Destructor" Stops the workers and deallocates the pool
+ */
+void thread_pool_free(thread_pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->batch_started);
+    pthread_mutex_unlock(&pool->lock);
+
+    for(size_t i = 0; i < pool->threads_count; i++){
+        pthread_join(pool->threads[i], NULL);
+    }
+    for(size_t i = 0; i < pool->threads_count; i++){
+        pthread_mutex_destroy(&pool->queues[i].lock);
+    }
+    pthread_cond_destroy(&pool->batch_finished);
+    pthread_cond_destroy(&pool->batch_started);
+    pthread_mutex_destroy(&pool->lock);
+
+    free(pool->queues);
+    free(pool->workers);
+    free(pool->threads);
+    free(pool);
+}
+
+/**
+ * Run tasks 0,...,tasks_count-1 on the pool and block until all of them are finished
+ */
+void thread_pool_run(thread_pool *pool,
+                     thread_pool_task task,
+                     void *context,
+                     size_t tasks_count,
+                     thread_pool_progress progress,
+                     void *progress_context)
+{
+    if(tasks_count == 0){
+        return;
+    }
+
+    //Split tasks in contiguous blocks onto the queues (neighbouring cells tend to have similar cost)
+    size_t *tasks = malloc(sizeof(size_t)*tasks_count);
+    for(size_t i = 0; i < tasks_count; i++){
+        tasks[i] = i;
+    }
+    for(size_t i = 0; i < pool->threads_count; i++){
+        pool->queues[i].tasks = tasks;
+        pool->queues[i].head = i*tasks_count/pool->threads_count;
+        pool->queues[i].tail = (i+1)*tasks_count/pool->threads_count;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->task_context = context;
+    pool->tasks_count = tasks_count;
+    pool->completed = 0;
+    pool->progress = progress;
+    pool->progress_context = progress_context;
+    clock_gettime(CLOCK_MONOTONIC, &pool->start);
+    pool->workers_active = pool->threads_count;
+    pool->batch++;
+    pthread_cond_broadcast(&pool->batch_started);
+
+    while(pool->workers_active > 0){
+        pthread_cond_wait(&pool->batch_finished, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    //Clean up!
+    for(size_t i = 0; i < pool->threads_count; i++){
+        pool->queues[i].tasks = NULL;
+    }
+    free(tasks);
+}
+
+/**
+ * Progress report printing the completed tasks and the estimated remaining time to stdout
+ */
+void thread_pool_print_progress(size_t completed,
+                                size_t total,
+                                double elapsed,
+                                double eta,
+                                void *progress_context)
+{
+    char *name = (char *)progress_context;
+    printf("\r%s: %d/%d done (%.1fs elapsed, ~%.1fs remaining)", (name != NULL) ? name : "Progress",
+           (int)completed, (int)total, elapsed, eta);
+    if(completed == total){
+        printf("\n");
+    }
+    fflush(stdout);
+}
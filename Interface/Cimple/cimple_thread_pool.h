@@ -0,0 +1,139 @@
+//
+// Created by L.Jonathan Feldstein
+//
+
+#ifndef CIMPLE_CIMPLE_THREAD_POOL_H
+#define CIMPLE_CIMPLE_THREAD_POOL_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <time.h>
+
+/**
+ * Work function of one task of a batch.
+ *
+ * Every task is identified by its index in {0,...,tasks_count-1} and has to write its result only into the slot
+ * "index" of the result array(s) in context: the placement of the results is thus deterministic and does not depend
+ * on which worker ran the task or in which order the tasks finished.
+ */
+typedef void (*thread_pool_task)(size_t index,
+                                 void *context);
+
+/**
+ * Progress report after every finished task:
+ *
+ *      completed: tasks finished so far
+ *      total: tasks in the batch
+ *      elapsed: seconds since the batch was started
+ *      eta: estimated seconds until the batch is finished (average time per task so far)
+ *
+ * Reports are serialized and completed is strictly increasing.
+ */
+typedef void (*thread_pool_progress)(size_t completed,
+                                     size_t total,
+                                     double elapsed,
+                                     double eta,
+                                     void *progress_context);
+
+/**
+ * Task queue of one worker:
+ * the owner takes tasks from the tail (last assigned first), other workers steal from the head.
+ */
+typedef struct thread_pool_queue{
+
+    pthread_mutex_t lock;
+    size_t *tasks;
+    size_t head;
+    size_t tail;
+
+}thread_pool_queue;
+
+/**
+ * Arguments of one worker thread
+ */
+typedef struct thread_pool_worker{
+
+    struct thread_pool *pool;
+    size_t id;
+
+}thread_pool_worker;
+
+/**
+ * Work-stealing pool of threads_count workers
+ *
+ * The tasks of a batch are split in contiguous blocks onto the queues of the workers.
+ * Once a worker runs out of tasks it steals from the other queues, thus cells that take very long
+ * (e.g. many iterations until the invariant set is found) do not leave the other workers idle.
+ *
+ * batch: number of the current batch (workers wait until it changes)
+ * workers_active: workers still working on the current batch
+ */
+typedef struct thread_pool{
+
+    size_t threads_count;
+    pthread_t *threads;
+    thread_pool_worker *workers;
+    thread_pool_queue *queues;
+
+    pthread_mutex_t lock;
+    pthread_cond_t batch_started;
+    pthread_cond_t batch_finished;
+    unsigned long batch;
+    size_t workers_active;
+    int shutdown;
+
+    thread_pool_task task;
+    void *task_context;
+    size_t tasks_count;
+    size_t completed;
+
+    thread_pool_progress progress;
+    void *progress_context;
+    struct timespec start;
+
+}thread_pool;
+
+/**
+ * @brief "Constructor" Dynamically allocates the pool and starts its workers
+ * @param threads_count number of workers (0: one per online processor)
+ * @return
+ */
+struct thread_pool *thread_pool_alloc(size_t threads_count);
+
+/**
+ * @brief "Destructor" Stops the workers and deallocates the pool
+ * @param pool
+ */
+void thread_pool_free(thread_pool *pool);
+
+/**
+ * @brief Run tasks 0,...,tasks_count-1 on the pool and block until all of them are finished
+ * @param pool
+ * @param task work function
+ * @param context passed to every task (contains the result slots)
+ * @param tasks_count
+ * @param progress progress report after every finished task (may be NULL)
+ * @param progress_context passed to progress
+ */
+void thread_pool_run(thread_pool *pool,
+                     thread_pool_task task,
+                     void *context,
+                     size_t tasks_count,
+                     thread_pool_progress progress,
+                     void *progress_context);
+
+/**
+ * @brief Progress report printing the completed tasks and the estimated remaining time to stdout
+ * @param completed
+ * @param total
+ * @param elapsed
+ * @param eta
+ * @param progress_context name of the computation (char *)
+ */
+void thread_pool_print_progress(size_t completed,
+                                size_t total,
+                                double elapsed,
+                                double eta,
+                                void *progress_context);
+
+#endif //CIMPLE_CIMPLE_THREAD_POOL_H
@@ -0,0 +1,410 @@
+//
+// Created by L.Jonathan Feldstein
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include "cimple_trace.h"
+
+#define TRACE_DRAIN_INTERVAL_NS 10000000L
+
+/**
+ * Ring of one thread: head is written by the recording thread only, tail by the drainer only
+ * retired: its thread exited, the drainer frees it once it is empty
+ */
+typedef struct trace_ring{
+
+    trace_event events[TRACE_RING_CAPACITY];
+    size_t head;
+    size_t tail;
+    size_t dropped;
+    uint16_t thread;
+    int retired;
+    struct trace_ring *next;
+
+}trace_ring;
+
+/**
+ * Trace of the process: rings of all threads that recorded an event and the drainer
+ *
+ * The list of rings is only accessed under the lock (registration, release at thread exit, drainer), recording
+ * itself never takes it. dropped_released: events dropped by rings that were freed already.
+ * running: the drainer keeps draining, draining: the drainer thread exists (until trace_close() joined it)
+ */
+static struct{
+
+    pthread_mutex_t lock;
+    trace_ring *rings;
+    uint16_t threads;
+    size_t dropped_released;
+
+    FILE *file;
+    int active;
+    int running;
+    int draining;
+    pthread_t drainer;
+
+}trace = {PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, NULL, 0, 0, 0};
+
+/**
+ * Events of one ring the drainer writes outside the lock: [tail, head) at the time of the snapshot
+ */
+typedef struct trace_pending{
+
+    trace_ring *ring;
+    size_t tail;
+    size_t head;
+
+}trace_pending;
+
+/**
+ * Snapshot of the drainer, grows with the number of rings
+ */
+typedef struct trace_snapshot{
+
+    trace_pending *pending;
+    size_t capacity;
+
+}trace_snapshot;
+
+static pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_key;
+static __thread trace_ring *thread_ring = NULL;
+static __thread uint32_t thread_step = 0;
+
+/**
+ * Remove the ring from the list and free it (under the lock)
+ */
+static void trace_ring_free(trace_ring *ring)
+{
+    for(trace_ring **link = &trace.rings; *link != NULL; link = &(*link)->next){
+        if(*link == ring){
+            *link = ring->next;
+            break;
+        }
+    }
+    trace.dropped_released += ring->dropped;
+    free(ring);
+}
+
+/**
+ * Thread exit: an empty ring is freed at once, otherwise the drainer frees it after writing its events
+ *
+ * A ring the drainer is writing is never empty (its tail only moves under the lock after writing).
+ */
+static void trace_ring_release(void *arg)
+{
+    trace_ring *ring = (trace_ring *)arg;
+    pthread_mutex_lock(&trace.lock);
+    if(!trace.draining || ring->tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)){
+        trace_ring_free(ring);
+    } else{
+        ring->retired = 1;
+    }
+    pthread_mutex_unlock(&trace.lock);
+}
+
+/**
+ * Key whose destructor releases the ring of an exiting thread
+ */
+static void trace_key_create(void)
+{
+    pthread_key_create(&trace_key, trace_ring_release);
+}
+
+/**
+ * Ring of the calling thread, allocated and registered on its first event
+ */
+static trace_ring *trace_thread_ring(void)
+{
+    if(thread_ring != NULL){
+        return thread_ring;
+    }
+
+    trace_ring *ring = malloc(sizeof(trace_ring));
+    if(ring == NULL){
+        return NULL;
+    }
+    ring->head = 0;
+    ring->tail = 0;
+    ring->dropped = 0;
+    ring->retired = 0;
+
+    pthread_once(&trace_key_once, trace_key_create);
+    pthread_mutex_lock(&trace.lock);
+    ring->thread = trace.threads++;
+    ring->next = trace.rings;
+    trace.rings = ring;
+    pthread_mutex_unlock(&trace.lock);
+    pthread_setspecific(trace_key, ring);
+
+    thread_ring = ring;
+    return ring;
+}
+
+/**
+ * Write all events recorded so far and free the rings of exited threads (drainer only)
+ *
+ * The lock is only held to take the snapshot and to publish the new tails, so registering a thread never waits for
+ * the file. The slots of the snapshot are not overwritten meanwhile (their tail did not move yet).
+ */
+static void trace_drain(trace_snapshot *snapshot)
+{
+    //Snapshot of the rings with pending events (rings beyond a failed allocation wait for the next drain)
+    pthread_mutex_lock(&trace.lock);
+    if(snapshot->capacity < trace.threads){
+        trace_pending *pending = realloc(snapshot->pending, sizeof(trace_pending)*trace.threads);
+        if(pending != NULL){
+            snapshot->pending = pending;
+            snapshot->capacity = trace.threads;
+        }
+    }
+    size_t pending_count = 0;
+    for(trace_ring *ring = trace.rings; ring != NULL && pending_count < snapshot->capacity; ring = ring->next){
+        size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if(ring->tail != head){
+            trace_pending *pending = &snapshot->pending[pending_count++];
+            pending->ring = ring;
+            pending->tail = ring->tail;
+            pending->head = head;
+        }
+    }
+    pthread_mutex_unlock(&trace.lock);
+
+    for(size_t i = 0; i < pending_count; i++){
+        trace_pending *pending = &snapshot->pending[i];
+        size_t tail = pending->tail;
+        while(tail != pending->head){
+            //Contiguous part up to the end of the array
+            size_t first = tail & (TRACE_RING_CAPACITY-1);
+            size_t count = pending->head-tail;
+            if(count > TRACE_RING_CAPACITY-first){
+                count = TRACE_RING_CAPACITY-first;
+            }
+            fwrite(&pending->ring->events[first], sizeof(trace_event), count, trace.file);
+            tail += count;
+        }
+    }
+
+    //Publish the tails, free the rings of exited threads that are empty now
+    pthread_mutex_lock(&trace.lock);
+    for(size_t i = 0; i < pending_count; i++){
+        __atomic_store_n(&snapshot->pending[i].ring->tail, snapshot->pending[i].head, __ATOMIC_RELEASE);
+    }
+    trace_ring **link = &trace.rings;
+    while(*link != NULL){
+        trace_ring *ring = *link;
+        if(ring->retired && ring->tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)){
+            *link = ring->next;
+            trace.dropped_released += ring->dropped;
+            free(ring);
+        } else{
+            link = &ring->next;
+        }
+    }
+    pthread_mutex_unlock(&trace.lock);
+}
+
+/**
+ * Drainer: empties the rings periodically until trace_close()
+ */
+static void *trace_drainer(void *arg)
+{
+    (void)arg;
+    trace_snapshot snapshot = {NULL, 0};
+    struct timespec interval = {0, TRACE_DRAIN_INTERVAL_NS};
+    while(__atomic_load_n(&trace.running, __ATOMIC_ACQUIRE)){
+        trace_drain(&snapshot);
+        nanosleep(&interval, NULL);
+    }
+    trace_drain(&snapshot);
+    fflush(trace.file);
+
+    //Clean up!
+    free(snapshot.pending);
+    return NULL;
+}
+
+/**
+ * Start the drainer writing all events to a file
+ */
+int trace_open(const char *path)
+{
+    if(trace.active){
+        return 0;
+    }
+
+    //Not stdout: the control loop prints its status there, the binary stream could not be decoded any more
+    if(path == NULL){
+        fprintf(stderr, "\nThe trace needs a file, the control loop is not traced.\n");
+        return -1;
+    }
+    trace.file = fopen(path, "wb");
+    if(trace.file == NULL){
+        fprintf(stderr, "\nCould not open the trace file %s, the control loop is not traced.\n", path);
+        return -1;
+    }
+
+    uint32_t header[2] = {TRACE_FILE_VERSION, sizeof(trace_event)};
+    fwrite("CTRC", 1, 4, trace.file);
+    fwrite(header, sizeof(uint32_t), 2, trace.file);
+
+    pthread_mutex_lock(&trace.lock);
+    trace.running = 1;
+    trace.draining = 1;
+    pthread_mutex_unlock(&trace.lock);
+    if(pthread_create(&trace.drainer, NULL, trace_drainer, NULL) != 0){
+        pthread_mutex_lock(&trace.lock);
+        trace.running = 0;
+        trace.draining = 0;
+        pthread_mutex_unlock(&trace.lock);
+        fclose(trace.file);
+        trace.file = NULL;
+        return -1;
+    }
+    __atomic_store_n(&trace.active, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * Stop the drainer after writing all remaining events and close the file
+ */
+void trace_close(void)
+{
+    if(!trace.active){
+        return;
+    }
+    __atomic_store_n(&trace.active, 0, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&trace.lock);
+    __atomic_store_n(&trace.running, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&trace.lock);
+    pthread_join(trace.drainer, NULL);
+    pthread_mutex_lock(&trace.lock);
+    trace.draining = 0;
+    pthread_mutex_unlock(&trace.lock);
+
+    size_t dropped = trace_dropped();
+    if(dropped > 0){
+        fprintf(stderr, "\n%d trace events dropped (rings full)\n", (int)dropped);
+    }
+
+    //Rings of threads that exited meanwhile and the ring of the calling thread (a thread that is still running keeps
+    //its ring, it is freed when the thread exits)
+    pthread_mutex_lock(&trace.lock);
+    trace_ring **link = &trace.rings;
+    while(*link != NULL){
+        trace_ring *ring = *link;
+        if(ring->retired || ring == thread_ring){
+            *link = ring->next;
+            trace.dropped_released += ring->dropped;
+            free(ring);
+        } else{
+            link = &ring->next;
+        }
+    }
+    pthread_mutex_unlock(&trace.lock);
+    if(thread_ring != NULL){
+        pthread_setspecific(trace_key, NULL);
+        thread_ring = NULL;
+    }
+    fclose(trace.file);
+    trace.file = NULL;
+}
+
+/**
+ * Time step the calling thread works on (registers its ring, so the first event allocates nothing)
+ */
+void trace_set_step(uint32_t step)
+{
+    thread_step = step;
+    if(thread_ring == NULL && __atomic_load_n(&trace.active, __ATOMIC_ACQUIRE)){
+        trace_thread_ring();
+    }
+}
+
+/**
+ * Record one event (recording thread only), values beyond TRACE_EVENT_VALUES are ignored
+ */
+static void trace_push(uint16_t type,
+                       int32_t cell,
+                       size_t offset,
+                       const double *values,
+                       size_t count,
+                       size_t stride)
+{
+    trace_ring *ring = trace_thread_ring();
+    if(ring == NULL){
+        return;
+    }
+
+    size_t head = ring->head;
+    if(head-__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == TRACE_RING_CAPACITY){
+        __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    trace_event *event = &ring->events[head & (TRACE_RING_CAPACITY-1)];
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    event->time = (uint64_t)now.tv_sec*1000000000u+(uint64_t)now.tv_nsec;
+    event->type = type;
+    event->thread = ring->thread;
+    event->offset = (uint16_t)offset;
+    event->count = (uint16_t)((count > TRACE_EVENT_VALUES) ? TRACE_EVENT_VALUES : count);
+    event->step = thread_step;
+    event->cell = cell;
+    for(size_t i = 0; i < event->count; i++){
+        event->values[i] = values[i*stride];
+    }
+
+    //Publish: the drainer reads the event only after it sees the new head
+    __atomic_store_n(&ring->head, head+1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Record an event with up to TRACE_EVENT_VALUES values
+ */
+void trace_record(uint16_t type,
+                  int32_t cell,
+                  const double *values,
+                  size_t count)
+{
+    if(!__atomic_load_n(&trace.active, __ATOMIC_ACQUIRE)){
+        return;
+    }
+    trace_push(type, cell, 0, values, count, 1);
+}
+
+/**
+ * Record a vector, split into several events if it is long
+ */
+void trace_vector(uint16_t type,
+                  const double *values,
+                  size_t count,
+                  size_t stride)
+{
+    if(!__atomic_load_n(&trace.active, __ATOMIC_ACQUIRE)){
+        return;
+    }
+    for(size_t offset = 0; offset < count; offset += TRACE_EVENT_VALUES){
+        trace_push(type, -1, offset, values+offset*stride, count-offset, stride);
+    }
+}
+
+/**
+ * Events dropped so far because a ring was full
+ */
+size_t trace_dropped(void)
+{
+    pthread_mutex_lock(&trace.lock);
+    size_t dropped = trace.dropped_released;
+    for(trace_ring *ring = trace.rings; ring != NULL; ring = ring->next){
+        dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&trace.lock);
+    return dropped;
+}
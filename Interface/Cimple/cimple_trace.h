@@ -0,0 +1,189 @@
+//
+// Created by L.Jonathan Feldstein
+//
+
+#ifndef CIMPLE_CIMPLE_TRACE_H
+#define CIMPLE_CIMPLE_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Binary trace of the control loop
+ *
+ * Every thread records fixed size events into its own lock-free ring (single producer: the thread, single consumer:
+ * the drainer), a background drainer writes them to a file. Recording never blocks and never calls printf, events
+ * are dropped (and counted) if a ring is full.
+ *
+ * File layout (native byte order): "CTRC" | version (uint32) | sizeof(trace_event) (uint32) | events
+ * Use tools/cimple_trace_decode to turn it into text.
+ */
+
+#define TRACE_FILE "cimple_trace.bin"
+#define TRACE_FILE_VERSION 1
+
+/**
+ * Events per ring (power of two)
+ */
+#define TRACE_RING_CAPACITY 4096
+
+/**
+ * Values of one event, longer vectors are split into several events (see offset)
+ */
+#define TRACE_EVENT_VALUES 8
+
+/**
+ * Compile-time levels: calls above CIMPLE_TRACE_LEVEL are removed entirely (arguments are not evaluated)
+ *
+ *      TRACE_LEVEL_WARNING: fallbacks of the control loop
+ *      TRACE_LEVEL_INFO: time steps, transitions, costs, timings, invariant set iterations of the safe mode
+ *      TRACE_LEVEL_DEBUG: states and inputs
+ */
+#define TRACE_LEVEL_NONE 0
+#define TRACE_LEVEL_WARNING 1
+#define TRACE_LEVEL_INFO 2
+#define TRACE_LEVEL_DEBUG 3
+
+#ifndef CIMPLE_TRACE_LEVEL
+#define CIMPLE_TRACE_LEVEL TRACE_LEVEL_DEBUG
+#endif
+
+/**
+ * Types of events and their values
+ */
+enum trace_event_type{
+
+    TRACE_STEP,         // time step started, cell: abstract state, values: remaining time horizon
+    TRACE_STATE,        // values: state x
+    TRACE_INPUT,        // values: applied input u
+    TRACE_QP,           // values: GUROBI status of the qp, cost
+    TRACE_QP_INPUTS,    // values: optimal inputs of the qp
+    TRACE_PLAN,         // main computation finished, values: status (see result_mailbox_status), cost
+    TRACE_PLAN_REUSED,  // previous plan applied without a new solve, values: age of the plan
+    TRACE_TIMING,       // values: release latency, duration of the step (seconds), overrun (0/1)
+    TRACE_TRANSITION,   // cell: new abstract state, values: old abstract state
+    TRACE_FALLBACK,     // values: reason (see trace_fallback)
+    TRACE_INVARIANT_SET,// iteration of an invariant set (see invariant_set_iteration), cell: abstract state,
+                        // values: iteration, alpha, rows, rows added, rows dropped, seconds, gap
+
+    TRACE_EVENT_TYPES_COUNT
+
+};
+
+/**
+ * Reasons of a TRACE_FALLBACK
+ */
+enum trace_fallback{
+
+    TRACE_FALLBACK_PLAN_INVALID,    // plan of the predicted state does not hold for the measured state
+    TRACE_FALLBACK_SAFE_MODE,       // safe mode input applied
+    TRACE_FALLBACK_EARLIER_INPUT    // input of an earlier plan applied
+
+};
+
+/**
+ * One event (fixed size)
+ *
+ * time: nanoseconds on CLOCK_MONOTONIC
+ * thread: number of the recording thread (in order of their first event)
+ * step: time step the thread works on (see trace_set_step())
+ * offset: index of values[0] in the recorded vector, count: valid values
+ */
+typedef struct trace_event{
+
+    uint64_t time;
+    uint16_t type;
+    uint16_t thread;
+    uint16_t offset;
+    uint16_t count;
+    uint32_t step;
+    int32_t cell;
+    double values[TRACE_EVENT_VALUES];
+
+}trace_event;
+
+/**
+ * @brief Start the drainer writing all events to a file
+ *
+ * stdout is not supported: the control loop prints its status there.
+ *
+ * @param path trace file
+ * @return 0 on success, -1 otherwise, also if path is NULL (nothing is recorded then)
+ */
+int trace_open(const char *path);
+
+/**
+ * @brief Stop the drainer after writing all remaining events and close the file
+ */
+void trace_close(void);
+
+/**
+ * @brief Time step the calling thread works on (recorded with all its events)
+ * @param step
+ */
+void trace_set_step(uint32_t step);
+
+/**
+ * @brief Record an event with up to TRACE_EVENT_VALUES values
+ * @param type see trace_event_type
+ * @param cell
+ * @param values
+ * @param count
+ */
+void trace_record(uint16_t type,
+                  int32_t cell,
+                  const double *values,
+                  size_t count);
+
+/**
+ * @brief Record a vector (e.g. gsl_vector data, size and stride), split into several events if it is long
+ * @param type
+ * @param values
+ * @param count
+ * @param stride
+ */
+void trace_vector(uint16_t type,
+                  const double *values,
+                  size_t count,
+                  size_t stride);
+
+/**
+ * @brief Events dropped so far because a ring was full
+ * @return
+ */
+size_t trace_dropped(void);
+
+/**
+ * Recording macros of the levels, the values are doubles (at most TRACE_EVENT_VALUES):
+ *
+ *      TRACE_WARNING(TRACE_FALLBACK, -1, TRACE_FALLBACK_SAFE_MODE);
+ *      TRACE_INFO(TRACE_TRANSITION, new_cell, old_cell);
+ *      TRACE_DEBUG_VECTOR(TRACE_STATE, x);    (x: gsl_vector)
+ */
+#define TRACE_VALUES(type, cell, ...) \
+    do{ \
+        const double trace_values[] = {__VA_ARGS__}; \
+        trace_record((type), (cell), trace_values, sizeof(trace_values)/sizeof(double)); \
+    }while(0)
+
+#if CIMPLE_TRACE_LEVEL >= TRACE_LEVEL_WARNING
+#define TRACE_WARNING(type, cell, ...) TRACE_VALUES(type, cell, __VA_ARGS__)
+#else
+#define TRACE_WARNING(type, cell, ...) do{ }while(0)
+#endif
+
+#if CIMPLE_TRACE_LEVEL >= TRACE_LEVEL_INFO
+#define TRACE_INFO(type, cell, ...) TRACE_VALUES(type, cell, __VA_ARGS__)
+#else
+#define TRACE_INFO(type, cell, ...) do{ }while(0)
+#endif
+
+#if CIMPLE_TRACE_LEVEL >= TRACE_LEVEL_DEBUG
+#define TRACE_DEBUG_VECTOR(type, vector) trace_vector((type), (vector)->data, (vector)->size, (vector)->stride)
+#define TRACE_DEBUG_ARRAY(type, values, count) trace_vector((type), (values), (count), 1)
+#else
+#define TRACE_DEBUG_VECTOR(type, vector) do{ }while(0)
+#define TRACE_DEBUG_ARRAY(type, values, count) do{ }while(0)
+#endif
+
+#endif //CIMPLE_CIMPLE_TRACE_H
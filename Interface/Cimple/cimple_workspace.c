@@ -0,0 +1,99 @@
+//
+// Created by L.Jonathan Feldstein
+//
+
+#include "cimple_workspace.h"
+
+/**
+ * "Constructor" Dynamically allocates the workspace of the control loop
+ */
+struct control_workspace *control_workspace_alloc(size_t n,
+                                                  size_t m,
+                                                  size_t p)
+{
+    struct control_workspace *return_workspace = malloc (sizeof (struct control_workspace));
+    if (return_workspace == NULL){
+        return NULL;
+    }
+
+    return_workspace->n = n;
+    return_workspace->m = m;
+    return_workspace->p = p;
+
+    return_workspace->x_next = gsl_vector_alloc(n);
+    return_workspace->x_predicted = gsl_vector_alloc(n);
+    return_workspace->x_planned = gsl_vector_alloc(n);
+    return_workspace->w = gsl_vector_alloc(p);
+    return_workspace->u_safemode = gsl_vector_alloc(m);
+    if (return_workspace->x_next == NULL || return_workspace->x_predicted == NULL
+        || return_workspace->x_planned == NULL || return_workspace->w == NULL || return_workspace->u_safemode == NULL){
+        control_workspace_free(return_workspace);
+        return NULL;
+    }
+
+    return return_workspace;
+}
+
+/**
+ * "Destructor" Deallocates the workspace
+ */
+void control_workspace_free(control_workspace *workspace)
+{
+    if(workspace->x_next != NULL){
+        gsl_vector_free(workspace->x_next);
+    }
+    if(workspace->x_predicted != NULL){
+        gsl_vector_free(workspace->x_predicted);
+    }
+    if(workspace->x_planned != NULL){
+        gsl_vector_free(workspace->x_planned);
+    }
+    if(workspace->w != NULL){
+        gsl_vector_free(workspace->w);
+    }
+    if(workspace->u_safemode != NULL){
+        gsl_vector_free(workspace->u_safemode);
+    }
+    free(workspace);
+}
+
+#ifdef CIMPLE_DEBUG_ALLOC
+
+/**
+ * Interposed allocator (glibc): every allocation of the process is counted for the calling thread
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *pointer, size_t size);
+
+static __thread size_t thread_allocations = 0;
+
+void *malloc(size_t size)
+{
+    thread_allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count,
+             size_t size)
+{
+    thread_allocations++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer,
+              size_t size)
+{
+    thread_allocations++;
+    return __libc_realloc(pointer, size);
+}
+
+/**
+ * Number of allocations of the calling thread so far
+ */
+size_t alloc_counter_thread(void)
+{
+    return thread_allocations;
+}
+
+#endif
@@ -0,0 +1,91 @@
+//
+// Created by L.Jonathan Feldstein
+//
+
+#ifndef CIMPLE_CIMPLE_WORKSPACE_H
+#define CIMPLE_CIMPLE_WORKSPACE_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <gsl/gsl_vector.h>
+
+/**
+ * Memory of one time step of the control loop, allocated once per ACT() from the sizes of the system:
+ *
+ *      n: state dimension, m: input dimension, p: disturbance dimension
+ *
+ * (Membership tests of the state work row by row and need no memory, see polytope_check_state().)
+ *
+ * x_next: successor of the state (check_backup(), apply_control())
+ * x_predicted: nominal successor the next plan is computed for
+ * x_planned: nominal state of the applied plan (open loop execution)
+ * w: disturbance of the time step
+ * u_safemode: safe mode input
+ */
+typedef struct control_workspace{
+
+    size_t n;
+    size_t m;
+    size_t p;
+
+    gsl_vector *x_next;
+    gsl_vector *x_predicted;
+    gsl_vector *x_planned;
+    gsl_vector *w;
+    gsl_vector *u_safemode;
+
+}control_workspace;
+
+/**
+ * @brief "Constructor" Dynamically allocates the workspace of the control loop
+ * @param n
+ * @param m
+ * @param p
+ * @return
+ */
+struct control_workspace *control_workspace_alloc(size_t n,
+                                                  size_t m,
+                                                  size_t p);
+
+/**
+ * @brief "Destructor" Deallocates the workspace
+ * @param workspace
+ */
+void control_workspace_free(control_workspace *workspace);
+
+/**
+ * Debug allocation counter (build with -DCIMPLE_DEBUG_ALLOC, CMake option CIMPLE_DEBUG_ALLOC)
+ *
+ * malloc, calloc and realloc of the whole process (including GSL, cdd and GUROBI) are interposed and counted per
+ * thread. ALLOC_COUNTER_ASSERT_NONE() stops the program if the calling thread allocated since ALLOC_COUNTER_START().
+ * Only the actuation thread of ACT() is checked: the main computation reuses its qp_workspace, but cdd and the
+ * GUROBI models allocate internally.
+ * Without CIMPLE_DEBUG_ALLOC both macros are empty.
+ */
+#ifdef CIMPLE_DEBUG_ALLOC
+
+/**
+ * @brief Number of allocations of the calling thread so far
+ * @return
+ */
+size_t alloc_counter_thread(void);
+
+#define ALLOC_COUNTER_START(counter) size_t counter = alloc_counter_thread()
+#define ALLOC_COUNTER_ASSERT_NONE(counter, where) \
+    do{ \
+        size_t alloc_counter_new = alloc_counter_thread()-(counter); \
+        if(alloc_counter_new != 0){ \
+            fprintf(stderr, "\n%s: %d heap allocations in the steady state\n", (where), (int)alloc_counter_new); \
+            exit(EXIT_FAILURE); \
+        } \
+    }while(0)
+
+#else
+
+#define ALLOC_COUNTER_START(counter)
+#define ALLOC_COUNTER_ASSERT_NONE(counter, where) do{ }while(0)
+
+#endif
+
+#endif //CIMPLE_CIMPLE_WORKSPACE_H
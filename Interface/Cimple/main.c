@@ -1,10 +1,101 @@
 #include "cimple_c_from_py.h"
 #include "setoper.h"
 #include "cimple_safe_mode.h"
+#include "cimple_safe_mode_storage.h"
+#include "cimple_rt_executor.h"
+#include "cimple_trace.h"
+#include "cimple_controller_service.h"
+#include <stdlib.h>
 #include <cdd.h>
 #include <gsl/gsl_matrix.h>
 
-int main(){
+/**
+ * Plants controlled by one controller service (context of the periods of plants_period())
+ */
+typedef struct plants_loop{
+
+    controller_service *service;
+    control_model *model;
+    plant_context **plants;
+    size_t plants_count;
+    double sec;
+
+}plants_loop;
+
+/**
+ * One time step of all plants: submit their computations, collect them by the deadline and apply the inputs
+ */
+static void plants_period(size_t period,
+                          void *context)
+{
+    plants_loop *loop = (plants_loop *)context;
+    trace_set_step((uint32_t)period);
+
+    //Fails while an abandoned computation of the plant still runs, its collection then reports the miss at once
+    for(size_t k = 0; k < loop->plants_count; k++){
+        controller_service_submit(loop->service, loop->plants[k], 0.8*loop->sec);
+    }
+    for(size_t k = 0; k < loop->plants_count; k++){
+        controller_service_collect(loop->service, loop->plants[k]);
+        plant_context_advance(loop->model, loop->plants[k], NULL);
+    }
+}
+
+/**
+ * Control plants_count copies of the plant in now towards target with one controller service (shared model)
+ */
+static void run_plants(size_t plants_count,
+                       int target,
+                       current_state *now,
+                       control_model *model,
+                       rt_executor *executor,
+                       double sec)
+{
+    controller_service *service = controller_service_alloc(model, 0, plants_count);
+    current_state **states = malloc(sizeof(current_state *)*plants_count);
+    plant_context **plants = malloc(sizeof(plant_context *)*plants_count);
+    if(service == NULL || states == NULL || plants == NULL){
+        fprintf(stderr, "\nCould not create the controller service\n");
+        exit(EXIT_FAILURE);
+    }
+    for(size_t k = 0; k < plants_count; k++){
+        states[k] = state_alloc(now->x->size, now->current_abs_state);
+        gsl_vector_memcpy(states[k]->x, now->x);
+        plants[k] = plant_context_alloc(model, states[k], target);
+        if(plants[k] == NULL){
+            fprintf(stderr, "\nCould not allocate plant %d\n", (int)k);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("\nControlling %d plants from abstract state %d to abstract state %d...\n", (int)plants_count,
+           now->current_abs_state, target);
+    plants_loop loop = {service, model, plants, plants_count, sec};
+    rt_executor_run(executor, sec, model->d_dyn->time_horizon, plants_period, &loop);
+
+    size_t reached = 0;
+    for(size_t k = 0; k < plants_count; k++){
+        reached += (states[k]->current_abs_state == target);
+    }
+    printf("\nController service: %d plans completed, %d deadlines missed, %d of %d plants reached the target\n",
+           (int)service->completed, (int)service->missed, (int)reached, (int)plants_count);
+
+    //Clean up! (the service first: abandoned computations may still use the plants)
+    controller_service_free(service);
+    for(size_t k = 0; k < plants_count; k++){
+        plant_context_free(plants[k], model);
+        state_free(states[k]);
+    }
+    free(plants);
+    free(states);
+}
+
+/**
+ * cimple [plants]: one plant controlled by ACT(), or that many plants controlled by one controller service
+ */
+int main(int argc, char **argv){
+
+    int plants_count = (argc > 1) ? atoi(argv[1]) : 0;
 
     dd_set_global_constants();
     // Initialize state:
@@ -16,10 +107,43 @@ int main(){
     system_alloc(&now, &s_dyn, &f_cost, &d_dyn);
     system_init(now, s_dyn, f_cost, d_dyn);
 
+    // Precompute the set-up of the control problem for every horizon
+    s_dyn->horizon_family = horizon_family_compute(d_dyn, s_dyn, f_cost);
+
+    // Trace of the safe mode computation and the control loop (decode with tools/cimple_trace_decode)
+    trace_open(TRACE_FILE);
+
+    // Safe mode: reuse the artefacts of an earlier run whose inputs did not change, recompute the others
+    safe_mode_store *store = safe_mode_store_alloc(s_dyn, (int)d_dyn->time_horizon);
+    safe_mode_store_load(store, SAFE_MODE_FILE);
+    thread_pool *pool = thread_pool_alloc(0);
+    compute_safe_mode(d_dyn, s_dyn, store, pool, thread_pool_print_progress, "Safe mode");
+    thread_pool_free(pool);
+    printf("\nSafe mode: %d artefacts reused, %d recomputed\n", (int)store->reused, (int)store->recomputed);
+    if(store->recomputed > 0 && safe_mode_store_save(store, SAFE_MODE_FILE) != 0){
+        fprintf(stderr, "\nCould not write safe mode artefacts to %s\n", SAFE_MODE_FILE);
+    }
+    safe_mode_store_free(store);
+
 
 
+    // Control loop: SCHED_FIFO priority and cpu pinning are optional (0 and -1: default scheduling, no pinning)
+    rt_executor_options executor_options = {0, -1};
+    rt_executor *executor = rt_executor_alloc(&executor_options);
     double sec = 2;
-    ACT(4, now, d_dyn, s_dyn, f_cost, sec);
+    if(plants_count > 0){
+        control_model model = {s_dyn, d_dyn, f_cost};
+        run_plants((size_t)plants_count, 4, now, &model, executor, sec);
+    } else{
+        ACT(4, now, d_dyn, s_dyn, f_cost, executor, sec);
+    }
+    trace_close();
+    rt_executor_statistics statistics;
+    rt_executor_get_statistics(executor, &statistics);
+    printf("\nControl loop: %d periods, %d overruns, release latency %.3fms mean %.3fms max, step %.3fms max\n",
+           (int)statistics.periods, (int)statistics.overruns, statistics.mean_latency*1e3, statistics.max_latency*1e3,
+           statistics.max_execution*1e3);
+    rt_executor_free(executor);
 
     system_dynamics_free(s_dyn);
     discrete_dynamics_free(d_dyn);
@@ -0,0 +1,137 @@
+//
+// Created by L.Jonathan Feldstein
+//
+
+/**
+ * Decoder of the binary trace of the control loop (see cimple_trace.h)
+ *
+ *      cimple_trace_decode [cimple_trace.bin]     (no file: reads stdin)
+ *
+ * Prints one line per event, ordered by time:
+ *
+ *      <seconds since the first event> t<thread> step <step> <type> [cell <cell>] <values>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../cimple_trace.h"
+
+static const char *event_names[TRACE_EVENT_TYPES_COUNT] = {
+        "step",
+        "state",
+        "input",
+        "qp",
+        "qp_inputs",
+        "plan",
+        "plan_reused",
+        "timing",
+        "transition",
+        "fallback",
+        "invariant_set"
+};
+
+static const char *fallback_names[] = {
+        "plan_invalid",
+        "safe_mode",
+        "earlier_input"
+};
+
+/**
+ * Order of the events: the drainer writes them ring by ring
+ */
+static int compare_events(const void *a,
+                          const void *b)
+{
+    const trace_event *first = (const trace_event *)a;
+    const trace_event *second = (const trace_event *)b;
+    if(first->time != second->time){
+        return (first->time < second->time) ? -1 : 1;
+    }
+    if(first->thread != second->thread){
+        return (int)first->thread - (int)second->thread;
+    }
+    return (int)first->offset - (int)second->offset;
+}
+
+/**
+ * Print one event as text
+ */
+static void print_event(const trace_event *event,
+                        uint64_t start)
+{
+    const char *name = (event->type < TRACE_EVENT_TYPES_COUNT) ? event_names[event->type] : "unknown";
+    printf("%.6f t%d step %d %s", (double)(event->time-start)*1e-9, (int)event->thread, (int)event->step, name);
+    if(event->cell >= 0){
+        printf(" cell %d", (int)event->cell);
+    }
+
+    if(event->type == TRACE_FALLBACK && event->count == 1){
+        int reason = (int)event->values[0];
+        if(reason >= 0 && reason < (int)(sizeof(fallback_names)/sizeof(fallback_names[0]))){
+            printf(" %s\n", fallback_names[reason]);
+            return;
+        }
+    }
+    if(event->offset > 0){
+        printf(" [%d..]", (int)event->offset);
+    }
+    for(int i = 0; i < event->count && i < TRACE_EVENT_VALUES; i++){
+        printf(" %.6g", event->values[i]);
+    }
+    printf("\n");
+}
+
+int main(int argc,
+         char *argv[])
+{
+    FILE *file = (argc > 1) ? fopen(argv[1], "rb") : stdin;
+    if(file == NULL){
+        fprintf(stderr, "\nCould not open %s\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    char magic[4];
+    uint32_t header[2];
+    if(fread(magic, 1, 4, file) != 4 || memcmp(magic, "CTRC", 4) != 0 || fread(header, sizeof(uint32_t), 2, file) != 2){
+        fprintf(stderr, "\nNot a trace of the control loop\n");
+        exit(EXIT_FAILURE);
+    }
+    if(header[0] != TRACE_FILE_VERSION || header[1] != sizeof(trace_event)){
+        fprintf(stderr, "\nTrace version %d (events of %d bytes) is not supported by this decoder\n", (int)header[0],
+                (int)header[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    size_t events_count = 0;
+    size_t capacity = 1024;
+    trace_event *events = malloc(capacity*sizeof(trace_event));
+    if(events == NULL){
+        fprintf(stderr, "\nOut of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    while(fread(&events[events_count], sizeof(trace_event), 1, file) == 1){
+        events_count++;
+        if(events_count == capacity){
+            capacity *= 2;
+            trace_event *grown = realloc(events, capacity*sizeof(trace_event));
+            if(grown == NULL){
+                fprintf(stderr, "\nOut of memory\n");
+                exit(EXIT_FAILURE);
+            }
+            events = grown;
+        }
+    }
+
+    qsort(events, events_count, sizeof(trace_event), compare_events);
+    for(size_t i = 0; i < events_count; i++){
+        print_event(&events[i], events[0].time);
+    }
+
+    //Clean up!
+    free(events);
+    if(file != stdin){
+        fclose(file);
+    }
+    return 0;
+}
@@ -9187,6 +9187,10 @@ def write_np_matrix_c_array(f, tab_number, c_array, py_matrix):
 def write_cimple_header(ctrl):
     """
     Create C header file, with the definition of the actions, to correspondant executive file.
+
+    The actions do not block: they hand the ACT to the controller thread and return its handle,
+    an act_impl_event with done_signal and the status of the ACT is posted to the active object once the
+    control loop finished. The header also declares the set-up of the controller the actions need.
     """
     f = StringIO()
     tab = "    "
@@ -9198,7 +9202,43 @@ def write_cimple_header(ctrl):
 #define CIMPLE_ACT_IMPL_H
 
 #include <stdio.h>
-#include "cimple_controller.h"
+#include <qf_port.h>
+#include "cimple_act_async.h"
+
+/**
+ * Event posted once an ACT finished or was cancelled: status tells them apart (see act_status, e.g. ACT_DONE if the
+ * target was reached, ACT_FAILED if not, ACT_CANCELLED if the ACT never started)
+ *
+ * Allocated with Q_NEW() from the event pools of the executive: it fits into the medium-size pool (QEvent and data)
+ * of the autocoded main, no pool of its own is needed.
+ */
+typedef struct act_impl_event{
+
+    QEvent super;
+    int status;
+
+}act_impl_event;
+
+/**
+ * @brief "Constructor" Initializes the system (see cimple_c_from_py.c) and its safe mode and starts the controller
+ *        thread the actions queue their ACT on
+ * @param sec duration of one time step of the control loop in seconds
+ * @return NULL if the controller could not be created
+ */
+act_controller *act_impl_controller_alloc(double sec);
+
+/**
+ * @brief "Destructor" Stops the controller (queued ACTs are cancelled) and deallocates the system
+ * @param controller
+ */
+void act_impl_controller_free(act_controller *controller);
+
+/**
+ * Actions: start the ACT to the target cell on the controller thread and return at once (NULL if it could not be
+ * started). An act_impl_event with done_signal is posted into the queue of active once the ACT finished (or was
+ * cancelled). The state of the plant belongs to the controller until then, the caller checks the returned handle
+ * (act_handle_status()) when the signal arrives and gives it up with act_handle_release().
+ */
 
 """)
     written_actions = []
@@ -9208,8 +9248,8 @@ def write_cimple_header(ctrl):
             continue
 
         # Write action functions
-        f.write(tab + "void ACT_" + str(
-            trans_to) + "(current_state * now, discrete_dynamics * d_dyn, system_dynamics * s_dyn, cost_function * f_cost);\n\n")
+        f.write(tab + "act_handle *ACT_" + str(
+            trans_to) + "(act_controller * controller, QActive * active, QSignal done_signal);\n\n")
         written_actions.append(trans_to)
 
     f.write("#endif //CIMPLE_ACT_IMPL_H")
@@ -9222,6 +9262,12 @@ def write_cimple_file(ctrl):
 
     Functions are only defined by the target cell. (Contrary to the python implementation
     that were defined based on start and end region.)
+
+    The generated actions are called from state machine actions: they only queue the ACT on the
+    controller thread (see cimple_act_async.h), the completion posts an event with the status of
+    the ACT back into the queue of the active object. The event loop thus keeps processing environment
+    events while the controller works. act_impl_controller_alloc() sets up the system (cimple_c_from_py.c),
+    its safe mode and the controller once, e.g. in the constructor of the Impl of the control modes.
     """
     f = StringIO()
     tab = "    "
@@ -9230,7 +9276,110 @@ def write_cimple_file(ctrl):
 //
 
 #include <stdio.h>
-#include "cimple_controller.h"
+#include <stdlib.h>
+#include <cdd.h>
+#include "act_impl.h"
+#include "cimple_c_from_py.h"
+#include "cimple_mpc_computation.h"
+#include "cimple_safe_mode.h"
+#include "cimple_safe_mode_storage.h"
+#include "cimple_thread_pool.h"
+
+/**
+ * "Constructor" Initializes the system and its safe mode and starts the controller thread
+ */
+act_controller *act_impl_controller_alloc(double sec){
+    dd_set_global_constants();
+    system_dynamics *s_dyn;
+    cost_function *f_cost;
+    discrete_dynamics *d_dyn;
+    current_state *now;
+
+    system_alloc(&now, &s_dyn, &f_cost, &d_dyn);
+    system_init(now, s_dyn, f_cost, d_dyn);
+
+    // Precompute the set-up of the control problem for every horizon
+    s_dyn->horizon_family = horizon_family_compute(d_dyn, s_dyn, f_cost);
+
+    // Safe mode: reuse the artefacts of an earlier run whose inputs did not change, recompute the others
+    safe_mode_store *store = safe_mode_store_alloc(s_dyn, (int)d_dyn->time_horizon);
+    safe_mode_store_load(store, SAFE_MODE_FILE);
+    thread_pool *pool = thread_pool_alloc(0);
+    compute_safe_mode(d_dyn, s_dyn, store, pool, NULL, NULL);
+    thread_pool_free(pool);
+    if (store->recomputed > 0 && safe_mode_store_save(store, SAFE_MODE_FILE) != 0){
+        fprintf(stderr, "\\nCould not write safe mode artefacts to %s\\n", SAFE_MODE_FILE);
+    }
+    safe_mode_store_free(store);
+
+    act_controller *controller = act_controller_alloc(now, d_dyn, s_dyn, f_cost, NULL, sec);
+    if (controller == NULL){
+        system_dynamics_free(s_dyn);
+        discrete_dynamics_free(d_dyn);
+        cost_function_free(f_cost);
+        state_free(now);
+        dd_free_global_constants();
+    }
+    return controller;
+}
+
+/**
+ * "Destructor" Stops the controller and deallocates the system
+ */
+void act_impl_controller_free(act_controller *controller){
+    system_dynamics *s_dyn = controller->s_dyn;
+    cost_function *f_cost = controller->f_cost;
+    discrete_dynamics *d_dyn = controller->d_dyn;
+    current_state *now = controller->now;
+
+    act_controller_free(controller);
+    // Clean up!
+    system_dynamics_free(s_dyn);
+    discrete_dynamics_free(d_dyn);
+    cost_function_free(f_cost);
+    state_free(now);
+    dd_free_global_constants();
+}
+
+/**
+ * Active object and signal the completion of an ACT is posted to
+ */
+typedef struct act_impl_post{
+
+    QActive *active;
+    QSignal signal;
+
+}act_impl_post;
+
+/**
+ * Completion of an ACT (controller thread): post the signal with the status into the queue of the active object
+ */
+static void act_impl_completion(act_handle *handle, int status, void *context){
+    act_impl_post *post = (act_impl_post *)context;
+    act_impl_event *done = Q_NEW(act_impl_event, post->signal);
+    done->status = status;
+    QActive_postFIFO(post->active, (QEvent *)done);
+    // Clean up!
+    free(post);
+}
+
+/**
+ * Queue the ACT to target_cell on the controller thread without waiting for it
+ */
+static act_handle *act_impl_start(act_controller * controller, int target_cell, QActive * active, QSignal done_signal){
+    act_impl_post *post = malloc(sizeof(act_impl_post));
+    if (post == NULL){
+        return NULL;
+    }
+    post->active = active;
+    post->signal = done_signal;
+
+    act_handle *handle = ACT_async(controller, target_cell, act_impl_completion, post);
+    if (handle == NULL){
+        free(post);
+    }
+    return handle;
+}
 
 """)
     written_actions = []
@@ -9240,26 +9389,10 @@ def write_cimple_file(ctrl):
             continue
 
         # Write action functions
-        f.write("void ACT_" + str(
-            trans_to) + "(current_state * now, discrete_dynamics * d_dyn, system_dynamics * s_dyn, cost_function * f_cost){\n")
+        f.write("act_handle *ACT_" + str(
+            trans_to) + "(act_controller * controller, QActive * active, QSignal done_signal){\n")
         f.write(tab + "int target_cell =" + str(trans_to[1::]) + ";\n")
-        f.write(tab + """printf("Computing control sequence to go from cell %d to cell """ + str(
-            trans_to) + """...", (*now).current_cell);\n""")
-        f.write(tab + "fflush(stdout);\n\n")
-        f.write(tab + "gsl_matrix * u = gsl_matrix_alloc(now->x->size, d_dyn->time_horizon);\n")
-        f.write(tab + "get_input(u, now, d_dyn, s_dyn, target_cell, f_cost);\n")
-        f.write(tab + """printf("Applying it...");\n""")
-        f.write(tab + "fflush(stdout);\n")
-        f.write(tab + "apply_control(now->x, u, s_dyn->A, s_dyn->B);\n")
-
-        f.write(tab + """printf("New state:");\n""")
-        f.write(tab + """gsl_vector_print(now->x, "now->");\n""")
-
-        # // int current_cell = find_discrete_state(now->x, now->d_dyn.ppp);
-        # // TODO:printf("That is in discrete cell %d", now->current_cell);
-        f.write(tab + "fflush(stdout);\n")
-        f.write(tab + "// Clean up!\n")
-        f.write(tab + "gsl_matrix_free(u);\n")
+        f.write(tab + "return act_impl_start(controller, target_cell, active, done_signal);\n")
         f.write("}")
         f.write("\n\n")
         written_actions.append(trans_to)
@@ -9293,12 +9426,10 @@ def write_init_file(ctrl, sys_dyn, disc_dynamics, N=5, ordinance=2, mid_weight=0
     :param name:
     :return:
     """
-    from scipy import linalg as lg
     import polytope as pc
     f = StringIO()
     tab = "    "
     x0 = np.zeros(sys_dyn.A.shape[1])
-    disturbance_ind = range(1, N)
     ######int main#########
     # R, Q, r
 
@@ -9330,127 +9461,19 @@ def write_init_file(ctrl, sys_dyn, disc_dynamics, N=5, ordinance=2, mid_weight=0
         raise Exception("get_input: "
                         "Q must be square and have side N * dim(input space)")
 
-    # LU, MU, GU, An, Ak, Uset, E_default, L_default, K_hat
+    # Auxiliary MPC matrices (LU, MU, GU, A_N, A_K, Ct, B_diag, E_diag, E_default, L_default, K_hat)
+    # are not emitted: they are computed in C by aux_matrices_init() from A, B, E, K, Uset and N.
 
     A = sys_dyn.A
     B = sys_dyn.B
     E = sys_dyn.E
-    K = sys_dyn.K
 
     D = sys_dyn.Wset
-    PU = sys_dyn.Uset
 
     n = A.shape[1]  # State space dimension
     m = B.shape[1]  # Input space dimension
     p = E.shape[1]  # Disturbance space dimension
 
-    LUn = np.shape(PU.A)[0]
-    L_default = np.zeros([n * N, n + (m * N)])
-    E_default = np.zeros([n * N, p * N])
-    LU = np.zeros([LUn * N, n + N * m])
-
-    MU = np.tile(PU.b.reshape(PU.b.size, 1), (N, 1))
-
-    GU = np.zeros([LUn * N, p * N])
-
-    K_hat = np.tile(K, (N, 1))
-
-    B_diag = sys_dyn.B
-    E_diag = sys_dyn.E
-    for i in range(N - 1):
-        B_diag = lg.block_diag(B_diag, B)
-    for i in range(N - 1):
-        E_diag = lg.block_diag(E_diag, E)
-
-    A_it = sys_dyn.A.copy()
-    A_row = np.zeros([n, n * N])
-    A_K = np.zeros([n * N, n * N])
-    A_N = np.zeros([n * N, n])
-
-    for i in range(N):
-        A_row = sys_dyn.A.dot(A_row)
-        A_row[np.ix_(
-            range(n),
-            range(i * n, (i + 1) * n)
-        )] = np.eye(n)
-
-        A_N[np.ix_(
-            range(i * n, (i + 1) * n),
-            range(n)
-        )] = A_it
-
-        A_K[np.ix_(
-            range(i * n, (i + 1) * n),
-            range(A_K.shape[1])
-        )] = A_row
-
-        A_it = sys_dyn.A.dot(A_it)
-    Ct = A_K.dot(B_diag)
-
-    A_n = np.eye(n)
-    A_k = np.zeros([n, n * N])
-
-    for i in range(N + 1):
-
-        ######### FOR G #########
-        if i in disturbance_ind:
-
-            idx = np.ix_(
-                range(n * i, n * (i + 1)),
-                range(E_default.shape[1])
-            )
-            E_default[idx] = A_k.dot(E_diag)
-
-            if (PU.A.shape[1] == m + n) and (i < N):
-                A_k_E_diag = A_k.dot(E_diag)
-                d_mult = np.vstack([np.zeros([m, p * N]), A_k_E_diag])
-
-                idx = np.ix_(range(LUn * i, LUn * (i + 1)), range(p * N))
-                GU[idx] = PU.A.dot(d_mult)
-
-        ######### FOR L #########
-        AB_line = np.hstack([A_n, A_k.dot(B_diag)])
-
-        if i >= N:
-            continue
-
-        idx = np.ix_(
-            range(n * i, n * (i + 1)),
-            range(L_default.shape[1])
-        )
-        L_default[idx] = AB_line
-        if PU.A.shape[1] == m:
-            idx = np.ix_(
-                range(i * LUn, (i + 1) * LUn),
-                range(n + m * i, n + m * (i + 1))
-            )
-            LU[idx] = PU.A
-        elif PU.A.shape[1] == m + n:
-            uk_line = np.zeros([m, n + m * N])
-
-            idx = np.ix_(range(m), range(n + m * i, n + m * (i + 1)))
-            uk_line[idx] = np.eye(m)
-
-            A_mult = np.vstack([uk_line, AB_line])
-
-            b_mult = np.zeros([m + n, 1])
-            b_mult[range(m, m + n), :] = A_k.dot(K_hat)
-
-            idx = np.ix_(
-                range(i * LUn, (i + 1) * LUn),
-                range(n + m * N)
-            )
-            LU[idx] = PU.A.dot(A_mult)
-
-            MU[range(i * LUn, (i + 1) * LUn), :] -= PU.A.dot(b_mult)
-
-        ####### Iterate #########
-        A_n = A.dot(A_n)
-        A_k = A.dot(A_k)
-
-        idx = np.ix_(range(n), range(i * n, (i + 1) * n))
-        A_k[idx] = np.eye(n)
-
     D_extreme = pc.extreme(D)
     nv = D_extreme.shape[0]
     dim = D_extreme.shape[1]
@@ -9708,30 +9731,9 @@ void system_init(current_state *now, system_dynamics *s_dyn,cost_function *f_cos
     f.write(
         tab + """gsl_vector_from_array(s_dyn->W_set->G, sys_WSetG, "s_dyn->W_set->G");\n""" + tab + """free(sys_WSetG);\n""")
 
-    f.write(tab + "double *sys_help_A_K = malloc(n* time_horizon * n * time_horizon* sizeof (double));\n")
-    write_np_matrix_c_array(f, 1, "sys_help_A_K", A_K)
-    f.write(
-        tab + """gsl_matrix_from_array(s_dyn->aux_matrices->A_K, sys_help_A_K, "s_dyn->aux_matrices->A_K");\n""" + tab + """free(sys_help_A_K);\n""")
-
-    f.write(tab + "double *sys_help_A_N = malloc(n* time_horizon * n * sizeof (double));\n")
-    write_np_matrix_c_array(f, 1, "sys_help_A_N", A_N)
-    f.write(
-        tab + """gsl_matrix_from_array(s_dyn->aux_matrices->A_N, sys_help_A_N, "s_dyn->aux_matrices->A_N");\n""" + tab + """free(sys_help_A_N);\n""")
-
-    f.write(tab + "double *sys_help_E_diag = malloc(n*time_horizon* p*time_horizon* sizeof (double));\n")
-    write_np_matrix_c_array(f, 1, "sys_help_E_diag", E_diag)
-    f.write(
-        tab + """gsl_matrix_from_array(s_dyn->aux_matrices->E_diag, sys_help_E_diag, "s_dyn->aux_matrices->E_diag");\n""" + tab + """free(sys_help_E_diag);\n""")
-
-    f.write(tab + "double *sys_help_B_diag = malloc(n*time_horizon* m*time_horizon* sizeof (double));\n")
-    write_np_matrix_c_array(f, 1, "sys_help_B_diag", B_diag)
-    f.write(
-        tab + """gsl_matrix_from_array(s_dyn->aux_matrices->B_diag, sys_help_B_diag, "s_dyn->aux_matrices->B_diag");\n""" + tab + """free(sys_help_B_diag);\n""")
-
-    f.write(tab + "double *sys_help_K_hat = malloc(n* time_horizon* sizeof (double));\n")
-    write_np_matrix_c_array(f, 1, "sys_help_K_hat", K_hat)
-    f.write(
-        tab + """gsl_vector_from_array(s_dyn->aux_matrices->K_hat, sys_help_K_hat, "s_dyn->aux_matrices->K_hat");\n""" + tab + """free(sys_help_K_hat);\n""")
+    f.write("""
+    // Compute auxiliary matrices from the system dynamics
+    aux_matrices_init(s_dyn, time_horizon);\n""")
 
     f.write(tab + "double *sys_help_D_vertices = malloc(d_ext_i* d_ext_j* sizeof(double));\n")
     write_np_matrix_c_array(f, 1, "sys_help_D_vertices", D_vertices)
@@ -9743,36 +9745,6 @@ void system_init(current_state *now, system_dynamics *s_dyn,cost_function *f_cos
     f.write(
         tab + """gsl_matrix_from_array(s_dyn->aux_matrices->D_one_step, sys_help_D_one_step,"s_dyn->aux_matrices->D_one_step");\n""" + tab + """free(sys_help_D_one_step);\n""")
 
-    f.write(tab + "double *sys_help_L_default = malloc(n*time_horizon * (n+m*(time_horizon))* sizeof (double));\n")
-    write_np_matrix_c_array(f, 1, "sys_help_L_default", L_default)
-    f.write(
-        tab + """gsl_matrix_from_array(s_dyn->aux_matrices->L_default, sys_help_L_default, "s_dyn->aux_matrices->L_default");\n""" + tab + """free(sys_help_L_default);\n""")
-
-    f.write(tab + "double *sys_help_E_default = malloc(n* time_horizon* p* time_horizon* sizeof (double));\n")
-    write_np_matrix_c_array(f, 1, "sys_help_E_default", E_default)
-    f.write(
-        tab + """gsl_matrix_from_array(s_dyn->aux_matrices->E_default, sys_help_E_default, "s_dyn->aux_matrices->E_default");\n""" + tab + """free(sys_help_E_default);\n""")
-
-    f.write(tab + "double *sys_help_Ct = malloc(n*time_horizon*m*time_horizon*sizeof(double));\n")
-    write_np_matrix_c_array(f, 1, "sys_help_Ct", Ct)
-    f.write(
-        tab + """gsl_matrix_from_array(s_dyn->aux_matrices->Ct, sys_help_Ct, "s_dyn->aux_matrices->Ct");\n""" + tab + """free(sys_help_Ct);\n""")
-
-    f.write(tab + "double *sys_help_MU = malloc(u_set_size*time_horizon * sizeof(double));\n")
-    write_np_matrix_c_array(f, 1, "sys_help_MU", MU)
-    f.write(
-        tab + """gsl_vector_from_array(s_dyn->aux_matrices->MU, sys_help_MU, "s_dyn->aux_matrices->MU");\n""" + tab + """free(sys_help_MU);\n""")
-
-    f.write(tab + "double *sys_help_GU = malloc(u_set_size*time_horizon* p*time_horizon* sizeof(double));\n")
-    write_np_matrix_c_array(f, 1, "sys_help_GU", GU)
-    f.write(
-        tab + """gsl_matrix_from_array(s_dyn->aux_matrices->GU, sys_help_GU,"s_dyn->aux_matrices->GU");\n""" + tab + """free(sys_help_GU);\n""")
-
-    f.write(tab + "double *sys_help_LU = malloc(u_set_size*time_horizon * (n+m*(time_horizon))* sizeof (double));\n")
-    write_np_matrix_c_array(f, 1, "sys_help_LU", LU)
-    f.write(
-        tab + """gsl_matrix_from_array(s_dyn->aux_matrices->LU, sys_help_LU, "s_dyn->aux_matrices->LU");\n""" + tab + """free(sys_help_LU);\n""")
-
     f.write("""
     // Set cost function\n""")
     f.write(tab + "double *cf_R = malloc(n* time_horizon* n* time_horizon* sizeof (double));\n")